@@ -42,7 +42,9 @@
 
 // Project headers
 
+#include "pvr/export.h"
 #include "pvr/Math.h"
+#include "pvr/SmallVector.h"
 #include "pvr/Strings.h"
 #include "pvr/Types.h"
 
@@ -105,6 +107,84 @@ private:
 
 };
 
+//----------------------------------------------------------------------------//
+// BVH
+//----------------------------------------------------------------------------//
+
+/*! \class BVH
+  \brief Bounding volume hierarchy over a set of bounding boxes. Used to find
+  the boxes that contain a point, or that a ray or box touches, without 
+  testing every box.
+
+  Items are referred to by their index in the array passed to build(). 
+  Empty boxes are taken to mean 'unbounded', and are returned by every 
+  query. Queries are const and may be called from multiple threads.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC BVH
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<BBox>       BBoxVec;
+  typedef SmallVector<size_t, 16> IndexVec;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Builds the hierarchy. Replaces any previous contents.
+  void build(const BBoxVec &bounds);
+  //! Appends the items whose box contains the point
+  void pointQuery(const Vector &p, IndexVec &result) const;
+  //! Appends the items whose box the ray passes through
+  void rayQuery(const Ray &ray, IndexVec &result) const;
+  //! Appends the items whose box overlaps the given box
+  void boxQuery(const BBox &box, IndexVec &result) const;
+  //! Returns the number of items
+  size_t size() const
+  { return m_items.size() + m_unbounded.size(); }
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Interior nodes store the index of their second child. The first child
+  //! immediately follows the node. Leaves store a range of m_items.
+  struct Node
+  {
+    BBox   bounds;
+    size_t first;
+    size_t count;
+    size_t secondChild;
+    bool   isLeaf() const
+    { return count > 0; }
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Recursively builds the subtree for m_items[first, first + count)
+  void buildNode(const BBoxVec &bounds, const size_t first, 
+                 const size_t count);
+  //! Traverses the hierarchy, appending the items of all leaves whose 
+  //! boxes pass the given test, and whose own box also does.
+  template <typename Test_T>
+  void query(const Test_T &test, IndexVec &result) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Nodes, in depth first order
+  std::vector<Node>   m_nodes;
+  //! Bounded items, ordered by leaf
+  std::vector<size_t> m_items;
+  //! Bounds of each bounded item, in the same order as m_items
+  BBoxVec             m_itemBounds;
+  //! Items with empty bounds
+  std::vector<size_t> m_unbounded;
+
+};
+
 //----------------------------------------------------------------------------//
 // Template implementations
 //----------------------------------------------------------------------------//
@@ -54,6 +54,7 @@
 #include "pvr/export.h"
 #include "pvr/Curve.h"
 #include "pvr/Exception.h"
+#include "pvr/RenderState.h"
 #include "pvr/Time.h"
 #include "pvr/Types.h"
 
@@ -90,6 +91,10 @@ namespace Render {
   PTime refers to the time between shutter open and shutter close, which 
   defines its own [0,1] interval.
 
+  The transforms that take a RayState instead of a time resolve the 
+  transform once per ray and cache it in the ray's TransformCache, which 
+  saves finding the motion interval at every sample along the ray.
+
   It is assumed that the Curve<T> instances used to provide parameters to
   the camera are adjusted so that 0.0 refers to shutter open and 1.0 refers to
   shutter close time.
@@ -129,6 +134,8 @@ public:
   void setPosition(const Util::VectorCurve &curve);
   //! Returns the position at the given time
   Vector position(const PTime time) const;
+  //! Returns the position at the time of the given ray
+  Vector position(const RayState &state) const;
   //! Sets the (potentially time-varying) orientation
   void setOrientation(const Util::QuatCurve &curve);
   //! Returns the position at the given time
@@ -155,6 +162,9 @@ public:
   Vector worldToCamera(const Vector &wsP, const PTime time) const;
   //! Returns the world-space coordinate given a camera-space coordinate.
   Vector cameraToWorld(const Vector &csP, const PTime time) const;
+  //! Returns the camera-space coordinate given a world-space coordinate,
+  //! at the time of the given ray.
+  Vector worldToCamera(const Vector &wsP, const RayState &state) const;
 
   //! Returns the world to camera transform matrices
   const MatrixVec& worldToCameraMatrices() const;
@@ -171,6 +181,14 @@ public:
   virtual Vector worldToRaster(const Vector &wsP, const PTime time) const = 0;
   //! Returns the world-space coordinate given a raster-space coordinate.
   virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const = 0;
+  //! Returns the screen-space coordinate given a world-space coordinate,
+  //! at the time of the given ray. Defaults to worldToScreen(wsP, time).
+  virtual Vector worldToScreen(const Vector &wsP, 
+                               const RayState &state) const;
+  //! Returns the raster-space coordinate given a world-space coordinate,
+  //! at the time of the given ray. Defaults to worldToRaster(wsP, time).
+  virtual Vector worldToRaster(const Vector &wsP, 
+                               const RayState &state) const;
   //! Whether the camera's transforms are well-defined behind the camera,
   //! i.e. where csP.z < 0.0
   virtual bool canTransformNegativeCamZ() const = 0;
@@ -195,6 +213,13 @@ protected:
   //! matrix transformations, given a [0,1] parametric time sample
   Vector transformPoint(const Vector &p, const MatrixVec &matrices,
                         const PTime time) const;
+  //! Transforms the given point at the time of the given ray. The matrices
+  //! are only resolved the first time they're used along the ray.
+  Vector transformPoint(const Vector &p, const MatrixVec &matrices,
+                        const RayState &state) const;
+  //! Finds the two matrices that bracket the given time
+  ResolvedTransform resolveTransform(const MatrixVec &matrices,
+                                     const PTime time) const;
   //! Computes the camera to world transform at the given time
   //! \param time Time in [0,1] range
   Matrix computeCameraToWorld(const PTime time) const;
@@ -211,6 +236,9 @@ protected:
 
   //! Number of time samples to use.
   unsigned int m_numSamples;
+  //! Whether the camera doesn't move during the shutter interval, in which
+  //! case only the first of each set of matrices needs to be used.
+  bool m_isStatic;
 
   //! Transformation matrices representing camera to world transform
   //! for the [0,dt] time interval
@@ -268,6 +296,10 @@ public:
   virtual Vector screenToWorld(const Vector &ssP, const PTime time) const;
   virtual Vector worldToRaster(const Vector &wsP, const PTime time) const;
   virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const;
+  virtual Vector worldToScreen(const Vector &wsP, 
+                               const RayState &state) const;
+  virtual Vector worldToRaster(const Vector &wsP, 
+                               const RayState &state) const;
   virtual bool canTransformNegativeCamZ() const;
 
   // Cloning -------------------------------------------------------------------
@@ -380,6 +412,10 @@ public:
   virtual Vector screenToWorld(const Vector &ssP, const PTime time) const;
   virtual Vector worldToRaster(const Vector &wsP, const PTime time) const;
   virtual Vector rasterToWorld(const Vector &rsP, const PTime time) const;
+  virtual Vector worldToScreen(const Vector &wsP, 
+                               const RayState &state) const;
+  virtual Vector worldToRaster(const Vector &wsP, 
+                               const RayState &state) const;
   virtual bool canTransformNegativeCamZ() const;
 
   // Cloning -------------------------------------------------------------------
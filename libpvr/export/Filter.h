@@ -34,6 +34,7 @@
 
 // System headers
 
+#include <algorithm>
 #include <cmath>
 
 #include <boost/shared_ptr.hpp>
@@ -53,19 +54,60 @@ namespace Filter {
 // Filter functions
 //----------------------------------------------------------------------------//
 
+//! Computes the normalized weights of the Filt_T::width taps around the
+//! fractional position x. The kernels are separable, so a 3D lookup only
+//! needs the weights along each axis, rather than evaluating the filter 
+//! for every tap.
+template <typename Filt_T>
+void filterWeights(const float x, const Filt_T &filter, 
+                   float weights[Filt_T::width])
+{
+  const float t = x + (Filt_T::width / 2) - 1;
+  float sum(0.0);
+  for (int i = 0; i < Filt_T::width; i++) {
+    weights[i] = filter(std::abs(i - t));
+    sum += weights[i];
+  }
+  for (int i = 0; i < Filt_T::width; i++) {
+    weights[i] /= sum;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the sum of values weighted by the outer product of the 
+//! per-axis weights.
+template <typename Data_T, int Width>
+Data_T weightedSum3D(const float wx[Width], const float wy[Width], 
+                     const float wz[Width], 
+                     const Data_T values[Width][Width][Width])
+{
+  Data_T result(0.0);
+  for (int i = 0; i < Width; i++) {
+    for (int j = 0; j < Width; j++) {
+      Data_T zSum(0.0);
+      for (int k = 0; k < Width; k++) {
+        zSum += wz[k] * values[i][j][k];
+      }
+      result += (wx[i] * wy[j]) * zSum;
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename Data_T, typename Filt_T>
 Data_T filter1D(const float x, const Data_T values[Filt_T::width], 
                 const Filt_T &filter)
 {
+  float weights[Filt_T::width];
+  filterWeights(x, filter, weights);
   Data_T result(0.0);
-  float weight(0.0);
   for (int i = 0; i < Filt_T::width; i++) {
-    const float t = x + (Filt_T::width / 2) - 1;
-    const float filterValue = filter(std::abs(i - t));
-    result += filterValue * values[i];
-    weight += filterValue;
+    result += weights[i] * values[i];
   }
-  return result / weight;
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -75,11 +117,16 @@ Data_T filter2D(const float x, const float y,
                 const Data_T values[Filt_T::width][Filt_T::width], 
                 const Filt_T &filter)
 {
-  Data_T yVals[Filt_T::width];
+  float wx[Filt_T::width], wy[Filt_T::width];
+  filterWeights(x, filter, wx);
+  filterWeights(y, filter, wy);
+  Data_T result(0.0);
   for (int i = 0; i < Filt_T::width; i++) {
-    yVals[i] = filter1D<Data_T,Filt_T>(y, values[i], filter);
+    for (int j = 0; j < Filt_T::width; j++) {
+      result += (wx[i] * wy[j]) * values[i][j];
+    }
   }
-  return filter1D<Data_T,Filt_T>(x, yVals, filter);
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -89,13 +136,54 @@ Data_T filter3D(const float x, const float y, const float z,
                 const Data_T values[Filt_T::width][Filt_T::width][Filt_T::width], 
                 const Filt_T &filter)
 {
-  Data_T yzVals[Filt_T::width];
-  for (int i = 0; i < Filt_T::width; i++) {
-    yzVals[i] = filter2D<Data_T,Filt_T>(y, z, values[i], filter);
-  }
-  return filter1D<Data_T,Filt_T>(x, yzVals, filter);
+  float wx[Filt_T::width], wy[Filt_T::width], wz[Filt_T::width];
+  filterWeights(x, filter, wx);
+  filterWeights(y, filter, wy);
+  filterWeights(z, filter, wz);
+  return weightedSum3D<Data_T, Filt_T::width>(wx, wy, wz, values);
 }
 
+//----------------------------------------------------------------------------//
+// WeightTable
+//----------------------------------------------------------------------------//
+
+/*! \class WeightTable
+  \brief Precomputed filterWeights() over the [0, 1] range of fractional
+  positions.
+
+  Lookups linearly interpolate between the two nearest entries, so the
+  weights still sum to one. With the default resolution the error is far
+  below what is visible, and no filter evaluations (exp() in the case of
+  the Gaussian) remain in the lookup.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Filt_T, int Res = 256>
+class WeightTable
+{
+public:
+  WeightTable(const Filt_T &filter = Filt_T())
+  {
+    for (int r = 0; r <= Res; r++) {
+      filterWeights(static_cast<float>(r) / Res, filter, m_weights[r]);
+    }
+  }
+  //! Returns the weights for fractional position x, in [0, 1]
+  void weights(const float x, float weights[Filt_T::width]) const
+  {
+    const float pos  = std::min(std::max(x, 0.0f), 1.0f) * Res;
+    const int   r    = std::min(static_cast<int>(pos), Res - 1);
+    const float frac = pos - r;
+    for (int i = 0; i < Filt_T::width; i++) {
+      weights[i] = (1.0f - frac) * m_weights[r][i] + 
+        frac * m_weights[r + 1][i];
+    }
+  }
+private:
+  float m_weights[Res + 1][Filt_T::width];
+};
+
 //----------------------------------------------------------------------------//
 // MitchellNetravali
 //----------------------------------------------------------------------------//
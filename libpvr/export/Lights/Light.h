@@ -117,7 +117,7 @@ public:
   //! NullOccluder assigned.
   void                setOccluder(Occluder::CPtr occluder);
   //! Returns the light's Occluder.
-  Occluder::CPtr      occluder() const;
+  const Occluder::CPtr& occluder() const;
 
 protected:
 
@@ -0,0 +1,146 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file MajorantGrid.h
+  Contains the MajorantGrid class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_MAJORANTGRID_H__
+#define __INCLUDED_PVR_MAJORANTGRID_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <vector>
+
+// Library headers
+
+#include <boost/shared_ptr.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Types.h"
+#include "pvr/RaymarchSamplers/RaymarchSampler.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// MajorantGrid
+//----------------------------------------------------------------------------//
+
+/*! \class MajorantGrid
+  \brief Coarse uniform grid storing an upper bound on the extinction
+  coefficient in each cell.
+
+  Used by tracking raymarchers, which sample free-flight distances against
+  the majorant. Majorants are scalar, the largest of the color channels, so
+  that a single distance can be sampled for all channels.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC MajorantGrid
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(MajorantGrid);
+
+  // Structs -------------------------------------------------------------------
+
+  //! Part of a ray with constant majorant
+  struct Segment
+  {
+    Segment(const double start, const double end, const float mu)
+      : t0(start), t1(end), majorant(mu)
+    { }
+    double t0;
+    double t1;
+    float  majorant;
+  };
+
+  typedef std::vector<Segment> SegmentVec;
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Builds the grid over the bounds of the given volume, by querying the
+  //! sampler for the maximum extinction of each cell.
+  //! \param resolution Number of cells along the longest axis of the 
+  //! volume's bounds.
+  MajorantGrid(const RaymarchSampler &sampler, const Volume &volume,
+               const size_t resolution);
+  //! Factory method
+  static Ptr create(const RaymarchSampler &sampler, const Volume &volume,
+                    const size_t resolution)
+  { return Ptr(new MajorantGrid(sampler, volume, resolution)); }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Splits the part of the ray between t0 and t1 into the segments that
+  //! pass through each grid cell. Neighboring cells with the same
+  //! majorant are merged, and parts of the ray outside the grid are left
+  //! out, since the majorant is zero there.
+  void         segments(const Ray &wsRay, const double t0, const double t1,
+                        SegmentVec &result) const;
+  //! Returns the majorant of a given cell
+  float        majorant(const int i, const int j, const int k) const
+  { return m_majorants[(k * m_res.y + j) * m_res.x + i]; }
+  //! Returns the grid resolution
+  Imath::V3i   resolution() const
+  { return m_res; }
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! World space bounds of the grid
+  BBox               m_wsBounds;
+  //! Number of cells along each axis
+  Imath::V3i         m_res;
+  //! World space size of each cell
+  Vector             m_cellSize;
+  //! Majorant of each cell, x varying fastest
+  std::vector<float> m_majorants;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -108,6 +108,12 @@ T min(const Imath::Vec3<T> &vec);
 
 //----------------------------------------------------------------------------//
 
+//! Component-wise max of two Vec3<T>
+template <typename T>
+Imath::Vec3<T> max(const Imath::Vec3<T> &a, const Imath::Vec3<T> &b);
+
+//----------------------------------------------------------------------------//
+
 //! Fits a value from range 1 to range 2
 //! \param t Value to fit
 //! \param min Old range min
@@ -328,6 +334,15 @@ T min(const Imath::Vec3<T> &vec)
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+Imath::Vec3<T> max(const Imath::Vec3<T> &a, const Imath::Vec3<T> &b)
+{
+  return Imath::Vec3<T>(std::max(a.x, b.x), std::max(a.y, b.y), 
+                        std::max(a.z, b.z));
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename S, typename T>
 S fit(const T &t, const T &min, const T &max, const S &newMin, const S &newMax)
 {
@@ -90,7 +90,8 @@ public:
   //! Enumerates data structures supported by modeler
   enum DataStructure {
     DenseBufferType,
-    SparseBufferType
+    SparseBufferType,
+    TreeBufferType
   };
 
   //! Enumerates supported sparse block sizes
@@ -100,6 +101,15 @@ public:
     SparseBlockSize32
   };
 
+  //! Enumerates the storage types that the voxel buffer can be output as.
+  //! Scalar storage keeps the average of the color channels.
+  enum Storage {
+    ColorStorage,
+    HalfColorStorage,
+    ScalarStorage,
+    HalfScalarStorage
+  };
+
   // Exceptions ----------------------------------------------------------------  
 
   DECLARE_PVR_RT_EXC(InvalidPrimitiveException, "Invalid primitive:");
@@ -132,6 +142,9 @@ public:
   void setDataStructure(const DataStructure dataStructure);
   //! Sets the block size in the case of a sparse voxel buffer
   void setSparseBlockSize(const SparseBlockSize size);
+  //! Sets the storage type used by saveBuffer() and storageBuffer(). 
+  //! Modeling always takes place in a full precision color buffer.
+  void setStorage(const Storage storage);
   //! Sets the camera to be used during rendering. Required for frustum mappings
   void setCamera(Render::PerspectiveCamera::CPtr camera);
 
@@ -151,10 +164,17 @@ public:
   //! complete the ModelerInput objects are purged from the list of current 
   //! inputs.
   void execute();
-  //! Saves the state of the voxel buffer to disk.
+  //! Saves the state of the voxel buffer to disk. Tree buffers are 
+  //! written as sparse buffers with blocks the size of their leaves, 
+  //! since Field3D files can't hold them.
   void saveBuffer(const std::string &filename) const;
   //! Returns the current buffer
   VoxelBuffer::Ptr buffer() const;
+  //! Returns a copy of the current buffer converted to the storage type, 
+  //! or the buffer itself for ColorStorage. Sparse buffers stay sparse, 
+  //! and tree buffers become sparse. 
+  //! The result can be passed to VoxelVolume::setField().
+  Field3D::FieldRes::Ptr storageBuffer() const;
 
 private:
 
@@ -173,6 +193,8 @@ private:
   DataStructure                   m_dataStructure;
   //! Current sparse block size
   SparseBlockSize                 m_sparseBlockSize;
+  //! Current output storage type
+  Storage                         m_storage;
   //! List of current inputs to the Modeler. This will be cleared by the 
   //! execute() call. 
   std::vector<ModelerInput::Ptr>  m_inputs;
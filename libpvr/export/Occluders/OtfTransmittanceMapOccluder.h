@@ -36,6 +36,8 @@
 
 // Library headers
 
+#include <boost/thread/mutex.hpp>
+
 // Project headers
 
 #include "pvr/export.h"
@@ -98,6 +100,8 @@ protected:
   size_t offset(const size_t x, const size_t y) const
   { return x + m_resolution.x * y; }
   void updateCoordinate(const Vector &rsP) const;
+  //! Traces the transmittance function for the given pixel and stores it,
+  //! unless another thread got there first.
   void updatePixel(const size_t x, const size_t y) const;
 
   // Data members --------------------------------------------------------------
@@ -110,6 +114,8 @@ protected:
   Imath::V2i                m_resolution;
   mutable DeepImage         m_transmittanceMap;
   mutable std::vector<char> m_computed;
+  //! Guards m_transmittanceMap and m_computed when rendering multithreaded
+  mutable boost::mutex      m_mutex;
 };
 
 //----------------------------------------------------------------------------//
@@ -36,6 +36,8 @@
 
 // Library headers
 
+#include <boost/thread/mutex.hpp>
+
 #include <Field3D/FieldInterp.h>
 
 // Project headers
@@ -91,6 +93,8 @@ protected:
 
   // Utility methods -----------------------------------------------------------
 
+  //! Traces the transmittance for the given voxel and stores it in m_buffer,
+  //! unless another thread got there first.
   void updateVoxel(const int i, const int j, const int k) const;
 
   // Data members --------------------------------------------------------------
@@ -98,6 +102,8 @@ protected:
   Renderer::CPtr m_renderer;
   const Vector m_wsLightPos;
   mutable DenseBuffer m_buffer;
+  //! Guards the lazy updates of m_buffer when rendering multithreaded
+  mutable boost::mutex m_mutex;
   //! Linear interpolator
   Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
 
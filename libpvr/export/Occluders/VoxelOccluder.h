@@ -34,9 +34,9 @@
 
 // System headers
 
-// Library headers
+#include <vector>
 
-#include <Field3D/FieldInterp.h>
+// Library headers
 
 // Project headers
 
@@ -58,6 +58,16 @@ namespace Render {
 
 /*! \class VoxelOccluder
   \brief Determines occlusion using a transmittance map.
+
+  The transmittance towards the light is precomputed in a sparse voxel 
+  buffer covering the scene volume. If the volume's extinction bounds are
+  conservative, only blocks that lie within a voxel of non-zero 
+  extinction (as bounded by the renderer's raymarch sampler) are 
+  allocated and computed, since occlusion is never looked up where 
+  nothing scatters light. Elsewhere the buffer is fully transmissive.
+  Volumes without conservative bounds, such as procedural ones, get all
+  blocks computed.
+  The blocks are computed in parallel, using the renderer's thread count.
  */
 
 //----------------------------------------------------------------------------//
@@ -89,12 +99,18 @@ public:
 
 protected:
 
-  // Data members --------------------------------------------------------------
+  // Utility methods -----------------------------------------------------------
+
+  //! Computes the transmittance of the voxels in the given block
+  void computeBlock(const Renderer &renderer, const RayState &baseState,
+                    const Vector &wsLightPos, 
+                    const std::vector<Imath::V3i> &blocks,
+                    const size_t blockIdx);
 
-  DenseBuffer m_buffer;
-  //! Linear interpolator
-  Field3D::LinearFieldInterp<Imath::V3f> m_linearInterp;
+  // Data members --------------------------------------------------------------
 
+  //! Transmittance towards the light. Unallocated blocks are one.
+  SparseBuffer m_buffer;
 
 };
 
@@ -40,6 +40,7 @@
 
 #include "pvr/export.h"
 #include "pvr/ParamBase.h"
+#include "pvr/SmallVector.h"
 #include "pvr/Types.h"
 
 //----------------------------------------------------------------------------//
@@ -65,11 +66,41 @@ public:
 
   PVR_TYPEDEF_SMART_PTRS(PhaseFunction);
 
+  // Structs -------------------------------------------------------------------
+
+  //! Weight of one input of a blending phase function
+  struct Weight
+  {
+    Weight()
+      : index(0), weight(0.0f)
+    { }
+    Weight(const size_t i, const float w)
+      : index(i), weight(w)
+    { }
+    //! Index of the input
+    size_t index;
+    float  weight;
+  };
+
+  //! Weights are computed per sample, so they're kept inline. Only the
+  //! inputs that contribute to a sample are listed, so the size depends on
+  //! how many inputs overlap, not on how many there are.
+  typedef SmallVector<Weight, 8> Weights;
+
   // To be implemented by subclasses -------------------------------------------
 
   //! Returns the scattering probability given two normalized vectors
   virtual float probability(const Vector &in, const Vector &out) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Returns the scattering probability given two normalized vectors and
+  //! a set of per-sample weights. Only phase functions that blend several 
+  //! inputs use the weights, the default implementation ignores them.
+  virtual float weightedProbability(const Vector &in, const Vector &out,
+                                    const Weights &weights) const
+  { return probability(in, out); }
+
 };
 
 //----------------------------------------------------------------------------//
@@ -97,13 +128,15 @@ public:
   // From PhaseFunction --------------------------------------------------------
 
   virtual float probability(const Vector &in, const Vector &out) const; 
+  //! Blends the phase functions listed in the per-sample weights. Falls
+  //! back to an even blend if none of them have a positive weight.
+  virtual float weightedProbability(const Vector &in, const Vector &out,
+                                    const Weights &weights) const;
 
   // Main methods --------------------------------------------------------------
 
   //! Adds a phase function to the composite
   void add(PhaseFunction::CPtr phaseFunction);
-  //! Sets the weight of one phase function
-  void setWeight(const size_t idx, const float weight);
 
 private:
 
@@ -111,8 +144,6 @@ private:
 
   //! Array of phase functions to be composited
   std::vector<PhaseFunction::CPtr> m_functions;
-  //! Array of phase function weights
-  std::vector<float>               m_weights;
 
 };
 
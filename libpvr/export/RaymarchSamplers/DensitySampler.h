@@ -71,9 +71,17 @@ public:
   PVR_DEFINE_TYPENAME(DensitySampler);
   // From RaymarchSampler ---
   virtual RaymarchSample sample(const VolumeSampleState &state) const;
+  virtual void           samplePacket(const VolumeSamplePacket &packet,
+                                      RaymarchSample *samples) const;
+  virtual Color          maxExtinction(const Volume &volume,
+                                       const BBox &wsBox) const;
 private:
+  // Enums ---
+  //! Indices into m_attrs
+  enum AttrIndex { DensityAttr = 0, HoldoutAttr, NumAttrs };
   // Private data members ---
-  VolumeAttr m_densityAttr;
+  //! Attributes to sample. All are fetched in a single call to the volume.
+  std::vector<VolumeAttr> m_attrs;
 };
 
 //----------------------------------------------------------------------------//
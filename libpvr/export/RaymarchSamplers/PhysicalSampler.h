@@ -43,6 +43,7 @@
 #include "pvr/Types.h"
 #include "pvr/VolumeAttr.h"
 #include "pvr/RaymarchSamplers/RaymarchSampler.h"
+#include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -83,17 +84,36 @@ public:
   // From RaymarchSampler ---
 
   virtual RaymarchSample sample(const VolumeSampleState &state) const;
+  //! Only samples the volume's extinction, which avoids looking up 
+  //! emission and setting up light and occlusion sampling.
+  virtual RaymarchSample sampleExtinction(const VolumeSampleState &state) const;
+  virtual void           samplePacket(const VolumeSamplePacket &packet,
+                                      RaymarchSample *samples) const;
 
 private:
 
+  // Private methods ---
+
+  //! Computes the in-scattered luminance at state.wsP, given the scattering
+  //! sample at that point.
+  Color inScattering(const VolumeSampleState &state, 
+                     const VolumeSample &scSample) const;
+
+  // Enums ---
+
+  //! Indices into m_attrs.
+  enum AttrIndex { 
+    ScatteringAttr = 0, 
+    AbsorptionAttr, 
+    EmissionAttr, 
+    HoldoutAttr, 
+    NumAttrs 
+  };
+
   // Private data members ---
 
-  //! Used for sampling the scattering attribute
-  VolumeAttr m_scatteringAttr;
-  //! Used for sampling the absorption attribute
-  VolumeAttr m_absorptionAttr;
-  //! Used for sampling the emission attribute
-  VolumeAttr m_emissionAttr;
+  //! Attributes to sample. All are fetched in a single call to the volume.
+  std::vector<VolumeAttr> m_attrs;
 
 };
 
@@ -54,17 +54,21 @@ namespace Render {
 // Structs
 //----------------------------------------------------------------------------//
 
-//! \brief Stores the result of a RaymarchSampler's sample call (luminance and
-//! extinction).
+//! \brief Stores the result of a RaymarchSampler's sample call (luminance,
+//! extinction and holdout).
 struct RaymarchSample
 {
   // Constructors --------------------------------------------------------------
 
   RaymarchSample()
-    : luminance(Colors::zero()), extinction(Colors::zero())
+    : luminance(Colors::zero()), extinction(Colors::zero()), 
+      holdout(Colors::zero())
   { }
   RaymarchSample(const Color &L, const Color &A)
-    : luminance(L), extinction(A)
+    : luminance(L), extinction(A), holdout(Colors::zero())
+  { }
+  RaymarchSample(const Color &L, const Color &A, const Color &H)
+    : luminance(L), extinction(A), holdout(H)
   { }
   
   // Public data members -------------------------------------------------------
@@ -75,6 +79,10 @@ struct RaymarchSample
   //! Extinction coefficient for the sample's point in space. This should
   //! not be scaled by the step length
   Color extinction;
+  //! Holdout extinction coefficient for the sample's point in space. 
+  //! Sampled along with the sampler's other attributes so that the volume
+  //! only needs to be looked up once per step.
+  Color holdout;
 };
 
 //----------------------------------------------------------------------------//
@@ -86,7 +94,7 @@ struct RaymarchSample
 
    These classes perform the task of sampling arbitrary attributes in the 
    scene, and turning them into Luminance and Extinction, which the 
-   Raymarcher can understand.
+   Raymarcher can understand. They also sample the "holdout" attribute.
  */
 
 //----------------------------------------------------------------------------//
@@ -103,6 +111,30 @@ public:
 
   virtual RaymarchSample sample(const VolumeSampleState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Samples only extinction and holdout. Raymarchers call this instead of 
+  //! sample() for RayState::TransmittanceOnly rays, where luminance isn't
+  //! needed. The default implementation calls sample().
+  virtual RaymarchSample sampleExtinction(const VolumeSampleState &state) const;
+  //! Samples all the points in a packet at once, writing the results to
+  //! samples[0, packet.size). Points on transmittance-only rays must give
+  //! the same result as sampleExtinction(). The default implementation 
+  //! calls sample() or sampleExtinction() for each point.
+  virtual void           samplePacket(const VolumeSamplePacket &packet,
+                                      RaymarchSample *samples) const;
+  //! Returns an upper bound on extinction plus holdout, as returned by 
+  //! both sample() and sampleExtinction(), within a world space box of the
+  //! given volume. Used to build the majorant grid of tracking raymarchers.
+  //! The default implementation bounds the larger of the volume's 
+  //! scattering + absorption and its Volume::maxExtinction(), since 
+  //! sample() and sampleExtinction() may differ when the volume has an 
+  //! explicit extinction attribute.
+  //! \note The bound is only conservative if 
+  //! volume.hasConservativeBounds() is true.
+  virtual Color          maxExtinction(const Volume &volume,
+                                       const BBox &wsBox) const;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -104,6 +104,9 @@ public:
   //! Sets the raymarch sampler to use during integration.
   void setRaymarchSampler(RaymarchSampler::CPtr sampler)
   { m_raymarchSampler = sampler; }
+  //! Returns the raymarch sampler used during integration.
+  RaymarchSampler::CPtr raymarchSampler() const
+  { return m_raymarchSampler; }
 
   // To be implemented by subclasses -------------------------------------------
 
@@ -111,6 +114,23 @@ public:
   //! luminance and transmittance in the IntegrationResult struct.
   virtual IntegrationResult integrate(const RayState &state) const = 0;
 
+  // Optionally implemented by subclasses --------------------------------------
+
+  //! Called by Renderer::execute() on the calling thread, before any rays
+  //! of the render are traced. Lets raymarchers build acceleration 
+  //! structures for the scene, which integrate() can then read without
+  //! locking. The default implementation does nothing.
+  virtual void              prepare(const RenderContext &context) const;
+  //! Integrates a packet of coherent rays (for example the camera rays 
+  //! of a single pixel), writing the results to results[0, numRays).
+  //! The result must be the same as calling integrate() on each ray.
+  //! The default implementation does just that.
+  //! 
+  //! \note numRays may not be larger than VolumeSamplePacket::MaxSize.
+  virtual void              integratePacket(const RayState *states, 
+                                            const size_t numRays,
+                                            IntegrationResult *results) const;
+
 protected:
 
   // Protected data members ----------------------------------------------------
@@ -125,6 +145,8 @@ protected:
 
 //! Splits a set of possible overlapping Interval instances into a new set,
 //! which is guaranteed to have no overlap (but possible continuity).
+//! Each output interval uses the smallest step length of the inputs that
+//! overlap it. Runs in O(n log n) time.
 IntervalVec splitIntervals(const IntervalVec &intervals);
 
 //! Allocates and initializes the deep luminance function based on 
@@ -0,0 +1,158 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file TrackingRaymarcher.h
+  Contains the TrackingRaymarcher class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TRACKINGRAYMARCHER_H__
+#define __INCLUDED_PVR_TRACKINGRAYMARCHER_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+// Library headers
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/MajorantGrid.h"
+#include "pvr/Raymarchers/Raymarcher.h"
+#include "pvr/Raymarchers/UniformRaymarcher.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher
+//----------------------------------------------------------------------------//
+
+/*! \class TrackingRaymarcher
+  \brief Estimates transmittance and luminance with ratio tracking or
+  delta tracking, instead of stepping through the volume.
+
+  Tentative collisions are placed along the ray with exponentially
+  distributed distances, using the majorant of the MajorantGrid cell that
+  the ray passes through. Thin or empty parts of the volume are therefore
+  crossed in few (or no) lookups, and there is no step length to tune.
+  The result is unbiased, but noisy, so it relies on pixel samples for
+  convergence.
+
+  Ratio tracking multiplies the transmittance by the probability of each
+  collision being a null collision. Delta tracking instead terminates the
+  ray at a real collision, which is cheaper but noisier. Since extinction
+  is colored, delta tracking uses the largest channel as the collision
+  probability and reweights the others (spectral tracking).
+
+  Holdouts attenuate luminance like extinction does, but only extinction
+  reduces the output transmittance of primary rays.
+
+  The majorant grid is built by prepare(), once per render, covering the
+  bounds of the scene volume. Rays through other volumes, or through 
+  volumes whose extinction bounds aren't conservative, are ray marched 
+  instead, since a majorant that is too low would bias the result. The 
+  fallback UniformRaymarcher is given the same parameters as this 
+  raymarcher, so step length settings apply to it. Each ray seeds its 
+  own random number generator from its origin, direction and time, so 
+  results don't depend on which thread traces the ray.
+ */
+
+//----------------------------------------------------------------------------//
+
+class LIBPVR_PUBLIC TrackingRaymarcher : public Raymarcher
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(TrackingRaymarcher);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Default constructor
+  TrackingRaymarcher();
+  //! Factory method
+  static Ptr create()
+  { return Ptr(new TrackingRaymarcher); }
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(Tracking);
+  virtual void setParams(const Util::ParamMap &params);
+
+  // From Raymarcher -----------------------------------------------------------
+
+  virtual IntegrationResult integrate(const RayState &state) const;
+  virtual void              prepare(const RenderContext &context) const;
+
+protected:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Params
+  {
+    Params();
+    //! Number of majorant grid cells along the longest axis of the scene.
+    int    majorantGridResolution;
+    //! Whether to use delta tracking rather than ratio tracking.
+    int    useDeltaTracking;
+    //! Whether to terminate rays early, using russian roulette.
+    int    doEarlyTermination;
+    //! Threshold below which russian roulette is played on the ray.
+    //! Used when doEarlyTermination is true.
+    double earlyTerminationThreshold;
+  };
+
+  // Protected data members ----------------------------------------------------
+
+  //! Holds user parameters.
+  Params                        m_params;
+  //! Majorant grid. Built by prepare(), since the scene isn't known until
+  //! rendering starts. Only read while rendering, so no lock is needed.
+  mutable MajorantGrid::CPtr m_majorantGrid;
+  //! Volume that m_majorantGrid was built for. Only used for comparison.
+  mutable const Volume      *m_gridVolume;
+  //! Used for rays that can't be tracked. Configured by setParams(), and
+  //! given the raymarch sampler by prepare().
+  UniformRaymarcher::Ptr     m_fallback;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
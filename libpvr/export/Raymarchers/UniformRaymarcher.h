@@ -83,6 +83,9 @@ public:
   // From Raymarcher -----------------------------------------------------------
 
   virtual IntegrationResult integrate(const RayState &state) const;
+  virtual void              integratePacket(const RayState *states, 
+                                            const size_t numRays,
+                                            IntegrationResult *results) const;
 
 protected:
 
@@ -108,8 +111,6 @@ protected:
   
   //! Holds user parameters.
   Params m_params;
-  //! Holdout attribute
-  VolumeAttr m_holdoutAttr;
 
 };
 
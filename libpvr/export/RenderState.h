@@ -36,8 +36,11 @@
 
 // Library headers
 
+#include <OpenEXR/ImathFun.h>
+
 // Project headers
 
+#include "pvr/SmallVector.h"
 #include "pvr/Time.h"
 #include "pvr/Types.h"
 
@@ -48,12 +51,132 @@
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Forward declarations
+//----------------------------------------------------------------------------//
+
+class Camera;
+class Scene;
+class Volume;
+
+//----------------------------------------------------------------------------//
+// RenderContext
+//----------------------------------------------------------------------------//
+
+/*! \class RenderContext
+  \brief Holds plain pointers to the scene elements of the current render.
+
+  The Renderer owns the scene elements for the duration of a render, so 
+  rays can reach them without touching the reference counts of the 
+  shared pointers in RenderGlobals, which all threads would contend for.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct RenderContext
+{
+  RenderContext()
+    : scene(NULL), volume(NULL), camera(NULL)
+  { }
+  const Scene  *scene;
+  const Volume *volume;
+  const Camera *camera;
+};
+
+//----------------------------------------------------------------------------//
+// ResolvedTransform
+//----------------------------------------------------------------------------//
+
+/*! \class ResolvedTransform
+  \brief A time-varying transform, resolved at the time of a single ray.
+
+  Points are transformed by the two matrices that bracket the time and the
+  results are interpolated, which is how Camera handles motion blur. 
+  Transforms that could be interpolated up front only use m0.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct ResolvedTransform
+{
+  ResolvedTransform()
+    : lerpFactor(0.0)
+  { }
+  //! Creates a transform that only uses the given matrix
+  explicit ResolvedTransform(const Matrix &m)
+    : m0(m), m1(m), lerpFactor(0.0)
+  { }
+  //! Returns the transformed point
+  Vector operator () (const Vector &p) const
+  {
+    if (lerpFactor == 0.0) {
+      return p * m0;
+    }
+    return Imath::lerp(p * m0, p * m1, lerpFactor);
+  }
+  Matrix m0, m1;
+  double lerpFactor;
+};
+
+//----------------------------------------------------------------------------//
+// TransformCache
+//----------------------------------------------------------------------------//
+
+/*! \class TransformCache
+  \brief Caches the time-varying transforms of the cameras and volumes that
+  a ray passes through, resolved at the time of the ray.
+
+  Transforms are cached under a key, usually the object that owns them. 
+  The cache grows to hold every transform that the scene uses, so nothing
+  is evicted while the time stays the same. Changing the time empties it.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct TransformCache
+{
+  TransformCache()
+    : time(0.0f)
+  { }
+  //! Returns the transform cached under the given key at the given time, 
+  //! or NULL if there is none.
+  //! \note The pointer is only valid until the next call to insert().
+  const ResolvedTransform* find(const void *key, const PTime t) const;
+  //! Caches a transform under the given key at the given time.
+  void insert(const void *key, const ResolvedTransform &xform, 
+              const PTime t);
+  //! A cached transform and its key
+  struct Entry
+  {
+    Entry()
+      : key(NULL)
+    { }
+    Entry(const void *k, const ResolvedTransform &x)
+      : key(k), xform(x)
+    { }
+    const void        *key;
+    ResolvedTransform  xform;
+  };
+  //! Cached transforms. Only scenes with many transformed objects need to
+  //! go beyond the inline storage.
+  SmallVector<Entry, 4> entries;
+  //! Time that the cached transforms were resolved at
+  PTime                 time;
+};
+
 //----------------------------------------------------------------------------//
 // RayState
 //----------------------------------------------------------------------------//
 
 /*! \class RayState
   \brief Stores information about the current state of the renderer.
+
+  Time is constant along a ray, so the time-varying transforms of the 
+  cameras and volumes that it passes through are cached in a 
+  TransformCache. Each one is resolved the first time it's needed, and is
+  then reused for every step and shadow lookup along the ray. The cache is
+  owned by whoever set up the ray, and secondary rays share their 
+  parent's, since they share its time.
  */
 
 //----------------------------------------------------------------------------//
@@ -70,17 +193,51 @@ struct RayState
       rayDepth(0), 
       rayType(FullRaymarch),
       time(0.0f),
+      stepOffset(0.5f),
       doOutputDeepL(false),
-      doOutputDeepT(false)
+      doOutputDeepT(false),
+      footprintWidth(0.0),
+      footprintSpread(0.0),
+      context(NULL),
+      transformCache(NULL)
   { }
+  //! Returns the scene that the ray is traced through
+  const Scene&  scene() const;
+  //! Returns the volume that the ray is traced through
+  const Volume& volume() const;
+  //! Returns the world space width of the ray's footprint at parameter t
+  double        footprint(const double t) const
+  { return footprintWidth + footprintSpread * t; }
+  //! Returns the transform cached under the given key, or NULL if there is
+  //! none for the current time or the ray has no cache.
+  //! \note The pointer is only valid until the next cached transform.
+  const ResolvedTransform* resolvedTransform(const void *key) const;
+  //! Caches a transform under the given key, if the ray has a cache.
+  void cacheResolvedTransform(const void *key, 
+                              const ResolvedTransform &xform) const;
   Ray     wsRay;
   double  tMin;
   double  tMax;
   size_t  rayDepth;
   RayType rayType;
   PTime   time;
+  //! Where within each raymarch step to place the sample, in [0,1).
+  //! 0.5 samples at the step midpoint.
+  float   stepOffset;
   bool    doOutputDeepL;
   bool    doOutputDeepT;
+  //! Width of the area covered by the ray's pixel, at the ray origin.
+  //! Zero for rays without a known footprint, such as shadow rays.
+  double  footprintWidth;
+  //! How much the footprint width grows per unit distance along the ray.
+  double  footprintSpread;
+  //! Scene elements of the current render. Rays that are fired outside 
+  //! of Renderer::execute() may leave this as NULL, in which case the 
+  //! scene is found through RenderGlobals.
+  const RenderContext *context;
+  //! Cache of resolved transforms, shared with secondary rays. May be 
+  //! NULL, in which case transforms are resolved each time they're used.
+  TransformCache *transformCache;
 };
 
 //----------------------------------------------------------------------------//
@@ -106,12 +263,65 @@ struct LightSampleState
   Vector wsP;
 };
 
+//----------------------------------------------------------------------------//
+// TransformedRay
+//----------------------------------------------------------------------------//
+
+/*! \class TransformedRay
+  \brief A ray mapped into some other space, such as the voxel space of a
+  buffer, so that points along it can be found without transforming each
+  one.
+
+  Each component of the transformed point is a linear fractional function
+  of the ray parameter, p(t) = (a + b * t) / (c + d * t). That represents
+  affine transforms (c = 1, d = 0) as well as perspective ones exactly.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct TransformedRay
+{
+  TransformedRay()
+    : c(1.0), d(0.0), isAffine(true), isValid(false)
+  { }
+  //! Creates an affine ray, p(t) = pos + t * dir
+  static TransformedRay affine(const Vector &pos, const Vector &dir)
+  {
+    TransformedRay ray;
+    ray.a       = pos;
+    ray.b       = dir;
+    ray.isValid = true;
+    return ray;
+  }
+  //! Returns the transformed point at parameter t
+  Vector operator () (const double t) const
+  {
+    if (isAffine) {
+      return a + b * t;
+    }
+    return Vector((a.x + b.x * t) / (c.x + d.x * t),
+                  (a.y + b.y * t) / (c.y + d.y * t),
+                  (a.z + b.z * t) / (c.z + d.z * t));
+  }
+  Vector a, b, c, d;
+  //! Whether c is one and d is zero, which saves the divisions
+  bool   isAffine;
+  //! False if the ray couldn't be transformed, in which case points need
+  //! to be transformed one by one. Cached anyway, so that the attempt 
+  //! isn't repeated for every point.
+  bool   isValid;
+};
+
 //----------------------------------------------------------------------------//
 // VolumeSampleState
 //----------------------------------------------------------------------------//
 
 /*! \class VolumeSampleState
   \brief Stores the information needed to evaluate a Volume at a given point.
+
+  Raymarchers keep one VolumeSampleState per ray, so it also caches the 
+  ray transformed into the spaces of the volumes being sampled. Volumes 
+  look the cache up with themselves as key.
  */
 
 //----------------------------------------------------------------------------//
@@ -119,10 +329,74 @@ struct LightSampleState
 struct VolumeSampleState
 {
   VolumeSampleState(const RayState &rState)
-    : rayState(rState)
+    : rayState(rState), t(0.0), numTransformedRays(0)
   { }
+  //! Moves wsP to parameter t along the ray. Unlike setting wsP directly,
+  //! this lets volumes step along a cached TransformedRay.
+  void setRayPosition(const double rayT)
+  { t = rayT; wsP = rayState.wsRay(rayT); }
+  //! Whether wsP is the point at parameter t along the ray. False if wsP 
+  //! was set directly, to a point elsewhere.
+  bool isOnRay() const
+  { return wsP == rayState.wsRay(t); }
+  //! Returns the transformed ray cached under the given key, or NULL if
+  //! there is none.
+  const TransformedRay* transformedRay(const void *key) const;
+  //! Caches a transformed ray under the given key. Returns the cached copy,
+  //! or NULL if the cache is full.
+  const TransformedRay* cacheTransformedRay(const void *key, 
+                                            const TransformedRay &ray) const;
+  //! Max number of transformed rays cached per ray
+  enum { MaxTransformedRays = 4 };
   const RayState &rayState;
   Vector wsP;
+  //! Ray parameter of wsP. Only valid if isOnRay() is true.
+  double t;
+  //! Keys of the cached transformed rays. Usually the volume they belong to.
+  mutable const void    *transformedRayKeys[MaxTransformedRays];
+  //! Cached transformed rays
+  mutable TransformedRay transformedRays[MaxTransformedRays];
+  //! Number of cached transformed rays
+  mutable size_t         numTransformedRays;
+};
+
+//----------------------------------------------------------------------------//
+// VolumeSamplePacket
+//----------------------------------------------------------------------------//
+
+/*! \class VolumeSamplePacket
+  \brief Stores the information needed to evaluate a Volume at a set of
+  points at once.
+
+  Positions are stored as separate x/y/z arrays, so that a loop over one
+  coordinate of the packet reads contiguous memory. Rays that have 
+  terminated are not included, the packet only contains the active 
+  samples.
+ */
+
+//----------------------------------------------------------------------------//
+
+struct VolumeSamplePacket
+{
+  //! Maximum number of samples in a packet
+  enum { MaxSize = 16 };
+  VolumeSamplePacket()
+    : size(0)
+  { }
+  //! Returns the world space position of sample i
+  Vector wsP(const size_t i) const
+  { return Vector(wsX[i], wsY[i], wsZ[i]); }
+  //! Sets the world space position of sample i
+  void   setWsP(const size_t i, const Vector &p)
+  { wsX[i] = p.x; wsY[i] = p.y; wsZ[i] = p.z; }
+  //! Ray state of each sample.
+  const RayState *rayState[MaxSize];
+  //! World space sample positions
+  double wsX[MaxSize];
+  double wsY[MaxSize];
+  double wsZ[MaxSize];
+  //! Number of valid samples
+  size_t size;
 };
 
 //----------------------------------------------------------------------------//
@@ -151,6 +425,10 @@ struct OcclusionSampleState
     state.wsRay.dir = (wsLightP - wsP).normalized();
     state.tMin = 0.0;
     state.tMax = (wsLightP - wsP).length();
+    // Shadow rays don't have a known footprint, so they keep full 
+    // resolution
+    state.footprintWidth  = 0.0;
+    state.footprintSpread = 0.0;
     return state;
   }
   const RayState &rayState;
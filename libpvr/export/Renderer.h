@@ -36,6 +36,9 @@
 
 // Library headers
 
+#include <boost/thread/mutex.hpp>
+
+#include <OpenEXR/ImathBox.h>
 #include <OpenEXR/ImathRandom.h>
 
 // Project headers
@@ -44,6 +47,7 @@
 #include "pvr/Camera.h"
 #include "pvr/Image.h"
 #include "pvr/Exception.h"
+#include "pvr/SampleGenerator.h"
 #include "pvr/Scene.h"
 #include "pvr/DeepImage.h"
 #include "pvr/Types.h"
@@ -105,6 +109,10 @@ public:
   void setCamera    (Camera::CPtr camera);
   //! Sets the raymarcher to use for rendering
   void setRaymarcher(Raymarcher::CPtr raymarcher);
+  //! Sets the sample generator used for pixel positions, shutter time and
+  //! raymarch step offsets. If none is set, pixel positions are jittered
+  //! randomly and time is stratified.
+  void setSampleGenerator(Sampling::SampleGenerator::CPtr generator);
   //! Adds a Volume object to the collection of volumes to be rendered
   void addVolume    (Volume::CPtr volume);
   //! Adds a Light to the scene
@@ -118,6 +126,9 @@ public:
   Scene::Ptr       scene() const;  
   //! Returns the number of pixel samples to use
   size_t           numPixelSamples() const;
+  //! Returns the number of threads used for rendering. Zero means 'use all
+  //! available cores'.
+  size_t           numThreads() const;
   
   // Options -------------------------------------------------------------------
 
@@ -136,6 +147,32 @@ public:
   //! Sets the number of samples to use for deep images (transmittance and
   //! luminance)
   void setNumDeepSamples         (const size_t numSamples);
+  //! Sets whether to use adaptive pixel sampling. When enabled, each pixel
+  //! starts with numPixelSamples^2 rays, and keeps adding batches of the 
+  //! same size until the noise estimate is below the adaptive threshold, or
+  //! maxPixelSamples^2 rays have been traced. With a single starting ray 
+  //! there is no noise estimate, so only pixels whose ray saw nothing stop
+  //! after it.
+  void setDoAdaptivePixelSamples (const bool enabled);
+  //! Sets the maximum number of pixel samples to use in adaptive mode
+  //! \note The max number of rays fired will be the square of this number
+  void setMaxPixelSamples        (const size_t numSamples);
+  //! Sets the noise threshold for adaptive pixel sampling. This is the 
+  //! largest allowed standard error of the pixel's mean luminance and alpha.
+  void setAdaptiveThreshold      (const float threshold);
+  //! Sets the number of threads to render with. Zero uses all available 
+  //! cores.
+  void setNumThreads             (const size_t numThreads);
+  //! Sets the size of the image tiles (in pixels) that are distributed to 
+  //! the render threads.
+  void setTileSize               (const size_t tileSize);
+  //! Sets the number of camera rays that are integrated together as a 
+  //! packet. Rays in a packet come from the same pixel, so with 4x4 pixel
+  //! samples a packet size of 16 traces each batch as a single packet.
+  //! One (the default) disables packet tracing. The result is the same
+  //! regardless of packet size.
+  //! \note Clamped to [1, VolumeSamplePacket::MaxSize]
+  void setPacketSize             (const size_t packetSize);
 
   // Execution -----------------------------------------------------------------
 
@@ -161,15 +198,38 @@ public:
 
 private:
 
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<Imath::Box2i> TileVec;
+
   // Private methods -----------------------------------------------------------
 
-  //! Integrates a single ray and returns the result
-  IntegrationResult integrateRay(const float x, const float y, 
-                                 const PTime time) const;
+  //! Splits the image into tiles of m_params.tileSize pixels
+  TileVec           setupTiles() const;
+  //! Renders all pixels in a single tile and writes the result to the
+  //! output images. 
+  //! \param commitMutex Serializes the writes to the output images and
+  //! numRays
+  //! \param numRays Total number of rays traced. Updated by each tile.
+  void              renderTile(const TileVec &tiles, boost::mutex &commitMutex,
+                               size_t &numRays, const size_t tileIdx);
+  //! Renders a single pixel. Returns the number of rays that were traced.
+  size_t            renderPixel(const int x, const int y, Color &luminance, 
+                                Color &alpha, Util::ColorCurve::CPtr &deepT,
+                                Util::ColorCurve::CPtr &deepL) const;
+  //! Sets up the RayState for a single camera ray
+  RayState          setupRayState(const float x, const float y, 
+                                  const PTime time, 
+                                  const float stepOffset) const;
   //! Configures the next pixel sample
-  void setupSample(const float xCenter, const float yCenter,
-                   const size_t xSubpixel, const size_t ySubpixel, 
-                   float &xSample, float &ySample, PTime &pTime) const;
+  //! \param sampleIdx Index of the sample within the pixel
+  //! \param rng Random number generator for the current pixel. Seeded per
+  //! pixel so that results don't depend on the order pixels are rendered in.
+  //! Only used when no SampleGenerator is set.
+  void              setupSample(const int x, const int y, 
+                                const size_t sampleIdx, Imath::Rand48 &rng, 
+                                float &xSample, float &ySample, PTime &pTime,
+                                float &stepOffset) const;
 
   // Structs -------------------------------------------------------------------
 
@@ -179,13 +239,17 @@ private:
     bool doLuminanceMap;
     bool doTransmittanceMap;
     bool doRandomizePixelSamples;
+    bool doAdaptivePixelSamples;
     size_t numPixelSamples;
+    size_t maxPixelSamples;
+    float adaptiveThreshold;
+    size_t numThreads;
+    size_t tileSize;
+    size_t packetSize;
   };
 
   // Private data members ------------------------------------------------------
 
-  //! Random number generator
-  mutable Imath::Rand48 m_rng;
   //! Renderer parameters
   Params m_params;
   //! Pointer to scene
@@ -194,6 +258,11 @@ private:
   Camera::CPtr m_camera;
   //! Pointer to raymarcher instance
   Raymarcher::CPtr m_raymarcher;
+  //! Pointer to sample generator. May be null.
+  Sampling::SampleGenerator::CPtr m_sampleGenerator;
+  //! Scene elements of the current render, referenced by each camera ray.
+  //! Set up by execute().
+  RenderContext m_context;
   //! Primary image output. 
   Image::Ptr m_primary;
   //! Pointer to deep transmittance map
@@ -0,0 +1,210 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SampleGenerator.h
+  Contains the SampleGenerator class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SAMPLEGENERATOR_H__
+#define __INCLUDED_PVR_SAMPLEGENERATOR_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <boost/shared_ptr.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/ParamBase.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+namespace Sampling {
+
+//----------------------------------------------------------------------------//
+// SampleGenerator
+//----------------------------------------------------------------------------//
+
+//! Base class for sample generators, used by the Renderer to place pixel
+//! samples in the pixel, in the shutter interval and within raymarch steps.
+//! \note Sample generators are stateless. Each sample is a pure function
+//! of the pixel seed, sample index and dimension, which makes them safe to
+//! use from multiple threads and independent of rendering order.
+class LIBPVR_PUBLIC SampleGenerator : public Util::ParamBase
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(SampleGenerator);
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Sample dimensions used by the Renderer. 2D samples use two consecutive
+  //! dimensions.
+  enum Dimension {
+    PixelDim      = 0,
+    TimeDim       = 2,
+    StepOffsetDim = 3
+  };
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns a 1D sample in [0,1)
+  //! \param pixelSeed Unique number for each pixel. Used to decorrelate
+  //! the samples of neighboring pixels.
+  //! \param index Index of the sample within the pixel
+  //! \param numSamples Number of samples that will be taken in each batch.
+  //! Indices larger than numSamples continue the sequence.
+  //! \param dimension Which dimension to sample
+  virtual float      sample1D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const = 0;
+  //! Returns a 2D sample in [0,1)^2, using dimension and dimension + 1.
+  //! Arguments are the same as for sample1D().
+  virtual Imath::V2f sample2D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const = 0;
+};
+
+//----------------------------------------------------------------------------//
+// Stratified
+//----------------------------------------------------------------------------//
+
+//! Jittered stratified samples. 2D samples use correlated multi-jittered
+//! sampling, which is stratified both in 2D and along each axis. 1D samples
+//! use a shuffled set of jittered strata. Each batch of numSamples samples
+//! is stratified by itself.
+class LIBPVR_PUBLIC Stratified : public SampleGenerator
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(Stratified);
+
+  // Factory -------------------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC(Stratified);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(Stratified);
+
+  // From SampleGenerator ------------------------------------------------------
+
+  virtual float      sample1D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+  virtual Imath::V2f sample2D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+};
+
+//----------------------------------------------------------------------------//
+// Sobol
+//----------------------------------------------------------------------------//
+
+//! Sobol sequence, decorrelated between pixels by a random digital shift.
+//! Any prefix of the sequence is well distributed, so it works well
+//! with adaptive sampling. Best results are had when the number of
+//! samples is a power of two.
+class LIBPVR_PUBLIC Sobol : public SampleGenerator
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(Sobol);
+
+  // Factory -------------------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC(Sobol);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(Sobol);
+
+  // From SampleGenerator ------------------------------------------------------
+
+  virtual float      sample1D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+  virtual Imath::V2f sample2D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+};
+
+//----------------------------------------------------------------------------//
+// OwenScrambledSobol
+//----------------------------------------------------------------------------//
+
+//! Sobol sequence with hash-based Owen (nested uniform) scrambling, seeded
+//! per pixel. Keeps the stratification of the Sobol sequence but removes
+//! its structured artifacts and converges faster for smooth integrands.
+class LIBPVR_PUBLIC OwenScrambledSobol : public SampleGenerator
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(OwenScrambledSobol);
+
+  // Factory -------------------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC(OwenScrambledSobol);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(OwenScrambledSobol);
+
+  // From SampleGenerator ------------------------------------------------------
+
+  virtual float      sample1D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+  virtual Imath::V2f sample2D(const size_t pixelSeed, const size_t index,
+                              const size_t numSamples,
+                              const size_t dimension) const;
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sampling
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,247 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SmallVector.h
+  Contains the SmallVector class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_SMALLVECTOR_H__
+#define __INCLUDED_PVR_SMALLVECTOR_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System includes
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <new>
+
+// Library includes
+
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+
+//----------------------------------------------------------------------------//
+// SmallVector
+//----------------------------------------------------------------------------//
+
+/*! \class SmallVector
+  \brief A std::vector replacement that stores up to N elements inline.
+
+  Used for the short, per-ray arrays of the integration path (intervals,
+  phase weights), so that no heap allocation takes place unless a ray has
+  unusually many of them. Only the subset of the std::vector interface
+  used by PVR is provided. Iterators are plain pointers and are
+  invalidated by anything that changes the size.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename T, size_t N>
+class SmallVector
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef T              value_type;
+  typedef T&             reference;
+  typedef const T&       const_reference;
+  typedef T*             iterator;
+  typedef const T*       const_iterator;
+  typedef size_t         size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  //! Creates an empty vector
+  SmallVector()
+    : m_data(inlineData()), m_size(0), m_capacity(N)
+  { }
+  //! Creates a vector with n copies of value
+  explicit SmallVector(const size_t n, const T &value = T())
+    : m_data(inlineData()), m_size(0), m_capacity(N)
+  { resize(n, value); }
+  //! Copy constructor
+  SmallVector(const SmallVector &other)
+    : m_data(inlineData()), m_size(0), m_capacity(N)
+  { append(other.begin(), other.end()); }
+  //! Destructor
+  ~SmallVector()
+  {
+    clear();
+    deallocate();
+  }
+
+  // Operators -----------------------------------------------------------------
+
+  SmallVector& operator = (const SmallVector &other)
+  {
+    if (this != &other) {
+      clear();
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+  T&       operator [] (const size_t i)
+  { assert(i < m_size); return m_data[i]; }
+  const T& operator [] (const size_t i) const
+  { assert(i < m_size); return m_data[i]; }
+
+  // Main methods --------------------------------------------------------------
+
+  iterator       begin()
+  { return m_data; }
+  const_iterator begin() const
+  { return m_data; }
+  iterator       end()
+  { return m_data + m_size; }
+  const_iterator end() const
+  { return m_data + m_size; }
+  size_t         size() const
+  { return m_size; }
+  bool           empty() const
+  { return m_size == 0; }
+  size_t         capacity() const
+  { return m_capacity; }
+  T&             front()
+  { assert(m_size > 0); return m_data[0]; }
+  const T&       front() const
+  { assert(m_size > 0); return m_data[0]; }
+  T&             back()
+  { assert(m_size > 0); return m_data[m_size - 1]; }
+  const T&       back() const
+  { assert(m_size > 0); return m_data[m_size - 1]; }
+
+  //! Appends an element
+  void push_back(const T &value)
+  {
+    if (m_size == m_capacity) {
+      // value may live in the current storage, so copy it first
+      const T copy(value);
+      reserve(m_capacity * 2);
+      new (m_data + m_size) T(copy);
+    } else {
+      new (m_data + m_size) T(value);
+    }
+    ++m_size;
+  }
+  //! Removes the last element
+  void pop_back()
+  {
+    assert(m_size > 0);
+    m_data[--m_size].~T();
+  }
+  //! Appends the elements in [first, last), which must not point into
+  //! this vector.
+  template <typename Iter_T>
+  void append(Iter_T first, Iter_T last)
+  {
+    reserve(m_size + std::distance(first, last));
+    for (; first != last; ++first, ++m_size) {
+      new (m_data + m_size) T(*first);
+    }
+  }
+  //! Removes all elements. Keeps the storage, so refilling the vector up
+  //! to its previous size doesn't allocate.
+  void clear()
+  {
+    for (size_t i = 0; i < m_size; ++i) {
+      m_data[i].~T();
+    }
+    m_size = 0;
+  }
+  //! Resizes the vector, filling new elements with value
+  void resize(const size_t n, const T &value = T())
+  {
+    reserve(n);
+    while (m_size > n) {
+      pop_back();
+    }
+    for (; m_size < n; ++m_size) {
+      new (m_data + m_size) T(value);
+    }
+  }
+  //! Makes sure that at least n elements fit without reallocating
+  void reserve(const size_t n)
+  {
+    if (n <= m_capacity) {
+      return;
+    }
+    const size_t capacity = std::max(n, m_capacity * 2);
+    T *data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+    for (size_t i = 0; i < m_size; ++i) {
+      new (data + i) T(m_data[i]);
+      m_data[i].~T();
+    }
+    deallocate();
+    m_data     = data;
+    m_capacity = capacity;
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  T*   inlineData()
+  { return static_cast<T*>(m_storage.address()); }
+  void deallocate()
+  {
+    if (m_data != inlineData()) {
+      ::operator delete(m_data);
+    }
+  }
+
+  // Private data members ------------------------------------------------------
+
+  //! Inline storage for the first N elements
+  boost::aligned_storage<sizeof(T) * N, 
+                         boost::alignment_of<T>::value> m_storage;
+  //! Points to either m_storage or to heap storage
+  T     *m_data;
+  //! Number of elements
+  size_t m_size;
+  //! Number of elements that fit in m_data
+  size_t m_capacity;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,106 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Threads.h
+  Contains the thread pool scheduling functions.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_THREADS_H__
+#define __INCLUDED_PVR_THREADS_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System includes
+
+#include <cstddef>
+
+// Library includes
+
+#include <boost/function.hpp>
+
+// Project headers
+
+#include "pvr/export.h"
+#include "pvr/Exception.h"
+#include "pvr/Log.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Exceptions
+//----------------------------------------------------------------------------//
+
+DECLARE_PVR_RT_EXC(WorkerThreadException, "Exception in worker thread:");
+
+//----------------------------------------------------------------------------//
+// Typedefs
+//----------------------------------------------------------------------------//
+
+//! Callback used by parallelFor(). The first argument is the task index,
+//! the second argument is the index of the worker thread executing it.
+typedef boost::function<void (const size_t, const size_t)> TaskFunc;
+
+//----------------------------------------------------------------------------//
+// Thread functions
+//----------------------------------------------------------------------------//
+
+//! Returns the number of hardware threads available. Never returns zero.
+LIBPVR_PUBLIC size_t numHardwareThreads();
+
+//! Resolves a user-specified thread count. Zero means 'use all hardware
+//! threads'.
+LIBPVR_PUBLIC size_t resolveNumThreads(const size_t numThreads);
+
+//! Executes tasks [0, numTasks) on a pool of worker threads.
+//! Each thread starts out with a contiguous range of tasks in its own queue.
+//! Once a thread's queue is exhausted it steals tasks from the back of the
+//! other threads' queues, so that uneven task costs are balanced out.
+//! The calling thread does not execute tasks. Instead it polls the global
+//! Interrupt and updates the (optional) progress reporter. This keeps
+//! interrupt handlers that are tied to the main thread (such as python's)
+//! working.
+//! \note With numThreads == 1 the tasks are executed in order on the
+//! calling thread.
+//! \throws UserInterruptException if the global Interrupt requested an abort.
+//! \throws WorkerThreadException if a task threw an exception.
+LIBPVR_PUBLIC void parallelFor(const size_t numTasks, const size_t numThreads,
+                               const TaskFunc &func,
+                               Util::ProgressReporter *progress = NULL);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
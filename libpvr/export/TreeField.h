@@ -0,0 +1,420 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file TreeField.h
+  Contains the TreeField class.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TREEFIELD_H__
+#define __INCLUDED_PVR_TREEFIELD_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+// Library headers
+
+#include <Field3D/Field.h>
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace Field3D {
+
+//----------------------------------------------------------------------------//
+// TreeField
+//----------------------------------------------------------------------------//
+
+/*! \class TreeField
+  \brief A sparse field with two levels of blocks below a coarse root
+  grid, in the spirit of VDB.
+
+  The root grid has one slot per internal node of nodeSize()^3 voxels.
+  Each internal node has one slot per leaf of leafSize()^3 voxels. A slot
+  either holds a child or a tile value that is constant across the
+  region. Writing to a voxel allocates its node and leaf. prune()
+  collapses constant leaves and nodes back into tiles.
+
+  Compared to a SparseField, the root index is nodeSize()^3 times
+  smaller than a block index at leaf resolution, and empty space can be
+  skipped a whole node at a time.
+
+  Leaf, node and voxel coordinates are all relative to the data window.
+  Leaves use the same voxel layout as SparseField blocks of the same size,
+  with x varying fastest.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class TreeField : public ResizableField<Data_T>
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::intrusive_ptr<TreeField> Ptr;
+  typedef std::vector<Ptr>                Vec;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef TreeField<Data_T> class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "TreeField";
+  }
+
+  static const char* classType()
+  {
+    return class_type::ms_classType.name();
+  }
+
+  // Constants -----------------------------------------------------------------
+
+  //! Log2 of the number of voxels along each edge of a leaf
+  static const int LeafOrder = 3;
+  //! Log2 of the number of leaves along each edge of an internal node
+  static const int NodeOrder = 4;
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! Creates an empty field
+  TreeField()
+    : base()
+  { }
+  //! Copies all nodes and leaves
+  TreeField(const TreeField &other)
+    : base(other), m_rootRes(other.m_rootRes),
+      m_rootTiles(other.m_rootTiles), m_nodes(other.m_nodes.size())
+  {
+    for (size_t i = 0, size = m_nodes.size(); i < size; ++i) {
+      if (other.m_nodes[i]) {
+        m_nodes[i].reset(new Node(*other.m_nodes[i]));
+      }
+    }
+  }
+
+  // From FieldBase ------------------------------------------------------------
+
+  virtual std::string className() const
+  { return staticClassName(); }
+  virtual FieldBase::Ptr clone() const
+  { return Ptr(new TreeField(*this)); }
+
+  // From FieldRes -------------------------------------------------------------
+
+  virtual long long int memSize() const
+  {
+    long long int size = sizeof(*this) +
+      m_rootTiles.capacity() * sizeof(Data_T) +
+      m_nodes.capacity() * sizeof(NodePtr);
+    for (size_t i = 0, numNodes = m_nodes.size(); i < numNodes; ++i) {
+      if (m_nodes[i]) {
+        size += sizeof(Node) + NodeChildren * (sizeof(Data_T) +
+                                               sizeof(LeafPtr));
+        for (int c = 0; c < NodeChildren; ++c) {
+          if (m_nodes[i]->leaves[c]) {
+            size += sizeof(Leaf);
+          }
+        }
+      }
+    }
+    return size;
+  }
+
+  // From Field ----------------------------------------------------------------
+
+  virtual Data_T value(int i, int j, int k) const
+  { return fastValue(i, j, k); }
+
+  // From WritableField --------------------------------------------------------
+
+  //! Removes all nodes and sets every root tile to value
+  virtual void clear(const Data_T &value)
+  {
+    std::fill(m_rootTiles.begin(), m_rootTiles.end(), value);
+    std::fill(m_nodes.begin(), m_nodes.end(), NodePtr());
+  }
+  virtual Data_T& lvalue(int i, int j, int k)
+  { return fastLValue(i, j, k); }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Non-virtual voxel lookup
+  Data_T fastValue(int i, int j, int k) const
+  {
+    applyDataWindowOffset(i, j, k);
+    const int   ni   = nodeIndex(i >> NodeShift, j >> NodeShift,
+                                 k >> NodeShift);
+    const Node *node = m_nodes[ni].get();
+    if (!node) {
+      return m_rootTiles[ni];
+    }
+    const int   ci   = childIndex(i, j, k);
+    const Leaf *leaf = node->leaves[ci].get();
+    if (!leaf) {
+      return node->tiles[ci];
+    }
+    return leaf->voxels[voxelIndex(i, j, k)];
+  }
+  //! Non-virtual voxel write access. Allocates the node and leaf of the
+  //! voxel if needed.
+  Data_T& fastLValue(int i, int j, int k)
+  {
+    applyDataWindowOffset(i, j, k);
+    const int ni = nodeIndex(i >> NodeShift, j >> NodeShift,
+                             k >> NodeShift);
+    if (!m_nodes[ni]) {
+      m_nodes[ni].reset(new Node(m_rootTiles[ni]));
+    }
+    Node     &node = *m_nodes[ni];
+    const int ci   = childIndex(i, j, k);
+    if (!node.leaves[ci]) {
+      node.leaves[ci].reset(new Leaf(node.tiles[ci]));
+    }
+    return node.leaves[ci]->voxels[voxelIndex(i, j, k)];
+  }
+  //! Replaces each leaf whose voxels are all equal by a tile, and then
+  //! each node whose slots are all tiles of equal value by a root tile.
+  void prune()
+  {
+    for (size_t ni = 0, numNodes = m_nodes.size(); ni < numNodes; ++ni) {
+      if (!m_nodes[ni]) {
+        continue;
+      }
+      Node &node = *m_nodes[ni];
+      bool isConstant = true;
+      for (int ci = 0; ci < NodeChildren; ++ci) {
+        if (const Leaf *leaf = node.leaves[ci].get()) {
+          const Data_T *v = leaf->voxels;
+          if (std::find_if(v + 1, v + LeafVoxels,
+                           std::bind2nd(std::not_equal_to<Data_T>(), v[0]))
+              == v + LeafVoxels) {
+            node.tiles[ci] = v[0];
+            node.leaves[ci].reset();
+          }
+        }
+        isConstant = isConstant && !node.leaves[ci] &&
+          node.tiles[ci] == node.tiles[0];
+      }
+      if (isConstant) {
+        m_rootTiles[ni] = node.tiles[0];
+        m_nodes[ni].reset();
+      }
+    }
+  }
+
+  // Tree structure ------------------------------------------------------------
+
+  //! Number of voxels along each edge of a leaf
+  static int leafSize()
+  { return 1 << LeafOrder; }
+  //! Number of voxels along each edge of an internal node
+  static int nodeSize()
+  { return 1 << NodeShift; }
+  //! Number of leaves along each edge of an internal node
+  static int leavesPerNode()
+  { return 1 << NodeOrder; }
+  //! Number of nodes along each axis of the root grid
+  const V3i& rootRes() const
+  { return m_rootRes; }
+  //! Number of leaves along each axis
+  V3i leafRes() const
+  {
+    const V3i size = base::dataResolution();
+    return V3i((size.x + leafSize() - 1) >> LeafOrder,
+               (size.y + leafSize() - 1) >> LeafOrder,
+               (size.z + leafSize() - 1) >> LeafOrder);
+  }
+  //! Whether the given node is allocated, rather than a root tile
+  bool nodeIsAllocated(const int ni, const int nj, const int nk) const
+  { return m_nodes[nodeIndex(ni, nj, nk)].get() != NULL; }
+  //! Value of the given root tile. Only meaningful if the node isn't
+  //! allocated.
+  const Data_T& nodeTileValue(const int ni, const int nj, const int nk) const
+  { return m_rootTiles[nodeIndex(ni, nj, nk)]; }
+  //! Whether the given leaf is allocated, rather than part of a tile
+  bool leafIsAllocated(const int li, const int lj, const int lk) const
+  { return leafData(li, lj, lk) != NULL; }
+  //! Value of the tile that the given leaf is part of, either in its node
+  //! or in the root grid. Only meaningful if the leaf isn't allocated.
+  const Data_T& leafTileValue(const int li, const int lj, const int lk) const
+  {
+    const int ni = nodeIndex(li >> NodeOrder, lj >> NodeOrder,
+                             lk >> NodeOrder);
+    if (const Node *node = m_nodes[ni].get()) {
+      return node->tiles[leafChildIndex(li, lj, lk)];
+    }
+    return m_rootTiles[ni];
+  }
+  //! Returns the voxels of the given leaf, or NULL if it isn't allocated
+  const Data_T* leafData(const int li, const int lj, const int lk) const
+  {
+    const Node *node = m_nodes[nodeIndex(li >> NodeOrder, lj >> NodeOrder,
+                                         lk >> NodeOrder)].get();
+    if (!node) {
+      return NULL;
+    }
+    const Leaf *leaf = node->leaves[leafChildIndex(li, lj, lk)].get();
+    return leaf ? leaf->voxels : NULL;
+  }
+
+protected:
+
+  // From ResizableField -------------------------------------------------------
+
+  //! Sets up the root grid for the new data window. All contents are
+  //! lost.
+  virtual void sizeChanged()
+  {
+    base::sizeChanged();
+    const V3i size = base::dataResolution();
+    m_rootRes = V3i((size.x + nodeSize() - 1) >> NodeShift,
+                    (size.y + nodeSize() - 1) >> NodeShift,
+                    (size.z + nodeSize() - 1) >> NodeShift);
+    const size_t numNodes = m_rootRes.x * m_rootRes.y * m_rootRes.z;
+    m_rootTiles.assign(numNodes, Data_T(0.0));
+    m_nodes.assign(numNodes, NodePtr());
+  }
+
+private:
+
+  // Constants -----------------------------------------------------------------
+
+  //! Log2 of the number of voxels along each edge of a node
+  static const int NodeShift    = LeafOrder + NodeOrder;
+  //! Number of voxels in a leaf
+  static const int LeafVoxels   = 1 << (3 * LeafOrder);
+  //! Number of slots in a node
+  static const int NodeChildren = 1 << (3 * NodeOrder);
+
+  // Structs -------------------------------------------------------------------
+
+  struct Leaf
+  {
+    explicit Leaf(const Data_T &value)
+    { std::fill(voxels, voxels + LeafVoxels, value); }
+    Data_T voxels[LeafVoxels];
+  };
+
+  typedef boost::shared_ptr<Leaf> LeafPtr;
+
+  struct Node
+  {
+    explicit Node(const Data_T &value)
+      : tiles(NodeChildren, value), leaves(NodeChildren)
+    { }
+    //! Copies all leaves
+    Node(const Node &other)
+      : tiles(other.tiles), leaves(NodeChildren)
+    {
+      for (int ci = 0; ci < NodeChildren; ++ci) {
+        if (other.leaves[ci]) {
+          leaves[ci].reset(new Leaf(*other.leaves[ci]));
+        }
+      }
+    }
+    //! Value of each slot without a leaf
+    std::vector<Data_T>  tiles;
+    //! Leaf of each slot. Null for tiles.
+    std::vector<LeafPtr> leaves;
+  };
+
+  typedef boost::shared_ptr<Node> NodePtr;
+
+  // Utility methods -----------------------------------------------------------
+
+  void applyDataWindowOffset(int &i, int &j, int &k) const
+  {
+    i -= base::m_dataWindow.min.x;
+    j -= base::m_dataWindow.min.y;
+    k -= base::m_dataWindow.min.z;
+  }
+  int nodeIndex(const int ni, const int nj, const int nk) const
+  { return (nk * m_rootRes.y + nj) * m_rootRes.x + ni; }
+  //! Index within its node of the leaf holding voxel i, j, k
+  static int childIndex(const int i, const int j, const int k)
+  { return leafChildIndex(i >> LeafOrder, j >> LeafOrder, k >> LeafOrder); }
+  //! Index within its node of leaf li, lj, lk
+  static int leafChildIndex(const int li, const int lj, const int lk)
+  {
+    const int mask = (1 << NodeOrder) - 1;
+    return ((((lk & mask) << NodeOrder) + (lj & mask)) << NodeOrder) +
+      (li & mask);
+  }
+  //! Index within its leaf of voxel i, j, k
+  static int voxelIndex(const int i, const int j, const int k)
+  {
+    const int mask = (1 << LeafOrder) - 1;
+    return ((((k & mask) << LeafOrder) + (j & mask)) << LeafOrder) +
+      (i & mask);
+  }
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<TreeField<Data_T> > ms_classType;
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef ResizableField<Data_T> base;
+
+  // Private data members ------------------------------------------------------
+
+  //! Number of nodes along each axis
+  V3i                  m_rootRes;
+  //! Value of each root slot without a node
+  std::vector<Data_T>  m_rootTiles;
+  //! Node of each root slot. Null for tiles.
+  std::vector<NodePtr> m_nodes;
+
+};
+
+//----------------------------------------------------------------------------//
+// Static data member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(TreeField);
+
+//----------------------------------------------------------------------------//
+
+} // namespace Field3D
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
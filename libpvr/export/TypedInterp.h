@@ -0,0 +1,512 @@
+//-*-c++-*--------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file TypedInterp.h
+  Contains interpolators that read dense and sparse buffers directly,
+  without going through the virtual Field::value() call. Buffers with
+  reduced storage (see VoxelBuffer.h) are converted to color as they are
+  read.
+ */
+
+//----------------------------------------------------------------------------//
+
+#ifndef __INCLUDED_PVR_TYPEDINTERP_H__
+#define __INCLUDED_PVR_TYPEDINTERP_H__
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// System headers
+
+#include <algorithm>
+#include <cmath>
+
+// Library headers
+
+#include <Field3D/DenseField.h>
+#include <Field3D/SparseField.h>
+
+// Project headers
+
+#include "pvr/CubicInterp.h"
+#include "pvr/Filter.h"
+#include "pvr/LinearInterp.h"
+#include "pvr/TreeField.h"
+#include "pvr/Types.h"
+#include "pvr/VoxelBuffer.h"
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Interp {
+
+//----------------------------------------------------------------------------//
+// Conversion to color
+//----------------------------------------------------------------------------//
+
+//! Converts a voxel of any supported storage type to a color. Scalars
+//! become grey.
+inline Imath::V3f toColor(const Imath::V3f &value)
+{ return value; }
+inline Imath::V3f toColor(const Field3D::V3h &value)
+{ return Imath::V3f(value.x, value.y, value.z); }
+inline Imath::V3f toColor(const float value)
+{ return Imath::V3f(value); }
+inline Imath::V3f toColor(const Field3D::half value)
+{ return Imath::V3f(static_cast<float>(value)); }
+
+//----------------------------------------------------------------------------//
+// DenseAccess
+//----------------------------------------------------------------------------//
+
+/*! \class DenseAccess
+  \brief Reads the voxels of a DenseField straight from its memory.
+
+  Neighborhoods are gathered using precomputed strides, with indices
+  clamped to the data window the same way the Field3D-based interpolators
+  do it.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T = Imath::V3f>
+class DenseAccess
+{
+public:
+
+  // Ctor ----------------------------------------------------------------------
+
+  DenseAccess(const Field3D::DenseField<Data_T> &buffer)
+    : m_dw(buffer.dataWindow())
+  {
+    const Imath::V3i res = m_dw.size() + Imath::V3i(1);
+    m_origin  = &buffer.fastValue(m_dw.min.x, m_dw.min.y, m_dw.min.z);
+    m_strideY = res.x;
+    m_strideZ = res.x * res.y;
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Gathers the Width^3 voxels starting at corner. The values array is
+  //! indexed [i][j][k].
+  template <int Width>
+  void gather(const Imath::V3i &corner,
+              Imath::V3f (&values)[Width][Width][Width]) const
+  {
+    int offsetX[Width], offsetY[Width], offsetZ[Width];
+    for (int n = 0; n < Width; ++n) {
+      offsetX[n] = clamp(corner.x + n, m_dw.min.x, m_dw.max.x) - m_dw.min.x;
+      offsetY[n] = (clamp(corner.y + n, m_dw.min.y, m_dw.max.y) -
+                    m_dw.min.y) * m_strideY;
+      offsetZ[n] = (clamp(corner.z + n, m_dw.min.z, m_dw.max.z) -
+                    m_dw.min.z) * m_strideZ;
+    }
+    for (int ki = 0; ki < Width; ++ki) {
+      for (int ji = 0; ji < Width; ++ji) {
+        const Data_T *row = m_origin + offsetY[ji] + offsetZ[ki];
+        for (int ii = 0; ii < Width; ++ii) {
+          values[ii][ji][ki] = toColor(row[offsetX[ii]]);
+        }
+      }
+    }
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  static int clamp(const int i, const int lo, const int hi)
+  { return std::min(std::max(i, lo), hi); }
+
+  // Private data members ------------------------------------------------------
+
+  //! Data window of the buffer
+  Imath::Box3i      m_dw;
+  //! Points to the voxel at m_dw.min
+  const Data_T     *m_origin;
+  //! Distance between voxels along y and z. x is contiguous.
+  int               m_strideY, m_strideZ;
+
+};
+
+//----------------------------------------------------------------------------//
+// SparseAccess
+//----------------------------------------------------------------------------//
+
+/*! \class SparseAccess
+  \brief Reads the voxels of a SparseField, looking up the block only
+  once when a whole neighborhood lies in the same block.
+
+  Neighborhoods that straddle a block boundary fall back to fastValue(),
+  which is still non-virtual but looks up the block for each voxel. So 
+  do all lookups in buffers that are dynamically loaded from disk, since
+  their blocks may be evicted from memory at any time.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T = Imath::V3f>
+class SparseAccess
+{
+public:
+
+  // Ctor ----------------------------------------------------------------------
+
+  //! useBlockData must be false for dynamically loaded buffers
+  SparseAccess(const Field3D::SparseField<Data_T> &buffer, 
+               const bool useBlockData = true)
+    : m_buffer(buffer), m_dw(buffer.dataWindow()),
+      m_blockOrder(buffer.blockOrder()), m_blockMask(buffer.blockSize() - 1),
+      m_useBlockData(useBlockData)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Gathers the Width^3 voxels starting at corner. The values array is
+  //! indexed [i][j][k].
+  template <int Width>
+  void gather(const Imath::V3i &corner,
+              Imath::V3f (&values)[Width][Width][Width]) const
+  {
+    // Clamp to the data window ---
+
+    int i[Width], j[Width], k[Width];
+    for (int n = 0; n < Width; ++n) {
+      i[n] = std::min(std::max(corner.x + n, m_dw.min.x), m_dw.max.x);
+      j[n] = std::min(std::max(corner.y + n, m_dw.min.y), m_dw.max.y);
+      k[n] = std::min(std::max(corner.z + n, m_dw.min.z), m_dw.max.z);
+    }
+
+    // Check if the neighborhood lies in a single block ---
+
+    // Block coordinates are relative to the data window
+    const Imath::V3i bMin(blockCoord(i[0], m_dw.min.x),
+                          blockCoord(j[0], m_dw.min.y),
+                          blockCoord(k[0], m_dw.min.z));
+    const Imath::V3i bMax(blockCoord(i[Width - 1], m_dw.min.x),
+                          blockCoord(j[Width - 1], m_dw.min.y),
+                          blockCoord(k[Width - 1], m_dw.min.z));
+
+    if (bMin != bMax || 
+        (!m_useBlockData && m_buffer.blockIsAllocated(bMin.x, bMin.y, 
+                                                      bMin.z))) {
+      for (int ki = 0; ki < Width; ++ki) {
+        for (int ji = 0; ji < Width; ++ji) {
+          for (int ii = 0; ii < Width; ++ii) {
+            values[ii][ji][ki] = 
+              toColor(m_buffer.fastValue(i[ii], j[ji], k[ki]));
+          }
+        }
+      }
+      return;
+    }
+
+    // Unallocated blocks are constant ---
+
+    const Data_T *block = m_useBlockData ? 
+      m_buffer.blockData(bMin.x, bMin.y, bMin.z) : NULL;
+
+    if (!block) {
+      const Imath::V3f value =
+        toColor(m_buffer.getBlockEmptyValue(bMin.x, bMin.y, bMin.z));
+      for (int ii = 0; ii < Width; ++ii) {
+        for (int ji = 0; ji < Width; ++ji) {
+          for (int ki = 0; ki < Width; ++ki) {
+            values[ii][ji][ki] = value;
+          }
+        }
+      }
+      return;
+    }
+
+    // Read directly from the block ---
+
+    int offsetX[Width], offsetY[Width], offsetZ[Width];
+    for (int n = 0; n < Width; ++n) {
+      offsetX[n] = (i[n] - m_dw.min.x) & m_blockMask;
+      offsetY[n] = ((j[n] - m_dw.min.y) & m_blockMask) << m_blockOrder;
+      offsetZ[n] = ((k[n] - m_dw.min.z) & m_blockMask) << (2 * m_blockOrder);
+    }
+    for (int ki = 0; ki < Width; ++ki) {
+      for (int ji = 0; ji < Width; ++ji) {
+        const Data_T *row = block + offsetY[ji] + offsetZ[ki];
+        for (int ii = 0; ii < Width; ++ii) {
+          values[ii][ji][ki] = toColor(row[offsetX[ii]]);
+        }
+      }
+    }
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  int blockCoord(const int i, const int dwMin) const
+  { return (i - dwMin) >> m_blockOrder; }
+
+  // Private data members ------------------------------------------------------
+
+  //! Buffer being read
+  const Field3D::SparseField<Data_T> &m_buffer;
+  //! Data window of the buffer
+  Imath::Box3i        m_dw;
+  //! Log2 of the block size
+  int                 m_blockOrder;
+  //! Block size - 1. Masks out the voxel index within a block.
+  int                 m_blockMask;
+  //! Whether allocated blocks may be read through blockData()
+  bool                m_useBlockData;
+
+};
+
+//----------------------------------------------------------------------------//
+// TreeAccess
+//----------------------------------------------------------------------------//
+
+/*! \class TreeAccess
+  \brief Reads the voxels of a TreeField straight from its leaves.
+
+  Works like SparseAccess, with leaves in place of blocks. Neighborhoods
+  inside a tile get the tile value without touching the tree again.
+ */
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T = Imath::V3f>
+class TreeAccess
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Field3D::TreeField<Data_T> Tree;
+
+  // Ctor ----------------------------------------------------------------------
+
+  TreeAccess(const Tree &buffer)
+    : m_buffer(buffer), m_dw(buffer.dataWindow())
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Gathers the Width^3 voxels starting at corner. The values array is
+  //! indexed [i][j][k].
+  template <int Width>
+  void gather(const Imath::V3i &corner,
+              Imath::V3f (&values)[Width][Width][Width]) const
+  {
+    // Clamp to the data window ---
+
+    int i[Width], j[Width], k[Width];
+    for (int n = 0; n < Width; ++n) {
+      i[n] = std::min(std::max(corner.x + n, m_dw.min.x), m_dw.max.x);
+      j[n] = std::min(std::max(corner.y + n, m_dw.min.y), m_dw.max.y);
+      k[n] = std::min(std::max(corner.z + n, m_dw.min.z), m_dw.max.z);
+    }
+
+    // Check if the neighborhood lies in a single leaf ---
+
+    const Imath::V3i lMin(leafCoord(i[0], m_dw.min.x),
+                          leafCoord(j[0], m_dw.min.y),
+                          leafCoord(k[0], m_dw.min.z));
+    const Imath::V3i lMax(leafCoord(i[Width - 1], m_dw.min.x),
+                          leafCoord(j[Width - 1], m_dw.min.y),
+                          leafCoord(k[Width - 1], m_dw.min.z));
+
+    if (lMin != lMax) {
+      for (int ki = 0; ki < Width; ++ki) {
+        for (int ji = 0; ji < Width; ++ji) {
+          for (int ii = 0; ii < Width; ++ii) {
+            values[ii][ji][ki] = 
+              toColor(m_buffer.fastValue(i[ii], j[ji], k[ki]));
+          }
+        }
+      }
+      return;
+    }
+
+    // Tiles are constant ---
+
+    const Data_T *leaf = m_buffer.leafData(lMin.x, lMin.y, lMin.z);
+
+    if (!leaf) {
+      const Imath::V3f value =
+        toColor(m_buffer.leafTileValue(lMin.x, lMin.y, lMin.z));
+      for (int ii = 0; ii < Width; ++ii) {
+        for (int ji = 0; ji < Width; ++ji) {
+          for (int ki = 0; ki < Width; ++ki) {
+            values[ii][ji][ki] = value;
+          }
+        }
+      }
+      return;
+    }
+
+    // Read directly from the leaf ---
+
+    const int order = Tree::LeafOrder;
+    const int mask  = Tree::leafSize() - 1;
+    int offsetX[Width], offsetY[Width], offsetZ[Width];
+    for (int n = 0; n < Width; ++n) {
+      offsetX[n] = (i[n] - m_dw.min.x) & mask;
+      offsetY[n] = ((j[n] - m_dw.min.y) & mask) << order;
+      offsetZ[n] = ((k[n] - m_dw.min.z) & mask) << (2 * order);
+    }
+    for (int ki = 0; ki < Width; ++ki) {
+      for (int ji = 0; ji < Width; ++ji) {
+        const Data_T *row = leaf + offsetY[ji] + offsetZ[ki];
+        for (int ii = 0; ii < Width; ++ii) {
+          values[ii][ji][ki] = toColor(row[offsetX[ii]]);
+        }
+      }
+    }
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  static int leafCoord(const int i, const int dwMin)
+  { return (i - dwMin) >> Tree::LeafOrder; }
+
+  // Private data members ------------------------------------------------------
+
+  //! Buffer being read
+  const Tree   &m_buffer;
+  //! Data window of the buffer
+  Imath::Box3i  m_dw;
+
+};
+
+//----------------------------------------------------------------------------//
+// Interpolators
+//----------------------------------------------------------------------------//
+
+/*! \class Point
+  \brief Point sampling. Matches VoxelVolume's NoInterp lookups.
+
+  The interpolators below take any access class with a gather() method,
+  so that the tap loop is compiled once per buffer type. Each one
+  reproduces the math of its Field3D-based counterpart.
+ */
+
+struct Point
+{
+  template <typename Access_T>
+  Imath::V3f sample(const Access_T &access, const Vector &vsP) const
+  {
+    const Imath::V3i c(static_cast<int>(std::floor(vsP.x)),
+                       static_cast<int>(std::floor(vsP.y)),
+                       static_cast<int>(std::floor(vsP.z)));
+    Imath::V3f values[1][1][1];
+    access.template gather<1>(c, values);
+    return values[0][0][0];
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Trilinear interpolation. Matches Field3D::LinearFieldInterp.
+struct Linear
+{
+  template <typename Access_T>
+  Imath::V3f sample(const Access_T &access, const Vector &vsP) const
+  {
+    // Voxel centers are at .5 coordinates
+    const Vector p = vsP - Vector(0.5);
+    const Vector f(std::floor(p.x), std::floor(p.y), std::floor(p.z));
+    const Imath::V3i c(static_cast<int>(f.x), static_cast<int>(f.y),
+                       static_cast<int>(f.z));
+    const Imath::V3f x(p - f);
+    Imath::V3f values[2][2][2];
+    access.template gather<2>(c, values);
+    return Field3D::trilinearInterp(x.x, x.y, x.z, values);
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Tricubic interpolation. Matches Field3D::TriCubicFieldInterp.
+struct Cubic
+{
+  template <typename Access_T>
+  Imath::V3f sample(const Access_T &access, const Vector &vsP) const
+  {
+    const Vector p = vsP - Vector(0.5);
+    const Vector f(std::floor(p.x), std::floor(p.y), std::floor(p.z));
+    const Imath::V3i c(static_cast<int>(f.x) - 1, static_cast<int>(f.y) - 1,
+                       static_cast<int>(f.z) - 1);
+    const Imath::V3f x(p - f);
+    Imath::V3f values[4][4][4];
+    access.template gather<4>(c, values);
+    return Field3D::tricubicInterp(x.x, x.y, x.z, values);
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Filtered interpolation using one of the kernels in pvr::Filter.
+//! Matches Field3D::GaussianFieldInterp and Field3D::MitchellFieldInterp,
+//! up to the precision of the weight table. Building the table is not 
+//! free, so instances should be kept around rather than created per 
+//! lookup.
+template <typename Filter_T>
+struct Filtered
+{
+  template <typename Access_T>
+  Imath::V3f sample(const Access_T &access, const Vector &vsP) const
+  {
+    const int width = Filter_T::width;
+    const Vector p = vsP - Vector(0.5);
+    const Vector f(std::floor(p.x), std::floor(p.y), std::floor(p.z));
+    const Imath::V3i c(static_cast<int>(f.x) - width / 2 + 1,
+                       static_cast<int>(f.y) - width / 2 + 1,
+                       static_cast<int>(f.z) - width / 2 + 1);
+    const Imath::V3f x(p - f);
+    float wx[width], wy[width], wz[width];
+    m_table.weights(x.x, wx);
+    m_table.weights(x.y, wy);
+    m_table.weights(x.z, wz);
+    Imath::V3f values[width][width][width];
+    access.template gather<width>(c, values);
+    return Filter::weightedSum3D<Imath::V3f, width>(wx, wy, wz, values);
+  }
+  Filter::WeightTable<Filter_T> m_table;
+};
+
+//----------------------------------------------------------------------------//
+
+typedef Filtered<Filter::Gaussian>          Gaussian;
+typedef Filtered<Filter::MitchellNetravali> Mitchell;
+
+//----------------------------------------------------------------------------//
+
+} // namespace Interp
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
+
+//----------------------------------------------------------------------------//
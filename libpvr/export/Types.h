@@ -51,6 +51,10 @@
 
 #include <Field3D/Field.h>
 
+// Project headers
+
+#include "pvr/SmallVector.h"
+
 //----------------------------------------------------------------------------//
 // Namespaces 
 //----------------------------------------------------------------------------//
@@ -112,8 +116,9 @@ struct Interval
   // Constructor ---------------------------------------------------------------
 
   //! Default constructor
-  Interval(double start, double end, double step)
-    : t0(start), t1(end), stepLength(step) 
+  Interval(double start, double end, double step, bool homogeneous = false)
+    : t0(start), t1(end), stepLength(step), isHomogeneous(homogeneous),
+      scalesWithFootprint(false)
   { }
 
   // Public data members -------------------------------------------------------
@@ -125,9 +130,20 @@ struct Interval
   //! The world space step length that is reasonable to use for the given 
   //! interval.
   double stepLength;
+  //! Whether the volume is known to be constant along the interval. 
+  //! Raymarchers may then integrate transmittance analytically instead of
+  //! stepping through it.
+  bool   isHomogeneous;
+  //! Whether the volume filters away detail smaller than the ray's 
+  //! footprint along the interval, for example by sampling a mipmap. 
+  //! Raymarchers may then step further than stepLength where the 
+  //! footprint is large.
+  bool   scalesWithFootprint;
 };
 
-typedef std::vector<Interval> IntervalVec;
+//! Most rays only pass through a handful of intervals, which then fit
+//! without heap allocation.
+typedef SmallVector<Interval, 16> IntervalVec;
 
 //----------------------------------------------------------------------------//
 // Common PVR types
@@ -32,6 +32,9 @@
 // Includes
 //----------------------------------------------------------------------------//
 
+#include <string>
+#include <vector>
+
 #include "Exception.h"
 
 //----------------------------------------------------------------------------//
@@ -49,16 +52,13 @@ namespace Render {
   \brief Utility class that makes it simple to efficiently reference an 
   attribute in a Volume using a name string.
 
-  A VolumeAttr instance is created with its name, and its index set to
-  IndexNotSet. The first time the instance is used to sample a Volume, that
-  Volume is responsible for setting the index of the VolumeAttr, so that
-  future calls to Volume::sample() efficiently can determine which attribute
-  is requested.
-
-  \note A single VolumeAttr can only be used to sample into a single Volume.
-  Once the index has been locked in, there is no guarantee that the attribute
-  name first specified will have the same index in a second Volume.
-  Caveat Emptor.
+  A VolumeAttr instance is created with its name. At construction time the
+  name is turned into a process-wide unique id, so that attributes with the
+  same name always share the same id. Volumes map ids to their own attribute
+  indices using a VolumeAttrTable, which is set up when attributes are added
+  to the Volume. This means that sampling never needs to modify either the
+  VolumeAttr or the Volume, and a single VolumeAttr may be used to sample
+  any number of Volumes, from any number of threads.
  */
 
 //----------------------------------------------------------------------------//
@@ -69,12 +69,7 @@ public:
   
   // Enums ---------------------------------------------------------------------
 
-  static const int IndexNotSet  = -1;
-  static const int IndexInvalid = -2;
-
-  // Exceptions ----------------------------------------------------------------
-
-  DECLARE_PVR_RT_EXC(SetIndexException, "Couldn't set index of of VolumeAttr:");
+  static const int IndexInvalid = -1;
 
   // Constructors --------------------------------------------------------------
 
@@ -84,16 +79,15 @@ public:
 
   //! Returns the name of the attribute
   const std::string& name() const;
-  //! Returns the index of the attribute
-  int                index() const;
-  //! Sets the index of the attribute.
-  //! \note This is const, because the value always needs to be set on first
-  //! use, and re-setting is prohibited.
-  //! \throws SetIndexException if trying to set the index more than once
-  void               setIndex(const int index) const;
-  //! Marks the index as invalid. This is set whenever a Volume decides it
-  //! can't provide the requested attribute
-  void               setIndexInvalid() const;
+  //! Returns the unique id of the attribute name
+  size_t             id() const
+  { return m_id; }
+
+  // Static methods ------------------------------------------------------------
+
+  //! Returns the unique id for a given attribute name. The id is allocated
+  //! the first time a name is seen.
+  static size_t      idForName(const std::string &name);
 
 private:
 
@@ -101,8 +95,49 @@ private:
 
   //! Name of attribute
   std::string m_name;
-  //! Index of attribute. This is IndexNotSet by default.
-  mutable int m_index;
+  //! Unique id of attribute name
+  size_t      m_id;
+
+};
+
+//----------------------------------------------------------------------------//
+// VolumeAttrTable class
+//----------------------------------------------------------------------------//
+
+/*! \class VolumeAttrTable
+  \brief Maps VolumeAttr ids to the attribute indices of a single Volume.
+
+  The table is built when attributes are added to a Volume and is only read
+  from during rendering.
+ */
+
+//----------------------------------------------------------------------------//
+
+class VolumeAttrTable
+{
+public:
+
+  // Main methods --------------------------------------------------------------
+
+  //! Maps the given attribute name to an index. If the name has already
+  //! been added the first index is kept.
+  void addAttribute(const std::string &name, const int index);
+  //! Removes all entries
+  void clear();
+  //! Returns the index for the given attribute, or VolumeAttr::IndexInvalid
+  //! if the attribute isn't in the table.
+  int  index(const VolumeAttr &attr) const
+  { 
+    const size_t id = attr.id();
+    return id < m_indices.size() ? m_indices[id] : VolumeAttr::IndexInvalid; 
+  }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! Index for each attribute id
+  std::vector<int> m_indices;
 
 };
 
@@ -114,3 +149,5 @@ private:
 //----------------------------------------------------------------------------//
 
 #endif // Include guard
+
+//----------------------------------------------------------------------------//
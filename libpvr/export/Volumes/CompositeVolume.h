@@ -43,6 +43,7 @@
 // Project headers
 
 #include "pvr/export.h"
+#include "pvr/Acceleration.h"
 #include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
@@ -59,6 +60,12 @@ namespace Render {
 /*! \class CompositeVolume
   \brief Takes an arbitrary number of input Volumes, and exposes them as a
   single instance. Attribute values are composited/blended.
+
+  A bounding volume hierarchy over the children's bounds is built by 
+  prepare(), once per render, so that sampling and intersection only visit
+  the children that can contribute. Adding a child invalidates it, and 
+  until it's rebuilt all children are visited. Children with empty bounds
+  are considered unbounded and are always visited.
  */
 
 //----------------------------------------------------------------------------//
@@ -67,27 +74,15 @@ class LIBPVR_PUBLIC CompositeVolume : public Volume
 {
 public:
 
-  // Structs -------------------------------------------------------------------
-
-  //! This struct is used to hold a set of VolumeAttr instances that can be
-  //! used to sample the child volumes. In general, ChildAtts::attrs will be
-  //! the same length as CompositeVolume::m_volumes.
-  struct ChildAttrs
-  {
-    std::string             name; 
-    std::vector<VolumeAttr> attrs;
-  };
-
   // Typedefs ------------------------------------------------------------------
 
   PVR_TYPEDEF_SMART_PTRS(CompositeVolume);
-  typedef std::vector<ChildAttrs> ChildAttrsVec;
 
   // Ctor, factory -------------------------------------------------------------
 
   //! Default constructor
   CompositeVolume()
-    : m_compositePhaseFunction(new Phase::Composite)
+    : m_compositePhaseFunction(new Phase::Composite), m_bvhValid(false)
   { 
     m_phaseFunction = m_compositePhaseFunction;
   }
@@ -107,6 +102,29 @@ public:
   virtual BBox         wsBounds() const;
   virtual IntervalVec  intersect(const RayState &state) const;
   virtual CVec         inputs() const;
+  virtual void         prepare() const;
+  virtual void         sampleAttributes(const VolumeSampleState &state,
+                                        const VolumeAttr *attributes,
+                                        const size_t numAttrs,
+                                        VolumeSample *samples) const;
+  virtual void         samplePacket(const VolumeSamplePacket &packet,
+                                    const VolumeAttr *attributes,
+                                    const size_t numAttrs,
+                                    PacketValues *values,
+                                    PacketWeights *phaseWeights) const;
+  virtual void         sampleExtinction(const VolumeSampleState &state,
+                                        Color &extinction,
+                                        Color &holdout) const;
+  virtual void         sampleExtinctionPacket(const VolumeSamplePacket &packet,
+                                              PacketValues &extinction,
+                                              PacketValues &holdout) const;
+  virtual void         maxAttributeValues(const BBox &wsBox,
+                                          const VolumeAttr *attributes,
+                                          const size_t numAttrs,
+                                          Color *maxValues) const;
+  virtual void         maxExtinction(const BBox &wsBox, Color &extinction,
+                                     Color &holdout) const;
+  virtual bool         hasConservativeBounds() const;
 
   // Main methods --------------------------------------------------------------
 
@@ -117,16 +135,27 @@ protected:
 
   // Utility methods -----------------------------------------------------------
 
-  void                 setupAttribute(const VolumeAttr &attribute) const;
+  //! Finds the children that may contain the point. All children if the 
+  //! hierarchy hasn't been built.
+  void pointQuery(const Vector &wsP, Accel::BVH::IndexVec &children) const;
+  //! Finds the children that may overlap the box
+  void boxQuery(const BBox &wsBox, Accel::BVH::IndexVec &children) const;
+  //! Finds the children that may intersect the ray
+  void rayQuery(const Ray &wsRay, Accel::BVH::IndexVec &children) const;
+  //! Lists all children, used when the hierarchy hasn't been built
+  void allChildren(Accel::BVH::IndexVec &children) const;
 
   // Protected data members ----------------------------------------------------
 
   //! Array of volumes
   std::vector<Volume::CPtr> m_volumes;
-  //! Array of child attributes. Used for sampling the child volumes.
-  mutable ChildAttrsVec     m_childAttrs;
   //! Pointer to composite phase function
   Phase::Composite::Ptr     m_compositePhaseFunction;
+  //! Hierarchy over the bounds of m_volumes. Built by prepare(), which is
+  //! called before any sampling, so it's read without locking.
+  mutable Accel::BVH        m_bvh;
+  //! Whether m_bvh is up to date with m_volumes
+  mutable bool              m_bvhValid;
 
 };
 
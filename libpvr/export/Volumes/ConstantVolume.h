@@ -82,12 +82,28 @@ public:
   virtual BBox              wsBounds() const;
   virtual IntervalVec       intersect(const RayState &state) const;
   virtual Volume::StringVec info() const;
+  virtual void              sampleAttributes(const VolumeSampleState &state,
+                                             const VolumeAttr *attributes,
+                                             const size_t numAttrs,
+                                             VolumeSample *samples) const;
+  virtual void              samplePacket(const VolumeSamplePacket &packet,
+                                         const VolumeAttr *attributes,
+                                         const size_t numAttrs,
+                                         PacketValues *values,
+                                         PacketWeights *phaseWeights) const;
+  virtual void              maxAttributeValues(const BBox &wsBox,
+                                               const VolumeAttr *attributes,
+                                               const size_t numAttrs,
+                                               Color *maxValues) const;
+  virtual bool              hasConservativeBounds() const;
 
 protected:
 
   // Utility methods -----------------------------------------------------------
 
-  
+  //! Returns the world to local transform at the time of the given ray. 
+  //! Interpolated once per ray and cached in the ray's transform cache.
+  ResolvedTransform worldToLocal(const RayState &state) const;
 
   // Data members --------------------------------------------------------------
   
@@ -101,6 +117,8 @@ protected:
   AttrNameVec             m_attrNames;
   //! Attribute scaling values
   std::vector<Imath::V3f> m_attrValues;
+  //! Maps VolumeAttr ids to indices in m_attrNames/m_attrValues
+  VolumeAttrTable         m_attrTable;
   //! Maximum value of all attributes. Used to compute a base 
   float                   m_maxAttrValue;
 
@@ -73,7 +73,7 @@ public:
 
   PVR_DEFINE_CREATE_FUNC(FractalCloud);
   FractalCloud()
-    : m_density(1.0f), m_stepLength(1.0)
+    : m_scatteringAttr("scattering"), m_density(1.0f), m_stepLength(1.0)
   { }
 
   // From ParamBase ------------------------------------------------------------
@@ -104,6 +104,8 @@ protected:
 
   // Protected data members ----------------------------------------------------
 
+  //! The only attribute provided by the volume
+  const VolumeAttr m_scatteringAttr;
   //! Fractal function
   Noise::Fractal::CPtr m_fractal;
 
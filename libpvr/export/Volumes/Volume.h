@@ -60,15 +60,32 @@ struct VolumeSample
   
   // Constructors ---
 
+  VolumeSample()
+    : value(0.0f)
+  { }
   VolumeSample(const Color &v, Phase::PhaseFunction::CPtr p)
     : value(v), phaseFunction(p)
   { }
 
+  // Main methods ---
+
+  //! Returns the phase function probability, taking phaseWeights into 
+  //! account
+  float phaseProbability(const Vector &in, const Vector &out) const
+  { 
+    return phaseWeights.empty() ? 
+      phaseFunction->probability(in, out) :
+      phaseFunction->weightedProbability(in, out, phaseWeights);
+  }
+
   // Public data members ---
 
   Color value;
   Phase::PhaseFunction::CPtr phaseFunction;
-
+  //! Weights of the inputs that contributed to the sample, used when 
+  //! phaseFunction blends several inputs. Empty for all other phase 
+  //! functions.
+  Phase::PhaseFunction::Weights phaseWeights;
 };
 
 //----------------------------------------------------------------------------//
@@ -86,6 +103,17 @@ public:
   typedef std::vector<std::string>  AttrNameVec;
   typedef std::vector<std::string>  StringVec;
   typedef std::vector<Volume::CPtr> CVec;
+  //! Values of a single attribute for each sample in a packet
+  typedef Color                     PacketValues[VolumeSamplePacket::MaxSize];
+  //! Phase function weights for each sample in a packet
+  typedef Phase::PhaseFunction::Weights 
+                                    PacketWeights[VolumeSamplePacket::MaxSize];
+
+  // Enums ---------------------------------------------------------------------
+
+  //! Maximum number of attributes that may be sampled in a single call to
+  //! sampleAttributes() or samplePacket()
+  enum { MaxAttributes = 8 };
 
   // Constructors and destructor -----------------------------------------------
 
@@ -107,6 +135,8 @@ public:
   virtual AttrNameVec        attributeNames() const = 0;
   //! Returns the value of the volume node for a given point.
   //! \note The point position is found in state.wsP
+  //! \note Must not modify the Volume, as it may be called from several
+  //! threads at once.
   virtual VolumeSample       sample(const VolumeSampleState &state,
                                     const VolumeAttr &attribute) const = 0;
   //! Returns an axis-aligned world space bounding box.
@@ -122,6 +152,71 @@ public:
   virtual StringVec          info() const;
   //! Returns a vector of other volumes that the volume references
   virtual CVec               inputs() const;
+  //! Called by Renderer::execute() on the calling thread, before any rays
+  //! of the render are traced. Lets volumes build acceleration structures
+  //! from the final state of their inputs. The default implementation 
+  //! prepares the inputs.
+  virtual void               prepare() const;
+  //! Samples several attributes at the same point, writing the results
+  //! to samples[0, numAttrs). The default implementation calls sample()
+  //! for each attribute. Subclasses override it so that the transform
+  //! and interpolation are only computed once.
+  //! \note numAttrs may not be larger than MaxAttributes.
+  virtual void               sampleAttributes(const VolumeSampleState &state,
+                                              const VolumeAttr *attributes,
+                                              const size_t numAttrs,
+                                              VolumeSample *samples) const;
+  //! Samples several attributes at all the points in a packet. Only the 
+  //! values are returned, values[attr][i] holds attribute attr for sample i.
+  //! If phaseWeights isn't NULL, the phase function weights that 
+  //! sampleAttributes() would return with the first attribute are appended 
+  //! to (*phaseWeights)[i], for the FullRaymarch samples. The phase 
+  //! function itself is always phaseFunction(). The default implementation
+  //! calls sampleAttributes() for each point. Subclasses may override it 
+  //! to amortize attribute lookups and transforms over the whole packet.
+  //! \note numAttrs may not be larger than MaxAttributes.
+  virtual void               samplePacket(const VolumeSamplePacket &packet,
+                                          const VolumeAttr *attributes,
+                                          const size_t numAttrs,
+                                          PacketValues *values,
+                                          PacketWeights *phaseWeights) const;
+  //! Samples the extinction coefficient (scattering + absorption) and the
+  //! holdout coefficient. Used for transmittance-only rays, which don't
+  //! need any other attributes. The default implementation samples 
+  //! scattering, absorption and holdout with sampleAttributes().
+  virtual void               sampleExtinction(const VolumeSampleState &state,
+                                              Color &extinction,
+                                              Color &holdout) const;
+  //! Samples the extinction and holdout coefficients at all the points in
+  //! a packet, with the same result as sampleExtinction(). The default 
+  //! implementation samples scattering, absorption and holdout with 
+  //! samplePacket().
+  virtual void               sampleExtinctionPacket
+  (const VolumeSamplePacket &packet, PacketValues &extinction, 
+   PacketValues &holdout) const;
+  //! Computes upper bounds on several attributes within a world space 
+  //! box, over the whole shutter interval, writing the results to 
+  //! maxValues[0, numAttrs). Used to build majorants for tracking 
+  //! raymarchers. The default implementation estimates the bounds by 
+  //! sampling the box on a regular lattice and padding the result, which
+  //! isn't guaranteed to be conservative. Subclasses that can compute an
+  //! exact bound should override it.
+  //! \note numAttrs may not be larger than MaxAttributes.
+  virtual void               maxAttributeValues(const BBox &wsBox,
+                                                const VolumeAttr *attributes,
+                                                const size_t numAttrs,
+                                                Color *maxValues) const;
+  //! Computes upper bounds on the values returned by sampleExtinction() 
+  //! within a world space box, over the whole shutter interval. The 
+  //! default implementation bounds scattering + absorption and holdout 
+  //! using maxAttributeValues().
+  virtual void               maxExtinction(const BBox &wsBox,
+                                           Color &extinction,
+                                           Color &holdout) const;
+  //! Whether maxAttributeValues() and maxExtinction() are guaranteed to be
+  //! upper bounds. False for the default lattice estimate. Majorants and
+  //! empty space culling should only be built from conservative bounds.
+  virtual bool               hasConservativeBounds() const;
 
 protected:
 
@@ -132,12 +227,6 @@ protected:
 
 };
 
-//----------------------------------------------------------------------------//
-// Utility functions
-//----------------------------------------------------------------------------//
-
-void setIndexForName(const VolumeAttr &attr, const Volume::StringVec &v);
-
 //----------------------------------------------------------------------------//
 
 } // namespace Render
@@ -34,11 +34,17 @@
 
 // System headers
 
+#include <deque>
+
 #include <boost/shared_ptr.hpp>
 
 // Library headers
 
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <Field3D/FieldMapping.h>
 
@@ -48,6 +54,7 @@
 #include "pvr/CubicInterp.h"
 #include "pvr/GaussianInterp.h"
 #include "pvr/MitchellInterp.h"
+#include "pvr/TypedInterp.h"
 #include "pvr/Volumes/Volume.h"
 #include "pvr/VoxelBuffer.h"
 
@@ -150,10 +157,91 @@ public:
                                const IntervalVec &intervals) const = 0;
 };
 
+//----------------------------------------------------------------------------//
+// SparseBlockPrefetcher
+//----------------------------------------------------------------------------//
+
+/*! \class SparseBlockPrefetcher
+  \brief Loads blocks of a dynamically loaded SparseBuffer on a background
+  thread, ahead of the rays that will sample them.
+
+  The sparse optimizers collect the allocated blocks that a ray passes 
+  through and hand them over in one batch, so the lock is taken once per
+  ray rather than once per block. Requests are dropped once maxQueued 
+  blocks are waiting, so prefetching never holds up the render threads. 
+  Blocks are loaded by reading a voxel, which leaves them in Field3D's 
+  block cache until they get evicted.
+ */
+
+//----------------------------------------------------------------------------//
+
+class SparseBlockPrefetcher : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(SparseBlockPrefetcher);
+  //! Blocks requested by a single ray
+  typedef SmallVector<Imath::V3i, 32> BlockVec;
+
+  // Ctor, dtor, factory -------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC_2_ARG(SparseBlockPrefetcher, SparseBuffer::Ptr,
+                               const size_t);
+  //! Starts the loader thread
+  SparseBlockPrefetcher(SparseBuffer::Ptr sparse, const size_t maxQueued);
+  //! Stops the loader thread. Queued blocks are discarded.
+  ~SparseBlockPrefetcher();
+
+  // Main methods --------------------------------------------------------------
+
+  //! Queues blocks for loading. Thread safe.
+  void prefetch(const BlockVec &blocks) const;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Loader thread main loop
+  void run();
+
+  // Private data members ------------------------------------------------------
+
+  //! Pointer to the sparse buffer
+  SparseBuffer::Ptr               m_sparse;
+  //! Maximum number of blocks waiting to be loaded
+  size_t                          m_maxQueued;
+  //! Blocks waiting to be loaded, oldest first
+  mutable std::deque<Imath::V3i>  m_queue;
+  //! Whether each block is in m_queue, so that it's only queued once
+  mutable std::vector<bool>       m_isQueued;
+  //! Whether the loader thread should exit
+  bool                            m_stop;
+  //! Guards m_queue, m_isQueued and m_stop
+  mutable boost::mutex            m_mutex;
+  //! Signals the loader thread
+  mutable boost::condition_variable m_cond;
+  //! Loader thread
+  boost::thread                   m_thread;
+};
+
 //----------------------------------------------------------------------------//
 // SparseUniformOptimizer
 //----------------------------------------------------------------------------//
 
+/*! \class SparseUniformOptimizer
+  \brief Removes the parts of a ray that only pass through empty blocks of
+  a SparseBuffer with a uniform mapping.
+
+  Blocks are grouped into a pyramid of coarser and coarser occupancy 
+  grids. The ray is walked through the coarsest grid first, and only 
+  descends into the occupied cells, so long stretches of unallocated 
+  blocks are crossed in a few steps.
+ */
+
+//----------------------------------------------------------------------------//
+
 class SparseUniformOptimizer : public EmptySpaceOptimizer
 {
 public:
@@ -166,8 +254,15 @@ public:
 
   PVR_DEFINE_CREATE_FUNC_2_ARG(SparseUniformOptimizer, SparseBuffer::Ptr,
                                Field3D::MatrixFieldMapping::Ptr);
+  PVR_DEFINE_CREATE_FUNC_3_ARG(SparseUniformOptimizer, SparseBuffer::Ptr,
+                               Field3D::MatrixFieldMapping::Ptr,
+                               SparseBlockPrefetcher::CPtr);
+  //! If a prefetcher is given, each allocated block along a ray is passed
+  //! to it.
   SparseUniformOptimizer(SparseBuffer::Ptr sparse, 
-                         Field3D::MatrixFieldMapping::Ptr mapping);
+                         Field3D::MatrixFieldMapping::Ptr mapping,
+                         SparseBlockPrefetcher::CPtr prefetcher = 
+                         SparseBlockPrefetcher::CPtr());
 
   // From ParamBase ------------------------------------------------------------
 
@@ -179,16 +274,34 @@ public:
                                const IntervalVec &intervals) const;
 private:
 
+  // Structs -------------------------------------------------------------------
+
+  //! One level of the occupancy pyramid
+  struct OccupancyLevel
+  {
+    //! Number of cells along each axis
+    Imath::V3i        res;
+    //! Number of voxels along each edge of a cell
+    int               cellSize;
+    //! Whether each cell covers any occupied block, x varying fastest
+    std::vector<bool> isOccupied;
+    size_t index(const Imath::V3i &cell) const
+    { return (cell.z * res.y + cell.y) * res.x + cell.x; }
+    bool   occupied(const Imath::V3i &cell) const
+    { return isOccupied[index(cell)]; }
+  };
+
   // Utility methods -----------------------------------------------------------
 
-  //! Constructs an Interval given the start and end blocks along the ray
-  Interval            intervalForRun(const Ray &wsRay, const PTime time,
-                                     const Imath::V3i &start, 
-                                     const Imath::V3i &end) const;
-  //! Intersects the ray with the given sparse block
-  void                intersect(const Ray &wsRay, const PTime time, 
-                                const Imath::V3i block,
-                                double &t0, double &t1) const;
+  //! Walks the ray through the cells [minCell, maxCell] of a level of the 
+  //! pyramid, from t to tEnd, descending into occupied cells. The ray 
+  //! passes through vsP0 at t0. Occupied blocks are appended to result, 
+  //! and allocated ones to prefetch. Updates t.
+  void walk(const size_t level, const Imath::V3i &minCell, 
+            const Imath::V3i &maxCell, const Vector &vsP0,
+            const Vector &vsDir, const double t0, const double stepLength,
+            double &t, const double tEnd, IntervalVec &result,
+            SparseBlockPrefetcher::BlockVec &prefetch) const;
 
   // Private data members ------------------------------------------------------
 
@@ -196,12 +309,32 @@ private:
   SparseBuffer::Ptr m_sparse;
   //! Pointer to the uniform mapping
   Field3D::MatrixFieldMapping::Ptr m_mapping;
+  //! Block prefetcher. May be null.
+  SparseBlockPrefetcher::CPtr m_prefetcher;
+  //! Voxel space position of the data window's min corner
+  Vector m_origin;
+  //! Occupancy pyramid, finest (the blocks themselves) first
+  std::vector<OccupancyLevel> m_levels;
 };
 
 //----------------------------------------------------------------------------//
 // SparseFrustumOptimizer
 //----------------------------------------------------------------------------//
 
+/*! \class SparseFrustumOptimizer
+  \brief Removes the parts of a ray that only pass through empty blocks of
+  a SparseBuffer with a frustum mapping.
+
+  Camera rays travel down a single column of blocks, which is walked 
+  along z. Any other ray, such as a shadow ray, is a straight line in 
+  voxel space as long as the mapping has a perspective z distribution. 
+  Its blocks are then walked like those of a uniform mapping, and the 
+  run boundaries are mapped back to the ray through the perspective 
+  divide.
+ */
+
+//----------------------------------------------------------------------------//
+
 class SparseFrustumOptimizer : public EmptySpaceOptimizer
 {
 public:
@@ -214,8 +347,15 @@ public:
 
   PVR_DEFINE_CREATE_FUNC_2_ARG(SparseFrustumOptimizer, SparseBuffer::Ptr,
                             Field3D::FrustumFieldMapping::Ptr);
+  PVR_DEFINE_CREATE_FUNC_3_ARG(SparseFrustumOptimizer, SparseBuffer::Ptr,
+                               Field3D::FrustumFieldMapping::Ptr,
+                               SparseBlockPrefetcher::CPtr);
+  //! If a prefetcher is given, each allocated block along a ray is passed
+  //! to it.
   SparseFrustumOptimizer(SparseBuffer::Ptr sparse, 
-                         Field3D::FrustumFieldMapping::Ptr mapping);
+                         Field3D::FrustumFieldMapping::Ptr mapping,
+                         SparseBlockPrefetcher::CPtr prefetcher = 
+                         SparseBlockPrefetcher::CPtr());
 
   // From ParamBase ------------------------------------------------------------
 
@@ -232,6 +372,9 @@ private:
   Interval            intervalForRun(const Ray &wsRay, const PTime time, 
                                      const Vector &vsFirst, 
                                      const int start, const int end) const;
+  //! Walks the blocks along an arbitrary ray
+  IntervalVec         traverse(const RayState &state, 
+                               const Interval &interval) const;
 
   // Private data members ------------------------------------------------------
   
@@ -239,6 +382,242 @@ private:
   SparseBuffer::Ptr m_sparse;
   //! Pointer to the frustum mapping
   Field3D::FrustumFieldMapping::Ptr m_mapping;
+  //! Block prefetcher. May be null.
+  SparseBlockPrefetcher::CPtr m_prefetcher;
+};
+
+//----------------------------------------------------------------------------//
+// TreeOptimizer
+//----------------------------------------------------------------------------//
+
+/*! \class TreeOptimizer
+  \brief Removes the parts of a ray that only pass through empty tiles of
+  a TreeBuffer with a uniform mapping.
+
+  The ray is first walked through the root grid. Empty root tiles are
+  skipped whole, and only allocated nodes are walked at leaf resolution,
+  where empty tiles are skipped in turn.
+ */
+
+//----------------------------------------------------------------------------//
+
+class TreeOptimizer : public EmptySpaceOptimizer
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(TreeOptimizer);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC_2_ARG(TreeOptimizer, TreeBuffer::Ptr,
+                               Field3D::MatrixFieldMapping::Ptr);
+  TreeOptimizer(TreeBuffer::Ptr tree, 
+                Field3D::MatrixFieldMapping::Ptr mapping);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(TreeOptimizer);
+
+  // From EmptySpaceOptimizer --------------------------------------------------
+
+  virtual IntervalVec optimize(const RayState &state, 
+                               const IntervalVec &intervals) const;
+
+private:
+
+  // Private data members ------------------------------------------------------
+
+  //! Pointer to the tree buffer
+  TreeBuffer::Ptr m_tree;
+  //! Pointer to the uniform mapping
+  Field3D::MatrixFieldMapping::Ptr m_mapping;
+};
+
+//----------------------------------------------------------------------------//
+// MacrocellGrid
+//----------------------------------------------------------------------------//
+
+/*! \class MacrocellGrid
+  \brief Stores the min and max voxel value of each block of voxels 
+  (macrocell) in a VoxelBuffer.
+
+  The min/max of each macrocell covers all voxels that an interpolated 
+  lookup inside the macrocell may read from, so a macrocell whose values 
+  are all zero is guaranteed to be empty for any interpolation type, and 
+  one whose min and max are equal is guaranteed to be constant.
+  Since all attributes of a VoxelVolume scale the same buffer, the min/max
+  of any attribute is the attribute's value times the buffer min/max.
+ */
+
+//----------------------------------------------------------------------------//
+
+class MacrocellGrid
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(MacrocellGrid);
+
+  // Enums ---------------------------------------------------------------------
+
+  enum CellType {
+    EmptyCell,
+    HomogeneousCell,
+    VaryingCell
+  };
+
+  // Ctor, factory -------------------------------------------------------------
+
+  //! Builds the grid. Each macrocell covers cellSize^3 voxels. Unallocated
+  //! blocks of sparse buffers are read using their empty value, without
+  //! touching individual voxels. The buffer may be a VoxelBuffer or use 
+  //! any of the reduced storage types.
+  MacrocellGrid(Field3D::FieldRes::Ptr buffer, const int cellSize);
+  PVR_DEFINE_CREATE_FUNC_2_ARG(MacrocellGrid, Field3D::FieldRes::Ptr, 
+                               const int);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns the type of a given macrocell
+  CellType          cellType(const Imath::V3i &cell) const;
+  //! Returns the min value of a given macrocell
+  const Imath::V3f& minValue(const Imath::V3i &cell) const
+  { return m_min[index(cell)]; }
+  //! Returns the max value of a given macrocell
+  const Imath::V3f& maxValue(const Imath::V3i &cell) const
+  { return m_max[index(cell)]; }
+  //! Returns the largest absolute value in the macrocells that overlap 
+  //! the given voxel space bounds.
+  Imath::V3f        maxAbsValue(const DiscreteBBox &dvsBounds) const;
+  //! Returns the macrocell containing a voxel space position. Positions
+  //! outside the data window are clamped to the closest macrocell.
+  Imath::V3i        cellForVoxel(const Vector &vsP) const;
+  //! Returns the continuous voxel space position of a macrocell's min
+  //! corner.
+  Vector            cellOrigin(const Imath::V3i &cell) const;
+  //! Returns the number of macrocells along each axis
+  const Imath::V3i& resolution() const
+  { return m_res; }
+  //! Returns the number of voxels along each edge of a macrocell
+  int               cellSize() const
+  { return m_cellSize; }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the index of a macrocell in m_min/m_max
+  size_t            index(const Imath::V3i &cell) const
+  { return (cell.z * m_res.y + cell.y) * m_res.x + cell.x; }
+  //! Expands the min/max of a range of macrocells to include a value
+  void              include(const Imath::V3i &firstCell, 
+                            const Imath::V3i &lastCell,
+                            const Imath::V3f &value);
+  //! Includes each voxel of a buffer. lo and hi hold the range of 
+  //! macrocells that each voxel index contributes to, along each axis.
+  template <typename Field_T>
+  void              includeVoxels(const Field_T &buffer, 
+                                  const std::vector<int> (&lo)[3],
+                                  const std::vector<int> (&hi)[3]);
+  //! Includes each allocated voxel and each empty block value of a sparse
+  //! buffer.
+  template <typename Data_T>
+  void              includeSparse(const Field3D::SparseField<Data_T> &buffer,
+                                  const std::vector<int> (&lo)[3],
+                                  const std::vector<int> (&hi)[3]);
+  //! Includes each allocated voxel and each tile value of a tree buffer.
+  void              includeTree(const TreeBuffer &buffer,
+                                const std::vector<int> (&lo)[3],
+                                const std::vector<int> (&hi)[3]);
+  //! Includes a constant block of voxels, given its first and last voxel
+  //! relative to the data window.
+  void              includeConstant(const Imath::V3i &first, 
+                                    const Imath::V3i &last,
+                                    const std::vector<int> (&lo)[3],
+                                    const std::vector<int> (&hi)[3],
+                                    const Imath::V3f &value);
+
+  // Private data members ------------------------------------------------------
+
+  //! Data window of the buffer
+  DiscreteBBox            m_dataWindow;
+  //! Number of macrocells along each axis
+  Imath::V3i              m_res;
+  //! Number of voxels along each edge of a macrocell
+  int                     m_cellSize;
+  //! Min value of each macrocell, x varying fastest
+  std::vector<Imath::V3f> m_min;
+  //! Max value of each macrocell, x varying fastest
+  std::vector<Imath::V3f> m_max;
+};
+
+//----------------------------------------------------------------------------//
+// MacrocellOptimizer
+//----------------------------------------------------------------------------//
+
+/*! \class MacrocellOptimizer
+  \brief Splits intervals into runs of macrocells, removing the empty runs
+  and flagging the homogeneous ones. Works for all buffer types.
+
+  Uniform mappings are traversed exactly, since the ray is a straight line
+  in voxel space. So are frustum mappings with a perspective z 
+  distribution, which map the ray to a straight line with a non-linear 
+  parameterization. Other frustum mappings bend the ray, and their 
+  intervals are passed through unoptimized.
+ */
+
+//----------------------------------------------------------------------------//
+
+class MacrocellOptimizer : public EmptySpaceOptimizer
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  PVR_TYPEDEF_SMART_PTRS(MacrocellOptimizer);
+
+  // Ctor, factory -------------------------------------------------------------
+
+  PVR_DEFINE_CREATE_FUNC_2_ARG(MacrocellOptimizer, MacrocellGrid::CPtr,
+                               Field3D::FieldMapping::Ptr);
+  MacrocellOptimizer(MacrocellGrid::CPtr macrocells, 
+                     Field3D::FieldMapping::Ptr mapping);
+
+  // From ParamBase ------------------------------------------------------------
+
+  PVR_DEFINE_TYPENAME(MacrocellOptimizer);
+
+  // From EmptySpaceOptimizer --------------------------------------------------
+
+  virtual IntervalVec optimize(const RayState &state, 
+                               const IntervalVec &intervals) const;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Traverses an interval of a uniform mapping, cell by cell
+  void                traverseUniform(const RayState &state, 
+                                      const Interval &interval,
+                                      IntervalVec &result) const;
+  //! Traverses an interval of a frustum mapping, cell by cell
+  void                traverseFrustum(const RayState &state, 
+                                      const Interval &interval,
+                                      IntervalVec &result) const;
+
+  // Private data members ------------------------------------------------------
+
+  //! Macrocell grid
+  MacrocellGrid::CPtr               m_macrocells;
+  //! Mapping of the buffer
+  Field3D::FieldMapping::Ptr        m_mapping;
+  //! The mapping, if it's a FrustumFieldMapping
+  Field3D::FrustumFieldMapping::Ptr m_frustumMapping;
+  //! Whether the mapping is a MatrixFieldMapping
+  bool                              m_isUniform;
 };
 
 //----------------------------------------------------------------------------//
@@ -295,26 +674,116 @@ public:
   virtual BBox         wsBounds() const;
   virtual IntervalVec  intersect(const RayState &state) const;
   virtual StringVec    info() const;
+  virtual void         sampleAttributes(const VolumeSampleState &state,
+                                        const VolumeAttr *attributes,
+                                        const size_t numAttrs,
+                                        VolumeSample *samples) const;
+  virtual void         samplePacket(const VolumeSamplePacket &packet,
+                                    const VolumeAttr *attributes,
+                                    const size_t numAttrs,
+                                    PacketValues *values,
+                                    PacketWeights *phaseWeights) const;
+  virtual void         sampleExtinction(const VolumeSampleState &state,
+                                        Color &extinction,
+                                        Color &holdout) const;
+  virtual void         sampleExtinctionPacket(const VolumeSamplePacket &packet,
+                                              PacketValues &extinction,
+                                              PacketValues &holdout) const;
+  virtual void         maxAttributeValues(const BBox &wsBox,
+                                          const VolumeAttr *attributes,
+                                          const size_t numAttrs,
+                                          Color *maxValues) const;
+  virtual void         maxExtinction(const BBox &wsBox, Color &extinction,
+                                     Color &holdout) const;
+  virtual bool         hasConservativeBounds() const;
 
   // Main methods --------------------------------------------------------------
 
-  //! Loads a Field3D file from disk. 
+  //! Loads a Field3D file from disk. Reads the layer set by 
+  //! setLayerName(), or the first layer if none was set.
+  //! \note If the sparse block cache is limited, sparse fields are 
+  //! streamed from the file as blocks get sampled, rather than read up 
+  //! front. See setSparseCacheSize().
   void                 load(const std::string &filename);
-  //! Sets the voxel buffer.
+  //! Sets the name of the layer to read in load(). An empty name reads
+  //! the first layer.
+  void                 setLayerName(const std::string &layerName);
+  //! Sets the voxel buffer. Also builds the buffer's macrocell grid.
   void                 setBuffer(VoxelBuffer::Ptr buffer);
+  //! Sets a voxel buffer of any supported storage type: a VoxelBuffer or
+  //! one of the reduced storage buffers in VoxelBuffer.h. Scalar buffers 
+  //! are grey, and get their color from the attribute values. 
+  //! \note Buffers with reduced storage are always read with the typed
+  //! interpolators, so NoInterp and MonotonicCubicInterp fall back to point
+  //! sampling and cubic interpolation. They can't be mipmapped or have a 
+  //! shadow proxy.
+  void                 setField(Field3D::FieldRes::Ptr field);
   //! Adds an attribute to be exposed. The supplied value acts as a scaling
   //! factor on top of the density value sampled from the voxel buffer.
+  //! \note An "extinction" attribute may be added to override the 
+  //! extinction used by transmittance-only rays. Otherwise it is baked 
+  //! from the scattering and absorption attributes.
   void                 addAttribute(const std::string &attrName, 
                                     const Imath::V3f &value);
   //! Sets the interpolator type to use for lookups.
   void                 setInterpolation(const InterpType interpType);
   //! Sets whether to use empty space optimization.
   void                 setUseEmptySpaceOptimization(const bool enabled);
+  //! Sets whether to build a mip pyramid of the buffer. Lookups along rays
+  //! whose footprint covers several voxels then read from a coarser level.
+  //! Only supported for dense and sparse buffers with matrix mappings.
+  void                 setUseMipmaps(const bool enabled);
+  //! Sets whether to build a shadow proxy: the coarsest downsampled copy 
+  //! of the buffer that stays within the shadow proxy tolerance. All rays
+  //! with rayDepth > 0 then read from the proxy, using linear 
+  //! interpolation. Same buffer requirements as setUseMipmaps().
+  void                 setUseShadowProxy(const bool enabled);
+  //! Sets the largest difference allowed between a voxel and the shadow
+  //! proxy at its center, relative to the largest voxel value.
+  void                 setShadowProxyTolerance(const float tolerance);
+  //! Sets whether to load the blocks along each ray on a background 
+  //! thread, ahead of the raymarcher. Only used for streamed sparse 
+  //! buffers with empty space optimization.
+  void                 setUseBlockPrefetch(const bool enabled);
+
+  // Static methods ------------------------------------------------------------
+
+  //! Limits the memory used by the blocks of streamed sparse fields, 
+  //! shared by all files. Once the limit is reached, the least recently
+  //! used blocks are evicted (using Field3D's clock approximation of LRU).
+  //! Zero or less disables the limit, which also disables streaming, so
+  //! that load() reads whole fields again. Only affects files loaded after
+  //! the call.
+  static void          setSparseCacheSize(const float megabytes);
 
 protected:
 
+  // Structs -------------------------------------------------------------------
+
+  //! A downsampled copy of the buffer, used for mip levels and the shadow
+  //! proxy
+  struct MipLevel
+  {
+    //! Creates an empty level
+    MipLevel()
+    { }
+    //! Creates a level for a downsampled buffer, given the data 
+    //! resolution of m_buffer.
+    MipLevel(VoxelBuffer::Ptr levelBuffer, const Vector &baseRes);
+    VoxelBuffer::Ptr  buffer;
+    //! buffer, if it is a DenseBuffer
+    DenseBuffer::Ptr  denseBuffer;
+    //! buffer, if it is a SparseBuffer
+    SparseBuffer::Ptr sparseBuffer;
+    //! Scales voxel space positions of m_buffer, relative to its data 
+    //! window origin, to voxel space positions of this level
+    Vector            scale;
+  };
+
   // Typedefs ------------------------------------------------------------------
 
+  typedef std::vector<MipLevel>                    MipLevelVec;
+  //! Linear interpolator
   typedef Field3D::LinearFieldInterp<Imath::V3f>   LinearInterpType;
   //! Cubic interpolator
   typedef Field3D::TriCubicFieldInterp<Imath::V3f> CubicInterpType;
@@ -328,17 +797,141 @@ protected:
   // Utility methods -----------------------------------------------------------
 
   void                 updateIntersectionHandler();
+  //! Sets the buffer and rebuilds everything that depends on it. 
+  //! isStreamed tells whether the blocks of a sparse field are loaded 
+  //! dynamically from a file.
+  void                 updateField(Field3D::FieldRes::Ptr field,
+                                   const bool isStreamed);
+  //! Creates m_eso for full precision sparse and tree buffers, along 
+  //! with the block prefetcher if enabled.
+  void                 updateEmptySpaceOptimizer();
+  //! Resolves the concrete type of m_field, for the typed interpolators. 
+  //! Called whenever the buffer changes.
+  void                 updateTypedBuffers();
+  //! Builds the mip pyramid, if enabled. Called whenever the buffer 
+  //! changes.
+  void                 updateMipmaps();
+  //! Builds the shadow proxy, if enabled. Called whenever the buffer 
+  //! changes.
+  void                 updateShadowProxy();
+  //! Returns the largest difference between a voxel of m_buffer and the
+  //! proxy. Stops early once the difference exceeds tolerance.
+  float                shadowProxyError(const MipLevel &proxy,
+                                        const float tolerance) const;
+  //! Builds the macrocell grid and its optimizer. Called whenever the 
+  //! buffer changes.
+  void                 updateMacrocells();
+  //! Bakes the extinction and holdout scaling values used by 
+  //! sampleExtinction(). Called whenever an attribute is added.
+  void                 updateExtinction();
+  //! Returns state.wsP in voxel space. When the point lies on the ray, 
+  //! it is found from a voxel space ray cached in the state, rather than
+  //! by transforming it.
+  Vector               voxelPosition(const VolumeSampleState &state) const;
+  //! Transforms the ray of the given state into voxel space. Returns an
+  //! invalid TransformedRay for mapping types that it can't handle.
+  TransformedRay       voxelSpaceRay(const VolumeSampleState &state) const;
+  //! Returns the interpolated buffer value at state.wsP. Returns zero 
+  //! outside the buffer's data window.
+  Imath::V3f           voxelValue(const VolumeSampleState &state) const;
+  //! Interpolates a buffer at a voxel space point, using the typed 
+  //! interpolators if dense or sparse is given.
+  Imath::V3f           interpolate(const VoxelBuffer &buffer, 
+                                   const DenseBuffer *dense,
+                                   const SparseBuffer *sparse,
+                                   const Vector &vsP) const;
+  //! Interpolates the full resolution buffer, whatever its storage type
+  Imath::V3f           baseValue(const Vector &vsP) const;
+  //! Packet version of baseValue() for buffers with reduced storage. 
+  //! Points outside the data window are set to zero.
+  void                 compactVoxelValues(const Vector *vsP, 
+                                          const bool *inBounds,
+                                          const size_t size, 
+                                          Imath::V3f *values) const;
+  //! Interpolates the shadow proxy or the mip level appropriate for the 
+  //! given ray, at parameter t along it.
+  Imath::V3f           lodValue(const RayState &rayState, const double t, 
+                                const Vector &vsP) const;
+  //! Returns whether lodValue() reads anything but m_buffer for the given
+  //! ray, at parameter t along it.
+  bool                 isReducedDetail(const RayState &rayState, 
+                                       const double t) const;
+  //! Interpolates the given mip level at a voxel space point of m_buffer.
+  //! Level zero is m_buffer itself.
+  Imath::V3f           levelValue(const size_t level, 
+                                  const Vector &vsP) const;
+  //! Returns the mip level to use at parameter t along a ray, based on 
+  //! the ray's footprint.
+  size_t               mipLevel(const RayState &rayState, 
+                                const double t) const;
+  //! Interpolates a single voxel space point with the typed interpolator
+  //! matching m_interpType. Point sampling and monotonic cubic have no 
+  //! typed version and must use the Field3D interpolators.
+  template <typename Access_T>
+  Imath::V3f           typedVoxelValue(const Access_T &access, 
+                                       const Vector &vsP) const;
+  //! Interpolates the buffer at each point of a packet, reading from the
+  //! mip levels and shadow proxy where the rays call for them. Shared by
+  //! samplePacket() and sampleExtinctionPacket().
+  void                 packetVoxelValues(const VolumeSamplePacket &packet,
+                                         Imath::V3f *value) const;
+  //! Packet version of typedVoxelValue(). Points outside the data window
+  //! are set to zero.
+  template <typename Access_T>
+  void                 typedVoxelValues(const Access_T &access, 
+                                        const Vector *vsP, 
+                                        const bool *inBounds,
+                                        const size_t size, 
+                                        Imath::V3f *values) const;
+  //! Returns the maximum value that interpolation may produce anywhere 
+  //! within a world space box, over the whole shutter interval. Uses the
+  //! macrocell grid, so the bound is only as tight as the macrocells.
+  //! Accounts for the mip levels and shadow proxy that lookups may read
+  //! from.
+  Imath::V3f           maxVoxelValue(const BBox &wsBox) const;
+  //! Returns how many voxels of m_buffer, beyond the interpolation support
+  //! covered by the macrocells, a lookup into a reduced detail level may
+  //! read from.
+  int                  reducedDetailPadding() const;
 
   // Protected data members ----------------------------------------------------
 
-  //! Voxel buffer
+  //! Voxel buffer, of any supported storage type
+  Field3D::FieldRes::Ptr    m_field;
+  //! m_field, if it is a VoxelBuffer. Null for reduced storage.
   VoxelBuffer::Ptr          m_buffer;
+  //! m_buffer, if it is a DenseBuffer. Read with the typed interpolators.
+  DenseBuffer::Ptr          m_denseBuffer;
+  //! m_buffer, if it is a SparseBuffer. Read with the typed interpolators.
+  SparseBuffer::Ptr         m_sparseBuffer;
+  //! m_buffer, if it is a TreeBuffer. Read with the typed interpolators.
+  TreeBuffer::Ptr           m_treeBuffer;
+  //! m_field, if it is a HalfDenseBuffer
+  HalfDenseBuffer::Ptr        m_halfDenseBuffer;
+  //! m_field, if it is a HalfSparseBuffer
+  HalfSparseBuffer::Ptr       m_halfSparseBuffer;
+  //! m_field, if it is a ScalarDenseBuffer
+  ScalarDenseBuffer::Ptr      m_scalarDenseBuffer;
+  //! m_field, if it is a ScalarSparseBuffer
+  ScalarSparseBuffer::Ptr     m_scalarSparseBuffer;
+  //! m_field, if it is a HalfScalarDenseBuffer
+  HalfScalarDenseBuffer::Ptr  m_halfScalarDenseBuffer;
+  //! m_field, if it is a HalfScalarSparseBuffer
+  HalfScalarSparseBuffer::Ptr m_halfScalarSparseBuffer;
   //! World space bounds
   BBox                      m_wsBounds;
   //! Attribute names
   AttrNameVec               m_attrNames;
   //! Attribute scaling values
   std::vector<Imath::V3f>   m_attrValues;
+  //! Maps VolumeAttr ids to indices in m_attrNames/m_attrValues
+  VolumeAttrTable           m_attrTable;
+  //! Baked extinction scaling value. Since all attributes scale the same
+  //! buffer, the sum of the scattering and absorption values gives the 
+  //! extinction with a single lookup.
+  Imath::V3f                m_extinctionValue;
+  //! Holdout scaling value
+  Imath::V3f                m_holdoutValue;
   //! Handles ray/buffer intersection tests
   BufferIntersection::CPtr  m_intersectionHandler;
   //! Interpolation type to use for lookups
@@ -353,10 +946,48 @@ protected:
   GaussianInterpType        m_gaussInterp;
   //! Mitchell-Netravali interpolator
   MitchellInterpType        m_mitchellInterp;
+  //! Gaussian interpolator for dense and sparse buffers. Holds the 
+  //! precomputed filter weights.
+  Interp::Gaussian          m_typedGaussInterp;
+  //! Mitchell-Netravali interpolator for dense and sparse buffers
+  Interp::Mitchell          m_typedMitchellInterp;
   //! Empty space optimizer. May be null.
   EmptySpaceOptimizer::CPtr m_eso;
+  //! Min/max macrocells of the buffer
+  MacrocellGrid::CPtr       m_macrocells;
+  //! Skips empty macrocells and flags homogeneous ones. Applied after
+  //! m_eso.
+  EmptySpaceOptimizer::CPtr m_macrocellOptimizer;
   //! Whether to use empty space optimization
   bool                      m_useEmptySpaceOptimization;
+  //! Whether to build a mip pyramid
+  bool                      m_useMipmaps;
+  //! Mip levels, starting at half the resolution of m_buffer. Empty 
+  //! unless mipmaps are enabled and supported by the buffer.
+  MipLevelVec               m_mipLevels;
+  //! Smallest world space voxel edge of m_buffer. Used to pick mip levels.
+  double                    m_wsVoxelSize;
+  //! Whether to build a shadow proxy
+  bool                      m_useShadowProxy;
+  //! Error tolerance of the shadow proxy, relative to the largest voxel
+  float                     m_shadowProxyTolerance;
+  //! Shadow proxy. The buffer is null unless a shadow proxy is enabled, 
+  //! supported by the buffer and a level within the tolerance was found.
+  MipLevel                  m_shadowProxy;
+  //! Absolute error tolerance that m_shadowProxy was built with. Added to
+  //! the voxel value bounds while a proxy is in use.
+  float                     m_shadowProxyMaxError;
+  //! Name of the layer to read in load()
+  std::string               m_layerName;
+  //! Whether m_field is a sparse field whose blocks are loaded 
+  //! dynamically. Such blocks must be read through fastValue(), since 
+  //! their data may be evicted at any time.
+  bool                      m_isStreamed;
+  //! Whether to prefetch blocks of streamed buffers
+  bool                      m_useBlockPrefetch;
+  //! Block prefetcher. Null unless prefetching is enabled and m_field is
+  //! streamed.
+  SparseBlockPrefetcher::CPtr m_prefetcher;
 
 };
 
@@ -39,6 +39,7 @@
 #include <Field3D/DenseField.h>
 #include <Field3D/SparseField.h>
 
+#include "pvr/TreeField.h"
 #include "pvr/Types.h"
 
 //----------------------------------------------------------------------------//
@@ -54,6 +55,21 @@ namespace pvr {
 typedef Field3D::ResizableField<Imath::V3f> VoxelBuffer;
 typedef Field3D::DenseField<Imath::V3f>     DenseBuffer;
 typedef Field3D::SparseField<Imath::V3f>    SparseBuffer;
+typedef Field3D::TreeField<Imath::V3f>      TreeBuffer;
+
+//----------------------------------------------------------------------------//
+// Reduced storage typedefs
+//----------------------------------------------------------------------------//
+
+//! \note Buffers with reduced storage are only used for storing and 
+//! rendering modeled data. Modeling always writes to a VoxelBuffer.
+
+typedef Field3D::DenseField<Field3D::V3h>    HalfDenseBuffer;
+typedef Field3D::SparseField<Field3D::V3h>   HalfSparseBuffer;
+typedef Field3D::DenseField<float>           ScalarDenseBuffer;
+typedef Field3D::SparseField<float>          ScalarSparseBuffer;
+typedef Field3D::DenseField<Field3D::half>   HalfScalarDenseBuffer;
+typedef Field3D::SparseField<Field3D::half>  HalfScalarSparseBuffer;
 
 //----------------------------------------------------------------------------//
 
@@ -106,12 +106,19 @@ void exportPerspectiveCamera()
 {
   using namespace boost::python;
 
+  // Only the overloads that take a time are exposed. The RayState ones are
+  // for use during rendering.
+  typedef Vector (Camera::*TransformFunc)(const Vector &, const PTime) const;
+  typedef Vector (PerspectiveCamera::*PerspTransformFunc)
+    (const Vector &, const PTime) const;
+
   class_<Camera, Camera::Ptr, boost::noncopyable>
     ("Camera", no_init)
     .def("setPosition",    &PerspectiveCamera::setPosition)
     .def("setOrientation", &PerspectiveCamera::setOrientation)
     .def("setResolution",  &PerspectiveCamera::setResolution)
-    .def("worldToCamera",  &PerspectiveCamera::worldToCamera)
+    .def("worldToCamera",  
+         static_cast<TransformFunc>(&PerspectiveCamera::worldToCamera))
     .def("cameraToWorld",  &PerspectiveCamera::cameraToWorld)
     .def("setNumTimeSamples", &Camera::setNumTimeSamples)
     ;
@@ -123,9 +130,11 @@ void exportPerspectiveCamera()
     .def("__init__",       make_constructor(PerspectiveCamera::create))
     .def("setClipPlanes",  &PerspectiveCamera::setClipPlanes)
     .def("setVerticalFOV", &PerspectiveCamera::setVerticalFOV)
-    .def("worldToScreen",  &PerspectiveCamera::worldToScreen)
+    .def("worldToScreen",  
+         static_cast<PerspTransformFunc>(&PerspectiveCamera::worldToScreen))
     .def("screenToWorld",  &PerspectiveCamera::screenToWorld)
-    .def("worldToRaster",  &PerspectiveCamera::worldToRaster)
+    .def("worldToRaster",  
+         static_cast<PerspTransformFunc>(&PerspectiveCamera::worldToRaster))
     .def("rasterToWorld",  &PerspectiveCamera::rasterToWorld)
     ;
 
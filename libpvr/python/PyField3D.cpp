@@ -55,9 +55,16 @@ void exportField3D()
   using namespace boost::python;
   using namespace pvr;
 
+  // FieldRes ---
+
+  class_<Field3D::FieldRes, Field3D::FieldRes::Ptr, boost::noncopyable>
+    ("FieldRes", no_init)
+    ;
+
   // VoxelBuffer ---
 
-  class_<VoxelBuffer, VoxelBuffer::Ptr, boost::noncopyable>
+  class_<VoxelBuffer, bases<Field3D::FieldRes>, VoxelBuffer::Ptr, 
+         boost::noncopyable>
     ("VoxelBuffer", no_init)
     ;
 
@@ -73,6 +80,38 @@ void exportField3D()
     ("SparseBuffer")
     ;
 
+  // TreeBuffer ---
+
+  class_<TreeBuffer, bases<VoxelBuffer>, TreeBuffer::Ptr>
+    ("TreeBuffer")
+    .def("prune", &TreeBuffer::prune)
+    ;
+
+  // Reduced storage buffers ---
+
+  class_<HalfDenseBuffer, bases<Field3D::FieldRes>, HalfDenseBuffer::Ptr>
+    ("HalfDenseBuffer")
+    ;
+  class_<HalfSparseBuffer, bases<Field3D::FieldRes>, HalfSparseBuffer::Ptr>
+    ("HalfSparseBuffer")
+    ;
+  class_<ScalarDenseBuffer, bases<Field3D::FieldRes>, 
+         ScalarDenseBuffer::Ptr>
+    ("ScalarDenseBuffer")
+    ;
+  class_<ScalarSparseBuffer, bases<Field3D::FieldRes>, 
+         ScalarSparseBuffer::Ptr>
+    ("ScalarSparseBuffer")
+    ;
+  class_<HalfScalarDenseBuffer, bases<Field3D::FieldRes>, 
+         HalfScalarDenseBuffer::Ptr>
+    ("HalfScalarDenseBuffer")
+    ;
+  class_<HalfScalarSparseBuffer, bases<Field3D::FieldRes>, 
+         HalfScalarSparseBuffer::Ptr>
+    ("HalfScalarSparseBuffer")
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
@@ -82,12 +82,14 @@ void exportModeler()
     .def("setMapping",         &Modeler::setMapping)
     .def("setDataStructure",   &Modeler::setDataStructure)
     .def("setSparseBlockSize", &Modeler::setSparseBlockSize)
+    .def("setStorage",         &Modeler::setStorage)
     .def("setCamera",          &Modeler::setCamera)
     .def("addInput",           &Modeler::addInput)
     .def("updateBounds",       &Modeler::updateBounds)
     .def("execute",            &Modeler::execute)
     .def("saveBuffer",         &Modeler::saveBuffer)
     .def("buffer",             &Modeler::buffer)
+    .def("storageBuffer",      &Modeler::storageBuffer)
     ;
 
   enum_<Modeler::Mapping>("Mapping")
@@ -98,6 +100,7 @@ void exportModeler()
   enum_<Modeler::DataStructure>("DataStructure")
     .value("DenseBufferType",  Modeler::DenseBufferType)
     .value("SparseBufferType", Modeler::SparseBufferType)
+    .value("TreeBufferType",   Modeler::TreeBufferType)
     ;
 
   enum_<Modeler::SparseBlockSize>("SparseBlockSize")
@@ -106,6 +109,13 @@ void exportModeler()
     .value("Size32", Modeler::SparseBlockSize32)
     ;
 
+  enum_<Modeler::Storage>("Storage")
+    .value("ColorStorage",      Modeler::ColorStorage)
+    .value("HalfColorStorage",  Modeler::HalfColorStorage)
+    .value("ScalarStorage",     Modeler::ScalarStorage)
+    .value("HalfScalarStorage", Modeler::HalfScalarStorage)
+    ;
+
 }
 
 //----------------------------------------------------------------------------//
@@ -99,7 +99,7 @@ void exportOccluders()
   // OtfTransmittanceMapOccluder ---
 
   class_<OtfTransmittanceMapOccluder, bases<Occluder>, 
-         OtfTransmittanceMapOccluder::Ptr>
+         OtfTransmittanceMapOccluder::Ptr, boost::noncopyable>
     ("OtfTransmittanceMapOccluder", no_init)
     .def("__init__", make_constructor(OtfTransmittanceMapOccluder::create))
     ;
@@ -121,7 +121,7 @@ void exportOccluders()
   // OtfVoxelOccluder ---
 
   class_<OtfVoxelOccluder, bases<Occluder>, 
-         OtfVoxelOccluder::Ptr>
+         OtfVoxelOccluder::Ptr, boost::noncopyable>
     ("OtfVoxelOccluder", no_init)
     .def("__init__", make_constructor(OtfVoxelOccluder::create))
     ;
@@ -85,6 +85,7 @@ void exportPrimitive();
 void exportRaymarchers();
 void exportRaymarchSamplers();
 void exportRenderer();
+void exportSampleGenerator();
 void exportTypes();
 void exportVolumes();
 
@@ -156,6 +157,7 @@ BOOST_PYTHON_MODULE(_pvr)
   exportRaymarchSamplers();
   exportRaymarchers();
   exportRenderer();
+  exportSampleGenerator();
   exportTypes();
   exportVolumes();
 }
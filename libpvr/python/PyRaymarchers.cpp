@@ -37,6 +37,7 @@
 // Library includes
 
 #include <pvr/Raymarchers/Raymarcher.h>
+#include <pvr/Raymarchers/TrackingRaymarcher.h>
 #include <pvr/Raymarchers/UniformRaymarcher.h>
 
 #include "Common.h"
@@ -91,6 +92,16 @@ void exportRaymarchers()
   
   implicitly_convertible<UniformRaymarcher::Ptr, UniformRaymarcher::CPtr>();
 
+  // TrackingRaymarcher ---
+
+  class_<TrackingRaymarcher, bases<Raymarcher>, TrackingRaymarcher::Ptr,
+         boost::noncopyable>
+    ("TrackingRaymarcher", no_init)
+    .def("__init__", make_constructor(TrackingRaymarcher::create))
+    ;
+  
+  implicitly_convertible<TrackingRaymarcher::Ptr, TrackingRaymarcher::CPtr>();
+
 }
 
 //----------------------------------------------------------------------------//
@@ -57,6 +57,13 @@ void exportRenderer()
     .def("setLuminanceMapEnabled",     &Renderer::setLuminanceMapEnabled)
     .def("setDoRandomizePixelSamples", &Renderer::setDoRandomizePixelSamples)
     .def("setNumPixelSamples",         &Renderer::setNumPixelSamples)
+    .def("setDoAdaptivePixelSamples",  &Renderer::setDoAdaptivePixelSamples)
+    .def("setMaxPixelSamples",         &Renderer::setMaxPixelSamples)
+    .def("setAdaptiveThreshold",       &Renderer::setAdaptiveThreshold)
+    .def("setNumThreads",              &Renderer::setNumThreads)
+    .def("setTileSize",                &Renderer::setTileSize)
+    .def("setPacketSize",              &Renderer::setPacketSize)
+    .def("setSampleGenerator",         &Renderer::setSampleGenerator)
     .def("execute",                    &Renderer::execute)
     .def("raymarcher",                 &Renderer::raymarcher)
     .def("transmittanceMap",           &Renderer::transmittanceMap)
@@ -0,0 +1,89 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file PySampleGenerator.cpp
+  Contains the interface definition for the SampleGenerator base and subclasses
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Needs to be first, to avoid macro "tolower" passed 2 arguments, on OSX, python 2.7
+#include <Python.h>
+
+// System includes
+
+#include <boost/python.hpp>
+
+// Library includes
+
+#include <pvr/SampleGenerator.h>
+
+//----------------------------------------------------------------------------//
+// Pvr python module
+//----------------------------------------------------------------------------//
+
+void exportSampleGenerator()
+{
+  using namespace boost::python;
+  using namespace pvr::Render::Sampling;
+
+  // SampleGenerator ---
+
+  class_<SampleGenerator, SampleGenerator::Ptr, boost::noncopyable>
+    ("SampleGenerator", no_init)
+    .def("typeName", &SampleGenerator::typeName)
+    .def("sample1D", &SampleGenerator::sample1D)
+    .def("sample2D", &SampleGenerator::sample2D)
+    ;
+  
+  implicitly_convertible<SampleGenerator::Ptr, SampleGenerator::CPtr>();
+
+  // Stratified ---
+
+  class_<Stratified, bases<SampleGenerator>, Stratified::Ptr>
+    ("Stratified", no_init)
+    .def("__init__", make_constructor(Stratified::create))
+    ;
+
+  implicitly_convertible<Stratified::Ptr, Stratified::CPtr>();
+
+  // Sobol ---
+
+  class_<Sobol, bases<SampleGenerator>, Sobol::Ptr>
+    ("Sobol", no_init)
+    .def("__init__", make_constructor(Sobol::create))
+    ;
+
+  implicitly_convertible<Sobol::Ptr, Sobol::CPtr>();
+
+  // OwenScrambledSobol ---
+
+  class_<OwenScrambledSobol, bases<SampleGenerator>, OwenScrambledSobol::Ptr>
+    ("OwenScrambledSobol", no_init)
+    .def("__init__", make_constructor(OwenScrambledSobol::create))
+    ;
+
+  implicitly_convertible<OwenScrambledSobol::Ptr, OwenScrambledSobol::CPtr>();
+}
+
+//----------------------------------------------------------------------------//
@@ -85,9 +85,17 @@ void exportVolumes()
     .def("__init__",         make_constructor(VoxelVolume::create))
     .def("load",             &VoxelVolume::load)
     .def("setBuffer",        &VoxelVolume::setBuffer)
+    .def("setField",         &VoxelVolume::setField)
     .def("addAttribute",     &VoxelVolume::addAttribute)
     .def("setInterpolation", &VoxelVolume::setInterpolation)
     .def("setUseEmptySpaceOptimization", &VoxelVolume::setUseEmptySpaceOptimization)
+    .def("setUseMipmaps", &VoxelVolume::setUseMipmaps)
+    .def("setUseShadowProxy", &VoxelVolume::setUseShadowProxy)
+    .def("setShadowProxyTolerance", &VoxelVolume::setShadowProxyTolerance)
+    .def("setLayerName", &VoxelVolume::setLayerName)
+    .def("setUseBlockPrefetch", &VoxelVolume::setUseBlockPrefetch)
+    .def("setSparseCacheSize", &VoxelVolume::setSparseCacheSize)
+    .staticmethod("setSparseCacheSize")
     ;
 
   implicitly_convertible<VoxelVolume::Ptr, VoxelVolume::CPtr>();
@@ -0,0 +1,247 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Acceleration.cpp
+  Contains implementations of the non-template acceleration structures.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Acceleration.h"
+
+// System includes
+
+#include <algorithm>
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Maximum number of items in a leaf
+  const size_t k_maxLeafSize = 4;
+
+  //--------------------------------------------------------------------------//
+
+  //! Orders items by the center of their box along an axis
+  struct CenterLess
+  {
+    CenterLess(const Accel::BVH::BBoxVec &bounds, const int axis)
+      : m_bounds(bounds), m_axis(axis)
+    { }
+    bool operator () (const size_t a, const size_t b) const
+    { 
+      return m_bounds[a].center()[m_axis] < m_bounds[b].center()[m_axis]; 
+    }
+    const Accel::BVH::BBoxVec &m_bounds;
+    const int                  m_axis;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  struct PointTest
+  {
+    PointTest(const Vector &p)
+      : m_p(p)
+    { }
+    bool operator () (const BBox &bounds) const
+    { return bounds.intersects(m_p); }
+    const Vector &m_p;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  struct RayTest
+  {
+    RayTest(const Ray &ray)
+      : m_ray(ray)
+    { }
+    bool operator () (const BBox &bounds) const
+    { 
+      double t0, t1;
+      return Math::intersect(m_ray, bounds, t0, t1); 
+    }
+    const Ray &m_ray;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  struct BoxTest
+  {
+    BoxTest(const BBox &box)
+      : m_box(box)
+    { }
+    bool operator () (const BBox &bounds) const
+    { return bounds.intersects(m_box); }
+    const BBox &m_box;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Accel {
+
+//----------------------------------------------------------------------------//
+// BVH
+//----------------------------------------------------------------------------//
+
+void BVH::build(const BBoxVec &bounds)
+{
+  m_nodes.clear();
+  m_items.clear();
+  m_itemBounds.clear();
+  m_unbounded.clear();
+
+  for (size_t i = 0, size = bounds.size(); i < size; ++i) {
+    if (bounds[i].isEmpty()) {
+      m_unbounded.push_back(i);
+    } else {
+      m_items.push_back(i);
+    }
+  }
+
+  if (m_items.empty()) {
+    return;
+  }
+
+  // A binary tree with at least one item per leaf has fewer than 2n nodes
+  m_nodes.reserve(2 * m_items.size());
+  buildNode(bounds, 0, m_items.size());
+
+  m_itemBounds.reserve(m_items.size());
+  for (size_t i = 0, size = m_items.size(); i < size; ++i) {
+    m_itemBounds.push_back(bounds[m_items[i]]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Test_T>
+void BVH::query(const Test_T &test, IndexVec &result) const
+{
+  result.append(m_unbounded.begin(), m_unbounded.end());
+
+  if (m_nodes.empty()) {
+    return;
+  }
+
+  SmallVector<size_t, 64> stack;
+  stack.push_back(0);
+
+  while (!stack.empty()) {
+    const size_t nodeIdx = stack.back();
+    const Node  &node    = m_nodes[nodeIdx];
+    stack.pop_back();
+    if (!test(node.bounds)) {
+      continue;
+    }
+    if (node.isLeaf()) {
+      for (size_t i = node.first, end = node.first + node.count; 
+           i < end; ++i) {
+        if (test(m_itemBounds[i])) {
+          result.push_back(m_items[i]);
+        }
+      }
+    } else {
+      stack.push_back(node.secondChild);
+      stack.push_back(nodeIdx + 1);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void BVH::pointQuery(const Vector &p, IndexVec &result) const
+{
+  query(PointTest(p), result);
+}
+
+//----------------------------------------------------------------------------//
+
+void BVH::rayQuery(const Ray &ray, IndexVec &result) const
+{
+  query(RayTest(ray), result);
+}
+
+//----------------------------------------------------------------------------//
+
+void BVH::boxQuery(const BBox &box, IndexVec &result) const
+{
+  query(BoxTest(box), result);
+}
+
+//----------------------------------------------------------------------------//
+
+void BVH::buildNode(const BBoxVec &bounds, const size_t first, 
+                    const size_t count)
+{
+  const size_t nodeIdx = m_nodes.size();
+  m_nodes.push_back(Node());
+
+  BBox nodeBounds, centerBounds;
+  for (size_t i = first; i < first + count; ++i) {
+    nodeBounds.extendBy(bounds[m_items[i]]);
+    centerBounds.extendBy(bounds[m_items[i]].center());
+  }
+
+  m_nodes[nodeIdx].bounds      = nodeBounds;
+  m_nodes[nodeIdx].first       = first;
+  m_nodes[nodeIdx].count       = 0;
+  m_nodes[nodeIdx].secondChild = 0;
+
+  if (count <= k_maxLeafSize) {
+    m_nodes[nodeIdx].count = count;
+    return;
+  }
+
+  // Split at the median along the axis where the centers spread the most
+  const int axis = centerBounds.majorAxis();
+  const size_t half = count / 2;
+  std::nth_element(m_items.begin() + first, m_items.begin() + first + half,
+                   m_items.begin() + first + count, 
+                   CenterLess(bounds, axis));
+
+  buildNode(bounds, first, half);
+  m_nodes[nodeIdx].secondChild = m_nodes.size();
+  buildNode(bounds, first + half, count - half);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Accel
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -71,7 +71,7 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 Camera::Camera()
-  : m_resolution(640, 480), m_numSamples(2)
+  : m_resolution(640, 480), m_numSamples(2), m_isStatic(true)
 {
   Camera::recomputeTransforms();
 }
@@ -100,6 +100,21 @@ Vector Camera::position(const PTime time) const
 
 //----------------------------------------------------------------------------//
 
+Vector Camera::position(const RayState &state) const
+{
+  // The position is cached as a translation of the origin
+  if (const ResolvedTransform *xform = state.resolvedTransform(&m_position)) {
+    return (*xform)(Vector(0.0));
+  }
+  const Vector position = m_position.interpolate(state.time);
+  Matrix translation;
+  translation.setTranslation(position);
+  state.cacheResolvedTransform(&m_position, ResolvedTransform(translation));
+  return position;
+}
+
+//----------------------------------------------------------------------------//
+
 void Camera::setOrientation(const Util::QuatCurve &curve)
 {
   m_orientation = curve;
@@ -164,6 +179,27 @@ Vector Camera::cameraToWorld(const Vector &csP, const PTime time) const
 
 //----------------------------------------------------------------------------//
 
+Vector Camera::worldToCamera(const Vector &wsP, const RayState &state) const
+{
+  return transformPoint(wsP, m_worldToCamera, state);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector Camera::worldToScreen(const Vector &wsP, const RayState &state) const
+{
+  return worldToScreen(wsP, state.time);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector Camera::worldToRaster(const Vector &wsP, const RayState &state) const
+{
+  return worldToRaster(wsP, state.time);
+}
+
+//----------------------------------------------------------------------------//
+
 const Camera::MatrixVec& Camera::worldToCameraMatrices() const
 {
   return m_worldToCamera;
@@ -190,6 +226,15 @@ void Camera::recomputeTransforms()
     m_cameraToWorld[i] = computeCameraToWorld(time);
     m_worldToCamera[i] = m_cameraToWorld[i].inverse();
   }
+
+  // Subclasses don't vary their projections over time, so the camera is
+  // static if its placement is
+  m_isStatic = true;
+  for (unsigned int i = 1; i < m_numSamples; ++i) {
+    if (m_cameraToWorld[i] != m_cameraToWorld[0]) {
+      m_isStatic = false;
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -198,18 +243,46 @@ Vector Camera::transformPoint(const Vector &p,
                               const std::vector<Matrix> &matrices,
                               const PTime time) const
 {
+  return resolveTransform(matrices, time)(p);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector Camera::transformPoint(const Vector &p, 
+                              const std::vector<Matrix> &matrices,
+                              const RayState &state) const
+{
+  // The matrices are used as key, since each camera transform has its own
+  if (const ResolvedTransform *xform = state.resolvedTransform(&matrices)) {
+    return (*xform)(p);
+  }
+  const ResolvedTransform xform = resolveTransform(matrices, state.time);
+  state.cacheResolvedTransform(&matrices, xform);
+  return xform(p);
+}
+
+//----------------------------------------------------------------------------//
+
+ResolvedTransform Camera::resolveTransform(const MatrixVec &matrices,
+                                           const PTime time) const
+{
+  if (m_isStatic) {
+    return ResolvedTransform(matrices[0]);
+  }
   // Calculate which interval to interpolate in
   double stepSize   = 1.0 / static_cast<float>(m_numSamples - 1);
   double t          = time / stepSize;
   unsigned int   first      = static_cast<unsigned int>(std::floor(t));
+  first             = std::min(first, m_numSamples - 1);
   unsigned int   second     = first + 1;
   second            = std::min(second, m_numSamples - 1);
-  double lerpFactor = t - static_cast<double>(first);
-  // Transform point twice
-  Vector t0         = p * matrices[first];
-  Vector t1         = p * matrices[second];
-  // Interpolate transformed positions
-  return lerp(t0, t1, lerpFactor);
+  // Points are transformed by both matrices, and the transformed positions
+  // are interpolated
+  ResolvedTransform xform;
+  xform.m0          = matrices[first];
+  xform.m1          = matrices[second];
+  xform.lerpFactor  = first == second ? 0.0 : t - static_cast<double>(first);
+  return xform;
 }
 
 //----------------------------------------------------------------------------//
@@ -303,6 +376,22 @@ Vector PerspectiveCamera::rasterToWorld(const Vector &rsP, const PTime time) con
 
 //----------------------------------------------------------------------------//
 
+Vector PerspectiveCamera::worldToScreen(const Vector &wsP, 
+                                        const RayState &state) const
+{
+  return transformPoint(wsP, m_worldToScreen, state);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector PerspectiveCamera::worldToRaster(const Vector &wsP, 
+                                        const RayState &state) const
+{
+  return transformPoint(wsP, m_worldToRaster, state);
+}
+
+//----------------------------------------------------------------------------//
+
 bool PerspectiveCamera::canTransformNegativeCamZ() const
 {
   return false;
@@ -411,6 +500,27 @@ Vector SphericalCamera::rasterToWorld(const Vector &rsP, const PTime time) const
 
 //----------------------------------------------------------------------------//
 
+Vector SphericalCamera::worldToScreen(const Vector &wsP, 
+                                      const RayState &state) const
+{
+  Vector csP = worldToCamera(wsP, state);
+  SphericalCoords sc = cartToSphere(csP);
+  return Vector(sc.longitude / M_PI, sc.latitude / (M_PI * 0.5), sc.radius);
+}
+
+//----------------------------------------------------------------------------//
+
+Vector SphericalCamera::worldToRaster(const Vector &wsP, 
+                                      const RayState &state) const
+{
+  Vector ssP = worldToScreen(wsP, state);
+  Vector rsP;
+  m_screenToRaster.multVecMatrix(ssP, rsP);
+  return rsP;
+}
+
+//----------------------------------------------------------------------------//
+
 bool SphericalCamera::canTransformNegativeCamZ() const
 {
   return true;
@@ -100,7 +100,7 @@ void Light::setOccluder(Occluder::CPtr occluder)
 
 //----------------------------------------------------------------------------//
 
-Occluder::CPtr Light::occluder() const
+const Occluder::CPtr& Light::occluder() const
 { 
   return m_occluder; 
 }
@@ -59,7 +59,7 @@ SpotLight::SpotLight()
 
 LightSample SpotLight::sample(const LightSampleState &state) const
 {
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
+  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState);
   float cosTheta = csP.normalized().z;
   float coneFalloff = 1.0;
   if (cosTheta < m_cosWidth) {
@@ -0,0 +1,224 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file MajorantGrid.cpp
+  Contains implementations of MajorantGrid class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/MajorantGrid.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Library includes
+
+#include <OpenEXR/ImathFun.h>
+
+// Project headers
+
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Strings.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the index of the smallest component
+  int minAxis(const Vector &v)
+  {
+    if (v.x < v.y && v.x < v.z) {
+      return 0;
+    }
+    return v.y < v.z ? 1 : 2;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// MajorantGrid
+//----------------------------------------------------------------------------//
+
+MajorantGrid::MajorantGrid(const RaymarchSampler &sampler,
+                           const Volume &volume, const size_t resolution)
+  : m_wsBounds(volume.wsBounds()), m_res(0)
+{
+  const BBox &wsBounds = m_wsBounds;
+
+  if (wsBounds.isEmpty() || resolution == 0) {
+    return;
+  }
+
+  Log::print("Building majorant grid");
+
+  // Cells are roughly cubical, with resolution cells along the longest axis
+  const Vector size    = wsBounds.size();
+  const double maxSize = Math::max(size);
+  for (int axis = 0; axis < 3; ++axis) {
+    m_res[axis] = std::max(1, static_cast<int>(std::ceil(size[axis] / maxSize
+                                                         * resolution)));
+    m_cellSize[axis] = size[axis] / m_res[axis];
+  }
+
+  Log::print("  Resolution: " + str(m_res));
+
+  Timer timer;
+
+  m_majorants.resize(m_res.x * m_res.y * m_res.z);
+
+  std::vector<float>::iterator majorant = m_majorants.begin();
+  for (int k = 0; k < m_res.z; ++k) {
+    for (int j = 0; j < m_res.y; ++j) {
+      for (int i = 0; i < m_res.x; ++i, ++majorant) {
+        const Vector cellMin = wsBounds.min +
+          m_cellSize * Vector(i, j, k);
+        const BBox   wsCell(cellMin, cellMin + m_cellSize);
+        *majorant = Math::max(sampler.maxExtinction(volume, wsCell));
+      }
+    }
+  }
+
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void MajorantGrid::segments(const Ray &wsRay, const double t0,
+                            const double t1, SegmentVec &result) const
+{
+  result.clear();
+
+  if (m_majorants.empty()) {
+    return;
+  }
+
+  // Clip to the grid bounds ---
+
+  double tBox0, tBox1;
+  if (!Math::intersect(wsRay, m_wsBounds, tBox0, tBox1)) {
+    return;
+  }
+
+  const double tStart = std::max(t0, tBox0);
+  const double tEnd   = std::min(t1, tBox1);
+
+  if (tStart >= tEnd) {
+    return;
+  }
+
+  // Set up traversal ---
+
+  // Implementation is based on:
+  // "A Fast Voxel Traversal Algorithm for Ray Tracing"
+  // John Amanatides, Andrew Woo
+
+  // Grid space position of the start point. It's clamped to the grid, 
+  // since it may lie exactly on the boundary
+  const Vector gsStart = (wsRay(tStart) - m_wsBounds.min) / m_cellSize;
+
+  Imath::V3i cell, step;
+  Vector     tNext, tDelta;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    cell[axis] = Imath::clamp(static_cast<int>(std::floor(gsStart[axis])),
+                              0, m_res[axis] - 1);
+    const double dir = wsRay.dir[axis];
+    if (dir > 0.0) {
+      step[axis]   = 1;
+      tNext[axis]  = (m_wsBounds.min[axis] + (cell[axis] + 1) *
+                      m_cellSize[axis] - wsRay.pos[axis]) / dir;
+      tDelta[axis] = m_cellSize[axis] / dir;
+    } else if (dir < 0.0) {
+      step[axis]   = -1;
+      tNext[axis]  = (m_wsBounds.min[axis] + cell[axis] *
+                      m_cellSize[axis] - wsRay.pos[axis]) / dir;
+      tDelta[axis] = -m_cellSize[axis] / dir;
+    } else {
+      step[axis]   = 0;
+      tNext[axis]  = std::numeric_limits<double>::max();
+      tDelta[axis] = std::numeric_limits<double>::max();
+    }
+  }
+
+  // Traverse cells ---
+
+  double t = tStart;
+
+  while (t < tEnd) {
+    const int    axis  = minAxis(tNext);
+    const double tExit = std::min(tNext[axis], tEnd);
+    const float  mu    = majorant(cell.x, cell.y, cell.z);
+    if (tExit > t) {
+      if (!result.empty() && result.back().majorant == mu &&
+          result.back().t1 == t) {
+        result.back().t1 = tExit;
+      } else {
+        result.push_back(Segment(t, tExit, mu));
+      }
+      t = tExit;
+    }
+    cell[axis]  += step[axis];
+    tNext[axis] += tDelta[axis];
+    if (cell[axis] < 0 || cell[axis] >= m_res[axis]) {
+      break;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
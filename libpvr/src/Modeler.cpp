@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <Field3D/Field3DFile.h>
@@ -81,6 +83,150 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Converts a color voxel to another storage type
+  template <typename Data_T>
+  Data_T fromColor(const Imath::V3f &value);
+
+  //--------------------------------------------------------------------------//
+
+  template <>
+  Imath::V3f fromColor(const Imath::V3f &value)
+  { 
+    return value; 
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <>
+  Field3D::V3h fromColor(const Imath::V3f &value)
+  { 
+    return Field3D::V3h(value.x, value.y, value.z); 
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Scalars keep the average of the channels
+  template <>
+  float fromColor(const Imath::V3f &value)
+  { 
+    return (value.x + value.y + value.z) / 3.0f; 
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <>
+  Field3D::half fromColor(const Imath::V3f &value)
+  { 
+    return Field3D::half(fromColor<float>(value)); 
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies a voxel buffer into a buffer of another storage type, with 
+  //! the same mapping and data window. Sparse buffers stay sparse, and 
+  //! only their allocated blocks are copied voxel by voxel. Tree buffers
+  //! become sparse, with a block per leaf.
+  template <typename Data_T>
+  typename Field3D::Field<Data_T>::Ptr convertBuffer(VoxelBuffer::Ptr buffer)
+  {
+    using Field3D::field_dynamic_cast;
+
+    typedef Field3D::DenseField<Data_T>  DenseOut;
+    typedef Field3D::SparseField<Data_T> SparseOut;
+
+    SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer);
+    TreeBuffer::Ptr   tree   = field_dynamic_cast<TreeBuffer>(buffer);
+    const Imath::Box3i &dw   = buffer->dataWindow();
+
+    if (tree) {
+      typename SparseOut::Ptr result(new SparseOut);
+      result->setBlockOrder(TreeBuffer::LeafOrder);
+      result->matchDefinition(tree);
+      result->attribute = buffer->attribute;
+      result->name      = buffer->name;
+      // Leaves line up with the blocks of the result
+      const int        ls   = TreeBuffer::leafSize();
+      const Imath::V3i lRes = tree->leafRes();
+      for (int lk = 0; lk < lRes.z; ++lk) {
+        for (int lj = 0; lj < lRes.y; ++lj) {
+          for (int li = 0; li < lRes.x; ++li) {
+            if (!tree->leafIsAllocated(li, lj, lk)) {
+              result->setBlockEmptyValue
+                (li, lj, lk, 
+                 fromColor<Data_T>(tree->leafTileValue(li, lj, lk)));
+              continue;
+            }
+            const Imath::V3i first = dw.min + Imath::V3i(li, lj, lk) * ls;
+            const Imath::V3i last(std::min(first.x + ls - 1, dw.max.x),
+                                  std::min(first.y + ls - 1, dw.max.y),
+                                  std::min(first.z + ls - 1, dw.max.z));
+            for (int k = first.z; k <= last.z; ++k) {
+              for (int j = first.y; j <= last.y; ++j) {
+                for (int i = first.x; i <= last.x; ++i) {
+                  result->fastLValue(i, j, k) = 
+                    fromColor<Data_T>(tree->fastValue(i, j, k));
+                }
+              }
+            }
+          }
+        }
+      }
+      return result;
+    }
+
+    if (sparse) {
+      typename SparseOut::Ptr result(new SparseOut);
+      result->setBlockOrder(sparse->blockOrder());
+      result->matchDefinition(sparse);
+      result->attribute = buffer->attribute;
+      result->name      = buffer->name;
+      const int        bs   = sparse->blockSize();
+      const Imath::V3i bRes = sparse->blockRes();
+      for (int bk = 0; bk < bRes.z; ++bk) {
+        for (int bj = 0; bj < bRes.y; ++bj) {
+          for (int bi = 0; bi < bRes.x; ++bi) {
+            if (!sparse->blockIsAllocated(bi, bj, bk)) {
+              result->setBlockEmptyValue
+                (bi, bj, bk, 
+                 fromColor<Data_T>(sparse->getBlockEmptyValue(bi, bj, bk)));
+              continue;
+            }
+            // Block coordinates are relative to the data window
+            const Imath::V3i first = dw.min + Imath::V3i(bi, bj, bk) * bs;
+            const Imath::V3i last(std::min(first.x + bs - 1, dw.max.x),
+                                  std::min(first.y + bs - 1, dw.max.y),
+                                  std::min(first.z + bs - 1, dw.max.z));
+            for (int k = first.z; k <= last.z; ++k) {
+              for (int j = first.y; j <= last.y; ++j) {
+                for (int i = first.x; i <= last.x; ++i) {
+                  result->fastLValue(i, j, k) = 
+                    fromColor<Data_T>(sparse->fastValue(i, j, k));
+                }
+              }
+            }
+          }
+        }
+      }
+      return result;
+    }
+
+    typename DenseOut::Ptr result(new DenseOut);
+    result->matchDefinition(buffer);
+    result->attribute = buffer->attribute;
+    result->name      = buffer->name;
+    for (int k = dw.min.z; k <= dw.max.z; ++k) {
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        for (int i = dw.min.x; i <= dw.max.x; ++i) {
+          result->fastLValue(i, j, k) = 
+            fromColor<Data_T>(buffer->value(i, j, k));
+        }
+      }
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -106,7 +252,8 @@ namespace Model {
 Modeler::Modeler()
   : m_mapping(UniformMappingType), 
     m_dataStructure(DenseBufferType),
-    m_sparseBlockSize(SparseBlockSize16)
+    m_sparseBlockSize(SparseBlockSize16),
+    m_storage(ColorStorage)
 { 
   // Empty
 }
@@ -183,6 +330,10 @@ void Modeler::updateBounds()
              "(" + str(wsBounds.min) + ", " + str(wsBounds.max) + ")");
 
   switch (m_dataStructure) {
+  case TreeBufferType:
+    m_buffer = TreeBuffer::Ptr(new TreeBuffer);
+    Log::print("Creating tree buffer");
+    break;
   case SparseBufferType:
     {
       SparseBuffer::Ptr buffer(new SparseBuffer);
@@ -311,6 +462,13 @@ void Modeler::setSparseBlockSize(const SparseBlockSize size)
 
 //----------------------------------------------------------------------------//
 
+void Modeler::setStorage(const Storage storage)
+{
+  m_storage = storage;
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::setCamera(Render::PerspectiveCamera::CPtr camera)
 {
   m_camera = camera;
@@ -355,6 +513,11 @@ void Modeler::execute()
 
   } 
 
+  // Leaves and nodes that ended up constant become tiles
+  if (TreeBuffer::Ptr tree = field_dynamic_cast<TreeBuffer>(m_buffer)) {
+    tree->prune();
+  }
+
   //! \todo Move out of this function.
   float mbUse = m_buffer->memSize() / (1024 * 1024);
   Log::print("Voxel buffer memory use: " + str(mbUse) + "MB");
@@ -375,7 +538,25 @@ void Modeler::saveBuffer(const std::string &filename) const
 
   Field3DOutputFile out;
   out.create(filename);
-  out.writeVectorLayer<float>(m_buffer);
+
+  switch (m_storage) {
+  case HalfColorStorage:
+    out.writeVectorLayer<half>(convertBuffer<V3h>(m_buffer));
+    break;
+  case ScalarStorage:
+    out.writeScalarLayer<float>(convertBuffer<float>(m_buffer));
+    break;
+  case HalfScalarStorage:
+    out.writeScalarLayer<half>(convertBuffer<half>(m_buffer));
+    break;
+  case ColorStorage:
+  default:
+    if (field_dynamic_cast<TreeBuffer>(m_buffer)) {
+      out.writeVectorLayer<float>(convertBuffer<V3f>(m_buffer));
+    } else {
+      out.writeVectorLayer<float>(m_buffer);
+    }
+  }
   
   Log::print("  Done");
 }
@@ -389,6 +570,27 @@ VoxelBuffer::Ptr Modeler::buffer() const
 
 //----------------------------------------------------------------------------//
 
+FieldRes::Ptr Modeler::storageBuffer() const
+{
+  if (!m_buffer) {
+    return FieldRes::Ptr();
+  }
+
+  switch (m_storage) {
+  case HalfColorStorage:
+    return convertBuffer<V3h>(m_buffer);
+  case ScalarStorage:
+    return convertBuffer<float>(m_buffer);
+  case HalfScalarStorage:
+    return convertBuffer<half>(m_buffer);
+  case ColorStorage:
+  default:
+    return m_buffer;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 void Modeler::setupFrustumMapping(const BBox &wsBounds) const
 {
   using namespace Render;
@@ -97,8 +97,8 @@ Color OtfTransmittanceMapOccluder::sample(const OcclusionSampleState &state) con
   }
 
   // Transform to camera space for depth and raster space for pixel coordinate
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
-  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState.time);
+  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState);
+  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState);
   
   // Bounds checks
   if (m_clipBehindCamera && csP.z < 0.0) {
@@ -110,7 +110,7 @@ Color OtfTransmittanceMapOccluder::sample(const OcclusionSampleState &state) con
   }
 
   // Compute depth to sample at
-  Vector wsCamPosition = m_camera->position(state.rayState.time);
+  Vector wsCamPosition = m_camera->position(state.rayState);
   float depth = (state.wsP - wsCamPosition).length();
 
   // Ensure all samples are available
@@ -127,15 +127,26 @@ OtfTransmittanceMapOccluder::updateCoordinate(const Vector &rsP) const
 {
   size_t x = static_cast<size_t>(std::floor(rsP.x));
   size_t y = static_cast<size_t>(std::floor(rsP.y));
-  for (unsigned int j = y; j < y + 2; j++) {
-    for (unsigned int i = x; i < x + 2; i++) {
-      unsigned int iC = Imath::clamp(i, 0u, static_cast<unsigned int>(m_intRasterBounds.x));
-      unsigned int jC = Imath::clamp(j, 0u, static_cast<unsigned int>(m_intRasterBounds.y));
-      if (!m_computed[offset(iC, jC)]) {
-        updatePixel(iC, jC);
+  // Find the pixels that haven't been computed yet. The check is done under
+  // lock since other threads may be updating the map, but the (expensive)
+  // tracing is not.
+  Imath::V2i missing[4];
+  int numMissing = 0;
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (unsigned int j = y; j < y + 2; j++) {
+      for (unsigned int i = x; i < x + 2; i++) {
+        unsigned int iC = Imath::clamp(i, 0u, static_cast<unsigned int>(m_intRasterBounds.x));
+        unsigned int jC = Imath::clamp(j, 0u, static_cast<unsigned int>(m_intRasterBounds.y));
+        if (!m_computed[offset(iC, jC)]) {
+          missing[numMissing++] = Imath::V2i(iC, jC);
+        }
       }
     }
   }
+  for (int i = 0; i < numMissing; ++i) {
+    updatePixel(missing[i].x, missing[i].y);
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -171,7 +182,12 @@ OtfTransmittanceMapOccluder::updatePixel(const size_t x, const size_t y) const
     }
   }
 
-  // Update transmittance map
+  // Update transmittance map. Only write if no other thread computed the
+  // pixel in the meantime
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (m_computed[offset(x, y)]) {
+    return;
+  }
   if (tf.size() > 0) {
     m_transmittanceMap.setPixel(x, y, Util::ColorCurve::average(tf));
   } else {
@@ -100,22 +100,36 @@ Color OtfVoxelOccluder::sample(const OcclusionSampleState &state) const
   int y0 = static_cast<int>(std::floor(vsP.y));
   int z0 = static_cast<int>(std::floor(vsP.z));
 
-  for (int k = z0; k < z0 + 2; ++k) {
-    for (int j = y0; j < y0 + 2; ++j) {
-      for (int i = x0; i < x0 + 2; ++i) {
-        int ii = Imath::clamp(i, m_buffer.dataWindow().min.x, 
-                              m_buffer.dataWindow().max.x);
-        int jj = Imath::clamp(j, m_buffer.dataWindow().min.y, 
-                              m_buffer.dataWindow().max.y);
-        int kk = Imath::clamp(k, m_buffer.dataWindow().min.z, 
-                              m_buffer.dataWindow().max.z);
-        if (Math::max(m_buffer.fastValue(ii, jj, kk)) < 0.0) {
-          updateVoxel(ii, jj, kk);
+  // Find the voxels that haven't been computed yet. Other threads may be
+  // writing to the buffer, so the check is done under lock, but the
+  // (expensive) tracing is not.
+  V3i missing[8];
+  int numMissing = 0;
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (int k = z0; k < z0 + 2; ++k) {
+      for (int j = y0; j < y0 + 2; ++j) {
+        for (int i = x0; i < x0 + 2; ++i) {
+          int ii = Imath::clamp(i, m_buffer.dataWindow().min.x, 
+                                m_buffer.dataWindow().max.x);
+          int jj = Imath::clamp(j, m_buffer.dataWindow().min.y, 
+                                m_buffer.dataWindow().max.y);
+          int kk = Imath::clamp(k, m_buffer.dataWindow().min.z, 
+                                m_buffer.dataWindow().max.z);
+          if (Math::max(m_buffer.fastValue(ii, jj, kk)) < 0.0) {
+            missing[numMissing++] = V3i(ii, jj, kk);
+          }
         }
       }
     }
   }
 
+  for (int i = 0; i < numMissing; ++i) {
+    updateVoxel(missing[i].x, missing[i].y, missing[i].z);
+  }
+
+  // Computed voxels are never written again, so interpolation is safe
+  // without holding the lock
   return m_linearInterp.sample(m_buffer, vsP);
 }
 
@@ -136,7 +150,11 @@ OtfVoxelOccluder::updateVoxel(const int i, const int j, const int k) const
   state.tMax = (m_wsLightPos - wsP).length();
   // Trace ray and record transmittance
   IntegrationResult result = m_renderer->trace(state);
-  m_buffer.fastLValue(i, j, k) = result.transmittance;
+  // Only write if no other thread computed the voxel in the meantime
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (Math::max(m_buffer.fastValue(i, j, k)) < 0.0) {
+    m_buffer.fastLValue(i, j, k) = result.transmittance;
+  }
 }
 
 //----------------------------------------------------------------------------//
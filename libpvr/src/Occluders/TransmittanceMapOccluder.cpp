@@ -101,8 +101,8 @@ Color TransmittanceMapOccluder::sample(const OcclusionSampleState &state) const
   }
 
   // Transform to camera space for depth and raster space for pixel coordinate
-  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState.time);
-  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState.time);
+  Vector csP = m_camera->worldToCamera(state.wsP, state.rayState);
+  Vector rsP = m_camera->worldToRaster(state.wsP, state.rayState);
   
   // Bounds checks
   if (m_clipBehindCamera && csP.z < 0.0) {
@@ -114,7 +114,7 @@ Color TransmittanceMapOccluder::sample(const OcclusionSampleState &state) const
   }
   
   // Compute depth to sample at
-  float depth = (state.wsP - m_camera->position(state.rayState.time)).length();
+  float depth = (state.wsP - m_camera->position(state.rayState)).length();
 
   // Finally interpolate
   return m_transmittanceMap->lerp(rsP.x, rsP.y, depth);
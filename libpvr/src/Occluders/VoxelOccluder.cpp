@@ -34,14 +34,21 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
+#include <boost/bind.hpp>
+
 // Project headers
 
 #include "pvr/Constants.h"
-#include "pvr/Interrupt.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
+#include "pvr/Scene.h"
+#include "pvr/Threads.h"
+#include "pvr/TypedInterp.h"
+#include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -51,6 +58,25 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the world space bounds of the given voxel space box
+  BBox voxelToWorld(const Field3D::FieldMapping &mapping, const BBox &vsBox)
+  {
+    BBox wsBox;
+    for (int c = 0; c < 8; ++c) {
+      const Vector vsP(c & 1 ? vsBox.max.x : vsBox.min.x,
+                       c & 2 ? vsBox.max.y : vsBox.min.y,
+                       c & 4 ? vsBox.max.z : vsBox.min.z);
+      Vector wsP;
+      mapping.voxelToWorld(vsP, wsP);
+      wsBox.extendBy(wsP);
+    }
+    return wsBox;
+  }
+
   //--------------------------------------------------------------------------//
 
 } // local namespace
@@ -79,7 +105,10 @@ VoxelOccluder::VoxelOccluder(Renderer::CPtr renderer,
 {
   Log::print("Building VoxelOccluder");
 
-  BBox wsBounds       = renderer->scene()->volume->wsBounds();
+  Timer timer;
+
+  Scene::CPtr scene   = renderer->scene();
+  BBox wsBounds       = scene->volume->wsBounds();
   Matrix localToWorld = Math::coordinateSystem(wsBounds);
   MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
   mapping->setLocalToWorld(localToWorld);
@@ -87,32 +116,80 @@ VoxelOccluder::VoxelOccluder(Renderer::CPtr renderer,
 
   V3i bufferRes = wsBounds.size() / Math::max(wsBounds.size()) * res;
   m_buffer.setSize(bufferRes);
+  // Unallocated blocks don't occlude
+  m_buffer.clear(Colors::one());
 
   Log::print("  Resolution: " + str(bufferRes));
 
+  // Find blocks near non-zero extinction ---
+
+  // Occlusion is only looked up where light is scattered, so blocks whose 
+  // voxels are all more than a voxel away from the volume are left empty.
+  // That's only safe if the volume's bounds are conservative, otherwise
+  // (and without a raymarch sampler) all blocks are used.
+  const Volume &volume = *scene->volume;
+  // Lets the volume set up, as Renderer::execute() would
+  volume.prepare();
+  const RaymarchSampler::CPtr sampler = 
+    volume.hasConservativeBounds() ? 
+    renderer->raymarcher()->raymarchSampler() : RaymarchSampler::CPtr();
+  const Box3i dw    = m_buffer.dataWindow();
+  const int   bs    = m_buffer.blockSize();
+  const V3i   bRes  = m_buffer.blockRes();
+
+  std::vector<V3i> blocks;
+  for (int bk = 0; bk < bRes.z; ++bk) {
+    for (int bj = 0; bj < bRes.y; ++bj) {
+      for (int bi = 0; bi < bRes.x; ++bi) {
+        // Block coordinates are relative to the data window
+        const V3i first = dw.min + V3i(bi, bj, bk) * bs;
+        const V3i last(std::min(first.x + bs - 1, dw.max.x),
+                       std::min(first.y + bs - 1, dw.max.y),
+                       std::min(first.z + bs - 1, dw.max.z));
+        // Voxel centers of the block, padded by the interpolation footprint
+        const BBox vsBox(Vector(first) - Vector(0.5), 
+                         Vector(last) + Vector(1.5));
+        const BBox wsBox = voxelToWorld(*mapping, vsBox);
+        if (sampler && 
+            Math::max(sampler->maxExtinction(volume, wsBox)) <= 0.0f) {
+          continue;
+        }
+        // Allocation isn't thread safe, so it's done up front
+        m_buffer.fastLValue(first.x, first.y, first.z) = Colors::one();
+        blocks.push_back(V3i(bi, bj, bk));
+      }
+    }
+  }
+
+  Log::print("  Allocated blocks: " + str(blocks.size()) + " of " + 
+             str(bRes.x * bRes.y * bRes.z));
+
+  // Compute transmittance ---
+
+  RenderContext context;
+  context.scene  = scene.get();
+  context.volume = scene->volume.get();
+
+  // Lets the raymarcher set up for the scene, as Renderer::execute() would
+  renderer->raymarcher()->prepare(context);
+
   RayState state;
   state.rayType  = RayState::TransmittanceOnly;
   state.rayDepth = 1;
+  state.context  = &context;
+
+  const size_t numThreads = Sys::resolveNumThreads(renderer->numThreads());
+
+  Log::print("  Using " + str(numThreads) + " thread(s)");
 
-  Timer timer;
   ProgressReporter progress(2.5f, "  ");
 
-  size_t count = 0, numVoxels = bufferRes.x * bufferRes.y * bufferRes.z;
-  for (DenseBuffer::iterator i = m_buffer.begin(), end = m_buffer.end();
-       i != end; ++i, ++count) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(static_cast<float>(count) / numVoxels);
-    // Do work
-    Vector wsP;
-    m_buffer.mapping()->voxelToWorld(discToCont(V3i(i.x, i.y, i.z)), wsP);
-    state.wsRay.pos          = wsP;
-    state.wsRay.dir          = (wsLightPos - wsP).normalized();
-    state.tMax               = (wsLightPos - wsP).length();
-    IntegrationResult result = renderer->trace(state);
-    *i = result.transmittance;
-  }
+  Sys::parallelFor(blocks.size(), numThreads,
+                   boost::bind(&VoxelOccluder::computeBlock, this, 
+                               boost::cref(*renderer), boost::cref(state),
+                               boost::cref(wsLightPos), boost::cref(blocks),
+                               _1),
+                   &progress);
 
   Log::print("  Time elapsed: " + str(timer.elapsed()));
 }
@@ -126,8 +203,42 @@ Color VoxelOccluder::sample(const OcclusionSampleState &state) const
   if (!Math::isInBounds(vsP, m_buffer.dataWindow())) {
     return Colors::one();
   }
-  Color val = m_linearInterp.sample(m_buffer, vsP);
-  return val;
+  return Interp::Linear().sample(Interp::SparseAccess<>(m_buffer), vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelOccluder::computeBlock(const Renderer &renderer, 
+                                 const RayState &baseState,
+                                 const Vector &wsLightPos,
+                                 const std::vector<V3i> &blocks,
+                                 const size_t blockIdx)
+{
+  const Box3i dw    = m_buffer.dataWindow();
+  const int   bs    = m_buffer.blockSize();
+  const V3i   first = dw.min + blocks[blockIdx] * bs;
+  const V3i   last(std::min(first.x + bs - 1, dw.max.x),
+                   std::min(first.y + bs - 1, dw.max.y),
+                   std::min(first.z + bs - 1, dw.max.z));
+
+  TransformCache transformCache;
+  RayState       state(baseState);
+  state.transformCache = &transformCache;
+
+  for (int k = first.z; k <= last.z; ++k) {
+    for (int j = first.y; j <= last.y; ++j) {
+      for (int i = first.x; i <= last.x; ++i) {
+        Vector wsP;
+        m_buffer.mapping()->voxelToWorld(discToCont(V3i(i, j, k)), wsP);
+        state.wsRay.pos          = wsP;
+        state.wsRay.dir          = (wsLightPos - wsP).normalized();
+        state.tMax               = (wsLightPos - wsP).length();
+        IntegrationResult result = renderer.trace(state);
+        // The block is allocated, so writing to it is thread safe
+        m_buffer.fastLValue(i, j, k) = result.transmittance;
+      }
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
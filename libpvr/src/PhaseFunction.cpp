@@ -56,29 +56,38 @@ namespace Phase {
 
 float Composite::probability(const Vector &in, const Vector &out) const
 {
+  if (m_functions.empty()) {
+    return k_isotropic;
+  }
   float p = 0.0;
-  float weight = 0.0;
   for (size_t i = 0, size = m_functions.size(); i < size; i++) {
-    p += m_functions[i]->probability(in, out) * m_weights[i];
-    weight += m_weights[i];
+    p += m_functions[i]->probability(in, out);
   }
-  return p / weight;
+  return p / m_functions.size();
 }
 
 //----------------------------------------------------------------------------//
 
-void Composite::add(PhaseFunction::CPtr phaseFunction)
+float Composite::weightedProbability(const Vector &in, const Vector &out,
+                                     const Weights &weights) const
 {
-  m_functions.push_back(phaseFunction);
-  m_weights.push_back(0.0f);
+  float p = 0.0;
+  float weight = 0.0;
+  for (size_t i = 0, size = weights.size(); i < size; i++) {
+    const Weight &w = weights[i];
+    if (w.weight > 0.0f && w.index < m_functions.size()) {
+      p += m_functions[w.index]->probability(in, out) * w.weight;
+      weight += w.weight;
+    }
+  }
+  return weight > 0.0f ? p / weight : probability(in, out);
 }
 
 //----------------------------------------------------------------------------//
 
-void Composite::setWeight(const size_t idx, const float weight)
+void Composite::add(PhaseFunction::CPtr phaseFunction)
 {
-  assert(idx < m_weights.size());
-  m_weights[idx] = weight;
+  m_functions.push_back(phaseFunction);
 }
 
 //----------------------------------------------------------------------------//
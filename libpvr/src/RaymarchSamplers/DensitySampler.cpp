@@ -37,8 +37,6 @@
 
 // Project headers
 
-#include "pvr/RenderGlobals.h"
-#include "pvr/Scene.h"
 #include "pvr/Volumes/Volume.h"
 
 //----------------------------------------------------------------------------//
@@ -57,9 +55,9 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 DensitySampler::DensitySampler()
-  : m_densityAttr("density")
 {
-  
+  m_attrs.push_back(VolumeAttr("density"));
+  m_attrs.push_back(VolumeAttr("holdout"));
 }
 
 //----------------------------------------------------------------------------//
@@ -67,9 +65,39 @@ DensitySampler::DensitySampler()
 RaymarchSample
 DensitySampler::sample(const VolumeSampleState &state) const
 {
-  VolumeSample sample = 
-    RenderGlobals::scene()->volume->sample(state, m_densityAttr);
-  return RaymarchSample(sample.value, sample.value);
+  VolumeSample samples[NumAttrs];
+  state.rayState.volume().sampleAttributes(state, &m_attrs[0], NumAttrs, 
+                                           samples);
+  const Color &density = samples[DensityAttr].value;
+  return RaymarchSample(density, density, samples[HoldoutAttr].value);
+}
+
+//----------------------------------------------------------------------------//
+
+void DensitySampler::samplePacket(const VolumeSamplePacket &packet,
+                                  RaymarchSample *samples) const
+{
+  if (packet.size == 0) {
+    return;
+  }
+  // All rays in a packet are traced through the same scene
+  Volume::PacketValues values[NumAttrs];
+  packet.rayState[0]->volume().samplePacket(packet, &m_attrs[0], NumAttrs,
+                                            values, NULL);
+  for (size_t i = 0; i < packet.size; ++i) {
+    samples[i] = RaymarchSample(values[DensityAttr][i], values[DensityAttr][i],
+                                values[HoldoutAttr][i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color DensitySampler::maxExtinction(const Volume &volume,
+                                    const BBox &wsBox) const
+{
+  Color maxValues[NumAttrs];
+  volume.maxAttributeValues(wsBox, &m_attrs[0], NumAttrs, maxValues);
+  return maxValues[DensityAttr] + maxValues[HoldoutAttr];
 }
 
 //----------------------------------------------------------------------------//
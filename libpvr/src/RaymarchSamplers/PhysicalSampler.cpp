@@ -45,7 +45,6 @@
 #include "pvr/Constants.h"
 
 #include "pvr/Lights/Light.h"
-#include "pvr/RenderGlobals.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -77,32 +76,112 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 PhysicalSampler::PhysicalSampler()
-  : m_scatteringAttr("scattering"), 
-    m_absorptionAttr("absorption"),
-    m_emissionAttr("emission")
 {
-
+  m_attrs.push_back(VolumeAttr("scattering"));
+  m_attrs.push_back(VolumeAttr("absorption"));
+  m_attrs.push_back(VolumeAttr("emission"));
+  m_attrs.push_back(VolumeAttr("holdout"));
 }
 
 //----------------------------------------------------------------------------//
 
 RaymarchSample PhysicalSampler::sample(const VolumeSampleState &state) const
 {
-  const Scene::CPtr    scene          = RenderGlobals::scene();
-  const Volume::CPtr   volume         = scene->volume;
+  VolumeSample         samples[NumAttrs];
+
+  state.rayState.volume().sampleAttributes(state, &m_attrs[0], NumAttrs, 
+                                           samples);
+
+  const VolumeSample & scSample       = samples[ScatteringAttr];
+  const Color &        sigma_s        = scSample.value;
+  const Color &        sigma_a        = samples[AbsorptionAttr].value;
+  const Color &        L_em           = samples[EmissionAttr].value;
+  const Color &        sigma_h        = samples[HoldoutAttr].value;
+
+  const Color          L_sc           = inScattering(state, scSample);
+
+  return RaymarchSample(L_sc + L_em, sigma_s + sigma_a, sigma_h);
+}
+
+//----------------------------------------------------------------------------//
+
+RaymarchSample 
+PhysicalSampler::sampleExtinction(const VolumeSampleState &state) const
+{
+  Color sigma_e, sigma_h;
+  state.rayState.volume().sampleExtinction(state, sigma_e, sigma_h);
+  return RaymarchSample(Colors::zero(), sigma_e, sigma_h);
+}
+
+//----------------------------------------------------------------------------//
+
+void PhysicalSampler::samplePacket(const VolumeSamplePacket &packet,
+                                   RaymarchSample *samples) const
+{
+  if (packet.size == 0) {
+    return;
+  }
+
+  // All rays in a packet are traced through the same scene
+  const Volume &volume = packet.rayState[0]->volume();
+
+  bool needScattering = false;
+  for (size_t i = 0; i < packet.size; ++i) {
+    if (packet.rayState[i]->rayType == RayState::FullRaymarch) {
+      needScattering = true;
+      break;
+    }
+  }
+
+  // Packets of shadow rays only need extinction
+  if (!needScattering) {
+    Volume::PacketValues sigma_e, sigma_h;
+    volume.sampleExtinctionPacket(packet, sigma_e, sigma_h);
+    for (size_t i = 0; i < packet.size; ++i) {
+      samples[i] = RaymarchSample(Colors::zero(), sigma_e[i], sigma_h[i]);
+    }
+    return;
+  }
+
+  // All attributes are sampled for the whole packet at once. The phase
+  // function weights come back with the values, so scattering doesn't 
+  // need a second lookup to find its phase function.
+  Volume::PacketValues  values[NumAttrs];
+  Volume::PacketWeights phaseWeights;
+  volume.samplePacket(packet, &m_attrs[0], NumAttrs, values, &phaseWeights);
+
+  const Phase::PhaseFunction::CPtr phaseFunction = volume.phaseFunction();
+
+  for (size_t i = 0; i < packet.size; ++i) {
+    const Color &sigma_s = values[ScatteringAttr][i];
+    const Color &sigma_a = values[AbsorptionAttr][i];
+    const Color &sigma_h = values[HoldoutAttr][i];
+    if (packet.rayState[i]->rayType == RayState::TransmittanceOnly) {
+      samples[i] = RaymarchSample(Colors::zero(), sigma_s + sigma_a, sigma_h);
+      continue;
+    }
+    VolumeSampleState state(*packet.rayState[i]);
+    state.wsP = packet.wsP(i);
+    VolumeSample scSample(sigma_s, phaseFunction);
+    scSample.phaseWeights = phaseWeights[i];
+    const Color  L_sc     = inScattering(state, scSample);
+    samples[i] = RaymarchSample(L_sc + values[EmissionAttr][i], 
+                                sigma_s + sigma_a, sigma_h);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color PhysicalSampler::inScattering(const VolumeSampleState &state,
+                                    const VolumeSample &scSample) const
+{
+  const Scene &        scene          = state.rayState.scene();
 
   LightSampleState     lightState     (state.rayState);
   OcclusionSampleState occlusionState (state.rayState);
 
   const Vector         wo             = -state.rayState.wsRay.dir;
-
-  VolumeSample         abSample       = volume->sample(state, m_absorptionAttr);
-  VolumeSample         emSample       = volume->sample(state, m_emissionAttr);
-  VolumeSample         scSample       = volume->sample(state, m_scatteringAttr);
-
   const Color &        sigma_s        = scSample.value;
-  const Color &        sigma_a        = abSample.value;
-  const Color &        L_em           = emSample.value;
 
   // Only perform calculation if ray is primary and scattering coefficient is
   // greater than zero.
@@ -117,7 +196,7 @@ RaymarchSample PhysicalSampler::sample(const VolumeSampleState &state) const
     occlusionState.wsP = state.wsP;
 
     // For each light source
-    BOOST_FOREACH (Light::CPtr light, scene->lights) {
+    BOOST_FOREACH (const Light::CPtr &light, scene.lights) {
 
       // Sample the light
       LightSample lightSample = light->sample(lightState);
@@ -128,7 +207,7 @@ RaymarchSample PhysicalSampler::sample(const VolumeSampleState &state) const
 
       // Find the scattering probability
       const Vector wi = (state.wsP - lightSample.wsP).normalized();
-      const float  p  = scSample.phaseFunction->probability(wi, wo);
+      const float  p  = scSample.phaseProbability(wi, wo);
 
       // Update luminance
       L_sc += sigma_s * p * lightSample.luminance * transmittance;
@@ -136,7 +215,7 @@ RaymarchSample PhysicalSampler::sample(const VolumeSampleState &state) const
     }
   }
 
-  return RaymarchSample(L_sc + L_em, sigma_s + sigma_a);
+  return L_sc;
 }
 
 //----------------------------------------------------------------------------//
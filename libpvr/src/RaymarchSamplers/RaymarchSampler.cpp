@@ -0,0 +1,127 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file RaymarchSampler.cpp
+  Contains implementations of RaymarchSampler class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/RaymarchSamplers/RaymarchSampler.h"
+
+// System includes
+
+// Library includes
+
+// Project headers
+
+#include "pvr/Math.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  //! Indices into k_extinctionAttrs
+  enum ExtinctionAttrIndex {
+    ScatteringAttr = 0,
+    AbsorptionAttr,
+    HoldoutAttr,
+    NumExtinctionAttrs
+  };
+
+  //! Attributes bounded by the default RaymarchSampler::maxExtinction()
+  const VolumeAttr k_extinctionAttrs[NumExtinctionAttrs] = {
+    VolumeAttr("scattering"), 
+    VolumeAttr("absorption"), 
+    VolumeAttr("holdout")
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// RaymarchSampler
+//----------------------------------------------------------------------------//
+
+RaymarchSample 
+RaymarchSampler::sampleExtinction(const VolumeSampleState &state) const
+{
+  return sample(state);
+}
+
+//----------------------------------------------------------------------------//
+
+void RaymarchSampler::samplePacket(const VolumeSamplePacket &packet,
+                                   RaymarchSample *samples) const
+{
+  for (size_t i = 0; i < packet.size; ++i) {
+    VolumeSampleState state(*packet.rayState[i]);
+    state.wsP = packet.wsP(i);
+    if (state.rayState.rayType == RayState::TransmittanceOnly) {
+      samples[i] = sampleExtinction(state);
+    } else {
+      samples[i] = sample(state);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Color RaymarchSampler::maxExtinction(const Volume &volume,
+                                     const BBox &wsBox) const
+{
+  Color maxValues[NumExtinctionAttrs];
+  volume.maxAttributeValues(wsBox, k_extinctionAttrs, NumExtinctionAttrs, 
+                            maxValues);
+  Color extinction, holdout;
+  volume.maxExtinction(wsBox, extinction, holdout);
+  return Math::max(extinction, 
+                   maxValues[ScatteringAttr] + maxValues[AbsorptionAttr]) +
+    Math::max(holdout, maxValues[HoldoutAttr]);
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -44,7 +44,6 @@
 #include "pvr/Curve.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
-#include "pvr/RenderGlobals.h"
 #include "pvr/Scene.h"
 #include "pvr/StlUtil.h"
 #include "pvr/Types.h"
@@ -132,7 +131,7 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
 {
   // Integration intervals ---
 
-  IntervalVec rawIntervals = RenderGlobals::scene()->volume->intersect(state);
+  IntervalVec rawIntervals = state.volume().intersect(state);
   IntervalVec intervals = splitIntervals(rawIntervals);
 
   if (intervals.size() == 0) {
@@ -150,6 +149,9 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
   Color             L = Colors::zero();
   Color             T = Colors::one();
 
+  // Transmittance-only rays only need extinction
+  const bool doExtinctionOnly = state.rayType == RayState::TransmittanceOnly;
+
   Color previousL = Colors::zero();
   Color previousT = Colors::one();
   
@@ -175,6 +177,20 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
       continue;
     }
 
+    // Transmittance through a homogeneous interval is exact in one step
+    if (doExtinctionOnly && interval.isHomogeneous) {
+      sampleState.setRayPosition((tStart + tEnd) * 0.5);
+      RaymarchSample sample = m_raymarchSampler->sampleExtinction(sampleState);
+      T *= exp(-sample.extinction * (tEnd - tStart));
+      if (Math::max(T) < m_params.earlyTerminationThreshold) {
+        T = Colors::zero();
+      }
+      if (tf || lf) {
+        updateDeepFunctions(tEnd, L, T, lf, tf);
+      }
+      continue;
+    }
+
     // Raymarch loop ---
  
     bool doTerminate = false;
@@ -184,8 +200,10 @@ AdaptiveRaymarcher::integrate(const RayState &state) const
       const double stepLength = stepT1 - stepT0;
       const double t = stepT1;
 
-      sampleState.wsP = state.wsRay(t);
-      RaymarchSample sample = m_raymarchSampler->sample(sampleState);
+      sampleState.setRayPosition(t);
+      RaymarchSample sample = doExtinctionOnly ? 
+        m_raymarchSampler->sampleExtinction(sampleState) :
+        m_raymarchSampler->sample(sampleState);
 
 #if 1
       const double divisor = std::sqrt(Math::max(T) / m_params.threshold);
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+#include <limits>
 #include <list>
 
 // Library includes
@@ -44,6 +46,43 @@
 #include "pvr/Camera.h"
 #include "pvr/RenderGlobals.h"
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! Interval that overlaps the current position of the sweep in 
+  //! splitIntervals(). Ordered so that a heap keeps the smallest step
+  //! length on top.
+  struct ActiveInterval
+  {
+    ActiveInterval(const double step, const double end)
+      : stepLength(step), t1(end)
+    { }
+    bool operator < (const ActiveInterval &other) const
+    { return stepLength > other.stepLength; }
+    double stepLength;
+    double t1;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  bool intervalStartsBefore(const Interval &a, const Interval &b)
+  {
+    return a.t0 < b.t0;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -56,6 +95,25 @@ using namespace boost;
 namespace pvr {
 namespace Render {
 
+//----------------------------------------------------------------------------//
+// Raymarcher
+//----------------------------------------------------------------------------//
+
+void Raymarcher::prepare(const RenderContext &context) const
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+void Raymarcher::integratePacket(const RayState *states, const size_t numRays,
+                                 IntegrationResult *results) const
+{
+  for (size_t i = 0; i < numRays; ++i) {
+    results[i] = integrate(states[i]);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // Utility function implementations
 //----------------------------------------------------------------------------//
@@ -68,7 +126,7 @@ IntervalVec splitIntervals(const IntervalVec &intervals)
   }
 
   // Gather all interval start/end points
-  vector<double> points;
+  SmallVector<double, 32> points;
   points.reserve(intervals.size() * 2);
   BOOST_FOREACH (const Interval &i, intervals) {
     points.push_back(i.t0);
@@ -77,25 +135,60 @@ IntervalVec splitIntervals(const IntervalVec &intervals)
 
   // Sort and unique start/end points 
   sort(points.begin(), points.end());
-  vector<double>::iterator newEnd = unique(points.begin(), points.end());
+  SmallVector<double, 32>::iterator newEnd = 
+    unique(points.begin(), points.end());
   points.resize(newEnd - points.begin());
 
-  // For each endpoint pair, find the incoming interval(s) that overlap it
+  // Sort incoming intervals by start point
+  IntervalVec sorted(intervals);
+  sort(sorted.begin(), sorted.end(), intervalStartsBefore);
+
+  // Sweep over the endpoint pairs. Intervals are added to the active set 
+  // once the sweep reaches their start. Rather than removing intervals
+  // as the sweep passes their end, the active set only tracks what's 
+  // needed to describe the overlap: the smallest step length (in a heap,
+  // whose finished entries are discarded once they reach the top), and 
+  // the furthest end of any interval, of any non-homogeneous interval and
+  // of any interval that doesn't scale with the ray footprint.
+  SmallVector<ActiveInterval, 16> active;
+  double       maxEnd              = -std::numeric_limits<double>::max();
+  double       maxInhomogeneousEnd = -std::numeric_limits<double>::max();
+  double       maxFixedStepEnd     = -std::numeric_limits<double>::max();
+  const size_t numIntervals        = sorted.size();
+  size_t       next                = 0;
+
   IntervalVec outIntervals;
   for (size_t i = 0, size = points.size() - 1; i < size; ++i) {
-    Interval newInterval(points[i], points[i + 1], 
-                         std::numeric_limits<float>::max());
-    bool foundInterval = false;
-    BOOST_FOREACH (const Interval &interval, intervals) {
-      if (interval.t0 < newInterval.t1 && interval.t1 > newInterval.t0) {
-        newInterval.stepLength = std::min(interval.stepLength, 
-                                          newInterval.stepLength);
-        foundInterval = true;
+    const double t0 = points[i], t1 = points[i + 1];
+    // Add intervals starting here
+    for (; next < numIntervals && sorted[next].t0 <= t0; ++next) {
+      const Interval &interval = sorted[next];
+      active.push_back(ActiveInterval(interval.stepLength, interval.t1));
+      push_heap(active.begin(), active.end());
+      maxEnd = std::max(maxEnd, interval.t1);
+      if (!interval.isHomogeneous) {
+        maxInhomogeneousEnd = std::max(maxInhomogeneousEnd, interval.t1);
+      }
+      if (!interval.scalesWithFootprint) {
+        maxFixedStepEnd = std::max(maxFixedStepEnd, interval.t1);
       }
     }
-    if (foundInterval) {
-      outIntervals.push_back(newInterval);
+    // All added intervals start at or before t0, so they overlap 
+    // [t0, t1] if they end after t0
+    if (maxEnd <= t0) {
+      continue;
+    }
+    // Discard finished intervals until the smallest step length is from 
+    // one that overlaps. There is at least one, since maxEnd > t0
+    while (active.front().t1 <= t0) {
+      pop_heap(active.begin(), active.end());
+      active.pop_back();
     }
+    // A sum of constant volumes is constant
+    outIntervals.push_back(Interval(t0, t1, active.front().stepLength,
+                                    maxInhomogeneousEnd <= t0));
+    // Larger steps are only safe if no overlapping volume needs fine ones
+    outIntervals.back().scalesWithFootprint = maxFixedStepEnd <= t0;
   }
   
   return outIntervals;
@@ -0,0 +1,381 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file TrackingRaymarcher.cpp
+  Contains implementations of TrackingRaymarcher class and related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Raymarchers/TrackingRaymarcher.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <OpenEXR/ImathRandom.h>
+
+// Project headers
+
+#include "pvr/Constants.h"
+#include "pvr/Curve.h"
+#include "pvr/Log.h"
+#include "pvr/Math.h"
+#include "pvr/Scene.h"
+#include "pvr/Types.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+  // Strings
+  //--------------------------------------------------------------------------//
+
+  const std::string k_strMajorantGridRes("majorant_grid_resolution");
+  const std::string k_strUseDeltaTracking("use_delta_tracking");
+  const std::string k_strDoEarlyTerm("do_early_termination");
+  const std::string k_strEarlyTermThresh("early_termination_threshold");
+
+  //--------------------------------------------------------------------------//
+  // Constants
+  //--------------------------------------------------------------------------//
+
+  //! Probability of terminating a ray when russian roulette is played
+  const float k_rouletteProbability = 0.5f;
+
+  //--------------------------------------------------------------------------//
+  // Helper functions
+  //--------------------------------------------------------------------------//
+
+  Color exp(const Color &val)
+  {
+    return Color(std::exp(val.x), std::exp(val.y), std::exp(val.z));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the probability of a tentative collision being a null
+  //! collision, for each channel. Clamped to zero in case the majorant
+  //! isn't conservative.
+  Color nullProbability(const Color &sigma, const double mu)
+  {
+    return Color(std::max(0.0, 1.0 - sigma.x / mu),
+                 std::max(0.0, 1.0 - sigma.y / mu),
+                 std::max(0.0, 1.0 - sigma.z / mu));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Seeds the random number generator of a ray. Only depends on the ray
+  //! itself, so that the result doesn't depend on which thread traces it,
+  //! or in what order.
+  unsigned long raySeed(const Render::RayState &state)
+  {
+    size_t seed = 0;
+    boost::hash_combine(seed, state.wsRay.pos.x);
+    boost::hash_combine(seed, state.wsRay.pos.y);
+    boost::hash_combine(seed, state.wsRay.pos.z);
+    boost::hash_combine(seed, state.wsRay.dir.x);
+    boost::hash_combine(seed, state.wsRay.dir.y);
+    boost::hash_combine(seed, state.wsRay.dir.z);
+    boost::hash_combine(seed, state.time.value());
+    // Each pixel sample uses a different step offset, which decorrelates
+    // samples that share the same ray
+    boost::hash_combine(seed, state.stepOffset);
+    boost::hash_combine(seed, state.rayDepth);
+    return static_cast<unsigned long>(seed);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace pvr::Util;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher::Params
+//----------------------------------------------------------------------------//
+
+TrackingRaymarcher::Params::Params()
+  : majorantGridResolution(32), useDeltaTracking(false),
+    doEarlyTermination(true), earlyTerminationThreshold(0.01)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+// TrackingRaymarcher
+//----------------------------------------------------------------------------//
+
+TrackingRaymarcher::TrackingRaymarcher()
+  : m_gridVolume(NULL), m_fallback(UniformRaymarcher::create())
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+void TrackingRaymarcher::setParams(const Util::ParamMap &params)
+{
+  getValue(params.intMap, k_strMajorantGridRes,
+           m_params.majorantGridResolution);
+  getValue(params.intMap, k_strUseDeltaTracking,
+           m_params.useDeltaTracking);
+  getValue(params.intMap, k_strDoEarlyTerm,
+           m_params.doEarlyTermination);
+  getValue(params.floatMap, k_strEarlyTermThresh,
+           m_params.earlyTerminationThreshold);
+
+  // The grid resolution may have changed
+  m_majorantGrid.reset();
+  m_gridVolume = NULL;
+
+  // Step length and early termination settings apply to the fallback
+  m_fallback->setParams(params);
+}
+
+//----------------------------------------------------------------------------//
+
+IntegrationResult
+TrackingRaymarcher::integrate(const RayState &state) const
+{
+  // Integration intervals ---
+
+  IntervalVec rawIntervals = state.volume().intersect(state);
+  IntervalVec intervals = splitIntervals(rawIntervals);
+
+  if (intervals.size() == 0) {
+    return IntegrationResult();
+  }
+
+  // Without a conservative majorant, tracking would be biased
+  const MajorantGrid *grid = 
+    m_gridVolume == &state.volume() ? m_majorantGrid.get() : NULL;
+
+  if (!grid) {
+    return m_fallback->integrate(state);
+  }
+
+  // Set up transmittance function and luminance function ---
+
+  ColorCurve::Ptr lf = setupDeepLCurve(state, intervals[0].t0);
+  ColorCurve::Ptr tf = setupDeepTCurve(state, intervals[0].t0);
+
+  // Ray integration variables ---
+
+  VolumeSampleState        sampleState(state);
+  Imath::Rand48            rng(raySeed(state));
+  MajorantGrid::SegmentVec segments;
+  Color                    L   = Colors::zero();
+  // Transmittance including holdouts. Used to weight luminance.
+  Color                    T_l = Colors::one();
+  // Transmittance from extinction alone
+  Color                    T_e = Colors::one();
+
+  // Transmittance-only rays only need extinction
+  const bool doExtinctionOnly = state.rayType == RayState::TransmittanceOnly;
+  // Holdouts don't show up in the output transmittance of primary rays
+  Color &T_out = state.rayDepth == 0 ? T_e : T_l;
+
+  // Interval loop ---
+
+  bool doTerminate = false;
+
+  BOOST_FOREACH (const Interval &interval, intervals) {
+
+    // Interval integration variables
+    const double tStart = std::max(interval.t0, state.tMin);
+    const double tEnd   = std::min(interval.t1, state.tMax);
+
+    if (tStart >= tEnd) {
+      continue;
+    }
+
+    // Transmittance through a homogeneous interval is exact, so there's
+    // no need to track it
+    if (doExtinctionOnly && interval.isHomogeneous) {
+      sampleState.setRayPosition((tStart + tEnd) * 0.5);
+      RaymarchSample sample = m_raymarchSampler->sampleExtinction(sampleState);
+      const double length = tEnd - tStart;
+      T_l *= exp(-(sample.extinction + sample.holdout) * length);
+      T_e *= exp(-sample.extinction * length);
+      updateDeepFunctions(tEnd, L, T_out, lf, tf);
+      continue;
+    }
+
+    grid->segments(state.wsRay, tStart, tEnd, segments);
+
+    BOOST_FOREACH (const MajorantGrid::Segment &segment, segments) {
+
+      // Nothing can be hit where the majorant is zero
+      if (segment.majorant <= 0.0f) {
+        continue;
+      }
+
+      const double mu = segment.majorant;
+      double       t  = segment.t0;
+
+      // Tracking loop ---
+
+      while (true) {
+
+        // Find next tentative collision
+        t -= std::log(1.0 - rng.nextf()) / mu;
+        if (t >= segment.t1) {
+          break;
+        }
+
+        // Get holdout, luminance and extinction from the scene
+        sampleState.setRayPosition(t);
+        RaymarchSample sample = doExtinctionOnly ?
+          m_raymarchSampler->sampleExtinction(sampleState) :
+          m_raymarchSampler->sample(sampleState);
+
+        const Color sigma_t = sample.extinction + sample.holdout;
+
+        // Tentative collisions have density mu along the ray, so each one
+        // contributes to the luminance integral with weight 1 / mu
+        L += sample.luminance * T_l / mu;
+
+        // Update transmittance
+        if (m_params.useDeltaTracking) {
+          const double pReal = std::min(Math::max(sigma_t) / mu, 1.0);
+          if (rng.nextf() < pReal) {
+            // Real collision
+            T_l         = Colors::zero();
+            T_e         = Colors::zero();
+            doTerminate = true;
+          } else {
+            // Null collision. Reweight, since the probability of getting
+            // here isn't the same as the null probability of each channel
+            const double weight = 1.0 / (1.0 - pReal);
+            T_l *= nullProbability(sigma_t, mu) * weight;
+            T_e *= nullProbability(sample.extinction, mu) * weight;
+          }
+        } else {
+          T_l *= nullProbability(sigma_t, mu);
+          T_e *= nullProbability(sample.extinction, mu);
+        }
+
+        // Early termination. Surviving rays are reweighted, which keeps
+        // the estimate unbiased.
+        if (!doTerminate && m_params.doEarlyTermination &&
+            Math::max(T_l) < m_params.earlyTerminationThreshold) {
+          if (rng.nextf() < k_rouletteProbability) {
+            T_l         = Colors::zero();
+            T_e         = Colors::zero();
+            doTerminate = true;
+          } else {
+            T_l /= 1.0f - k_rouletteProbability;
+            T_e /= 1.0f - k_rouletteProbability;
+          }
+        }
+
+        // Update transmittance and luminance functions
+        updateDeepFunctions(t, L, T_out, lf, tf);
+
+        // Terminate if requested
+        if (doTerminate) {
+          break;
+        }
+
+      } // end tracking of single segment
+
+      if (doTerminate) {
+        break;
+      }
+
+    } // end for each segment
+
+    if (doTerminate) {
+      break;
+    }
+
+  } // end for each interval
+
+  if (tf) {
+    tf->removeDuplicates();
+  }
+
+  if (lf) {
+    lf->removeDuplicates();
+  }
+
+  return IntegrationResult(L, lf, T_out, tf);
+}
+
+//----------------------------------------------------------------------------//
+
+void TrackingRaymarcher::prepare(const RenderContext &context) const
+{
+  m_majorantGrid.reset();
+  m_gridVolume = context.volume;
+
+  m_fallback->setRaymarchSampler(m_raymarchSampler);
+  m_fallback->prepare(context);
+
+  if (!context.volume || !m_raymarchSampler) {
+    return;
+  }
+
+  if (context.volume->hasConservativeBounds()) {
+    const int res  = std::max(m_params.majorantGridResolution, 1);
+    m_majorantGrid = MajorantGrid::create(*m_raymarchSampler, 
+                                          *context.volume, res);
+  } else {
+    Log::warning("Scene volume has no conservative extinction bound. "
+                 "Tracking raymarcher falls back to ray marching.");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <boost/foreach.hpp>
@@ -44,7 +46,6 @@
 #include "pvr/Curve.h"
 #include "pvr/Log.h"
 #include "pvr/Math.h"
-#include "pvr/RenderGlobals.h"
 #include "pvr/Scene.h"
 #include "pvr/StlUtil.h"
 #include "pvr/Types.h"
@@ -115,6 +116,65 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Raymarch state of a single ray in a packet
+  struct PacketRay
+  {
+    PacketRay()
+      : interval(0), stepT0(0.0), stepT1(0.0), tEnd(0.0), baseStepLength(0.0),
+        L(Colors::zero()), T_e(Colors::one()), T_h(Colors::one()), 
+        T_alpha(Colors::one()), T_m(Colors::zero()), active(false)
+    { }
+    IntervalVec           intervals;
+    size_t                interval;
+    double                stepT0;
+    double                stepT1;
+    double                tEnd;
+    double                baseStepLength;
+    Color                 L;
+    Color                 T_e;
+    Color                 T_h;
+    Color                 T_alpha;
+    Color                 T_m;
+    Util::ColorCurve::Ptr lf;
+    Util::ColorCurve::Ptr tf;
+    bool                  active;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets up the first raymarch step of the ray's current interval. Intervals 
+  //! that can't be stepped through are skipped. Returns false if the ray 
+  //! has no intervals left.
+  bool setupInterval(const Render::RayState &state, 
+                     const bool useVolumeStepLength, 
+                     const double volumeStepLengthMult, 
+                     const double stepLength, PacketRay &ray)
+  {
+    for (; ray.interval < ray.intervals.size(); ++ray.interval) {
+      const Interval &interval = ray.intervals[ray.interval];
+      const double    tStart   = std::max(interval.t0, state.tMin);
+      ray.tEnd = std::min(interval.t1, state.tMax);
+      // Pick step length
+      const double stepLengthToUse = useVolumeStepLength ? 
+        interval.stepLength * volumeStepLengthMult : stepLength;
+      ray.baseStepLength = std::min(stepLengthToUse, ray.tEnd - tStart);
+      // Transmittance through a homogeneous interval is exact in one step
+      if (interval.isHomogeneous && 
+          state.rayType == Render::RayState::TransmittanceOnly) {
+        ray.baseStepLength = ray.tEnd - tStart;
+      }
+      // Set up first raymarch step
+      ray.stepT0 = tStart;
+      ray.stepT1 = tStart + ray.baseStepLength;
+      if (ray.stepT0 != ray.stepT1 && ray.stepT0 < ray.tEnd) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -145,7 +205,6 @@ UniformRaymarcher::Params::Params()
 //----------------------------------------------------------------------------//
 
 UniformRaymarcher::UniformRaymarcher()
-  : m_holdoutAttr("holdout")
 {
 
 }
@@ -173,7 +232,7 @@ UniformRaymarcher::integrate(const RayState &state) const
 {
   // Integration intervals ---
 
-  IntervalVec rawIntervals = RenderGlobals::scene()->volume->intersect(state);
+  IntervalVec rawIntervals = state.volume().intersect(state);
   IntervalVec intervals = splitIntervals(rawIntervals);
 
   if (intervals.size() == 0) {
@@ -194,6 +253,9 @@ UniformRaymarcher::integrate(const RayState &state) const
   Color             T_alpha = Colors::one();
   Color             T_m     = Colors::zero();
 
+  // Transmittance-only rays only need extinction
+  const bool doExtinctionOnly = state.rayType == RayState::TransmittanceOnly;
+
   // Interval loop ---
 
   BOOST_FOREACH (const Interval &interval, intervals) {
@@ -207,7 +269,9 @@ UniformRaymarcher::integrate(const RayState &state) const
       m_params.useVolumeStepLength ? 
       interval.stepLength * m_params.volumeStepLengthMult : 
       m_params.stepLength;
-    const double baseStepLength = std::min(stepLengthToUse, tEnd - tStart);
+    // Transmittance through a homogeneous interval is exact in one step
+    const double baseStepLength = doExtinctionOnly && interval.isHomogeneous ?
+      tEnd - tStart : std::min(stepLengthToUse, tEnd - tStart);
 
     // Set up first raymarch step
     double stepT0 = tStart;
@@ -226,16 +290,16 @@ UniformRaymarcher::integrate(const RayState &state) const
 
       // Information about current step
       const double stepLength = stepT1 - stepT0;
-      const double t          = (stepT0 + stepT1) * 0.5;
-      sampleState.wsP         = state.wsRay(t);
+      const double t          = stepT0 + stepLength * state.stepOffset;
+      sampleState.setRayPosition(t);
 
       // Get holdout, luminance and extinction from the scene
-      VolumeSample hoSample = 
-        RenderGlobals::scene()->volume->sample(sampleState, m_holdoutAttr);
-      RaymarchSample sample = m_raymarchSampler->sample(sampleState);
+      RaymarchSample sample = doExtinctionOnly ? 
+        m_raymarchSampler->sampleExtinction(sampleState) :
+        m_raymarchSampler->sample(sampleState);
 
       // Update transmittance
-      updateTransmittance(state, stepLength, sample.extinction, hoSample.value,
+      updateTransmittance(state, stepLength, sample.extinction, sample.holdout,
                           T_e, T_h, T_alpha, T_m);
 
       // Update luminance
@@ -252,9 +316,16 @@ UniformRaymarcher::integrate(const RayState &state) const
       // Update transmittance and luminance functions
       updateDeepFunctions(stepT1, L, T_e, lf, tf);
 
-      // Set up next raymarch step
+      // Set up next raymarch step. Where the volume filters away detail 
+      // smaller than the ray footprint, half a footprint resolves it
+      double nextStepLength = baseStepLength;
+      if (interval.scalesWithFootprint && m_params.useVolumeStepLength) {
+        nextStepLength = 
+          std::max(nextStepLength, 0.5 * state.footprint(stepT1) * 
+                   m_params.volumeStepLengthMult);
+      }
       stepT0 = stepT1;
-      stepT1 = min(tEnd, stepT1 + baseStepLength);
+      stepT1 = min(tEnd, stepT1 + nextStepLength);
 
       // Terminate if requested
       if (doTerminate) {
@@ -286,6 +357,174 @@ UniformRaymarcher::integrate(const RayState &state) const
 
 //----------------------------------------------------------------------------//
 
+void UniformRaymarcher::integratePacket(const RayState *states, 
+                                        const size_t numRays,
+                                        IntegrationResult *results) const
+{
+  assert(numRays <= VolumeSamplePacket::MaxSize && "Packet too large");
+
+  // Integration intervals ---
+
+  PacketRay rays[VolumeSamplePacket::MaxSize];
+
+  for (size_t i = 0; i < numRays; ++i) {
+    PacketRay &ray = rays[i];
+    ray.intervals = splitIntervals(states[i].volume().intersect(states[i]));
+    if (ray.intervals.size() == 0) {
+      continue;
+    }
+    ray.lf     = setupDeepLCurve(states[i], ray.intervals[0].t0);
+    ray.tf     = setupDeepTCurve(states[i], ray.intervals[0].t0);
+    ray.active = setupInterval(states[i], m_params.useVolumeStepLength, 
+                               m_params.volumeStepLengthMult, 
+                               m_params.stepLength, ray);
+  }
+
+  // Packet integration variables ---
+
+  // Rays that have terminated are compacted out of the sample packet, so
+  // lanes[j] holds the index of the ray that sample j belongs to.
+  VolumeSamplePacket packet;
+  size_t             lanes[VolumeSamplePacket::MaxSize];
+  double             stepLengths[VolumeSamplePacket::MaxSize];
+  RaymarchSample     samples[VolumeSamplePacket::MaxSize];
+  Color              expSigmaE[VolumeSamplePacket::MaxSize];
+  Color              expSigmaH[VolumeSamplePacket::MaxSize];
+
+  // Raymarch loop ---
+
+  while (true) {
+
+    // Gather sample positions of all active rays
+    packet.size = 0;
+    for (size_t i = 0; i < numRays; ++i) {
+      const PacketRay &ray = rays[i];
+      if (!ray.active) {
+        continue;
+      }
+      const size_t j          = packet.size++;
+      const double stepLength = ray.stepT1 - ray.stepT0;
+      const double t          = ray.stepT0 + stepLength * states[i].stepOffset;
+      lanes[j]              = i;
+      stepLengths[j]        = stepLength;
+      packet.rayState[j]    = &states[i];
+      packet.setWsP(j, states[i].wsRay(t));
+    }
+
+    if (packet.size == 0) {
+      break;
+    }
+
+    const size_t size = packet.size;
+
+    // Get holdout, luminance and extinction from the scene
+    m_raymarchSampler->samplePacket(packet, samples);
+
+    // Compute the transmittance exponents. Zero exponents are used where
+    // the scalar path skips the exp(), which gives identical results.
+    for (size_t j = 0; j < size; ++j) {
+      Color       &sigma_e = samples[j].extinction;
+      const Color &sigma_h = samples[j].holdout;
+      expSigmaH[j] = Colors::zero();
+      if (packet.rayState[j]->rayDepth > 0) {
+        sigma_e += sigma_h;
+      } else if (Math::max(sigma_h) > 0.0f) {
+        expSigmaH[j] = -sigma_h * stepLengths[j];
+      }
+      expSigmaE[j] = Math::max(sigma_e) > 0.0f ? 
+        Color(-sigma_e * stepLengths[j]) : Colors::zero();
+    }
+
+    // Color is three packed floats, so the exp() calls for all rays and 
+    // channels are done as one flat loop. std::exp() is still called once 
+    // per value, since compilers won't vectorize it without -ffast-math 
+    // or a vector math library, but it keeps the results identical to 
+    // integrate().
+    float *expE = &expSigmaE[0].x;
+    float *expH = &expSigmaH[0].x;
+    for (size_t k = 0; k < size * 3; ++k) {
+      expE[k] = std::exp(expE[k]);
+      expH[k] = std::exp(expH[k]);
+    }
+
+    // Update each ray's transmittance, luminance and step
+    for (size_t j = 0; j < size; ++j) {
+
+      PacketRay      &ray   = rays[lanes[j]];
+      const RayState &state = *packet.rayState[j];
+
+      // Update transmittance
+      ray.T_e *= expSigmaE[j];
+      if (state.rayDepth == 0) {
+        ray.T_h     *= expSigmaH[j];
+        ray.T_m      = Math::lerp(ray.T_alpha, ray.T_m, expSigmaH[j]);
+        ray.T_alpha  = Math::lerp(ray.T_m, ray.T_alpha, expSigmaE[j]);
+      }
+
+      // Update luminance
+      ray.L += samples[j].luminance * ray.T_e * ray.T_h * stepLengths[j];
+
+      // Early termination
+      bool doTerminate = false;
+      if (m_params.doEarlyTermination &&
+          Math::max(ray.T_e) < m_params.earlyTerminationThreshold) {
+        ray.T_e     = Colors::zero();
+        ray.T_alpha = Colors::zero();
+        doTerminate = true;
+      }
+
+      // Update transmittance and luminance functions
+      updateDeepFunctions(ray.stepT1, ray.L, ray.T_e, ray.lf, ray.tf);
+
+      // Set up next raymarch step, scaled by the footprint as in integrate()
+      const Interval &interval = ray.intervals[ray.interval];
+      double nextStepLength = ray.baseStepLength;
+      if (interval.scalesWithFootprint && m_params.useVolumeStepLength) {
+        nextStepLength = 
+          std::max(nextStepLength, 0.5 * state.footprint(ray.stepT1) * 
+                   m_params.volumeStepLengthMult);
+      }
+      ray.stepT0 = ray.stepT1;
+      ray.stepT1 = min(ray.tEnd, ray.stepT1 + nextStepLength);
+
+      // Move on to the next interval, or terminate if requested
+      if (doTerminate) {
+        ray.active = false;
+      } else if (ray.stepT0 >= ray.tEnd) {
+        ray.interval++;
+        ray.active = setupInterval(state, m_params.useVolumeStepLength, 
+                                   m_params.volumeStepLengthMult, 
+                                   m_params.stepLength, ray);
+      }
+
+    }
+
+  } // end raymarch loop
+
+  // Output results ---
+
+  for (size_t i = 0; i < numRays; ++i) {
+    PacketRay &ray = rays[i];
+    if (ray.intervals.size() == 0) {
+      results[i] = IntegrationResult();
+      continue;
+    }
+    if (ray.tf) {
+      ray.tf->removeDuplicates();
+    }
+    if (ray.lf) {
+      ray.lf->removeDuplicates();
+    }
+    if (states[i].rayDepth == 0) {
+      results[i] = IntegrationResult(ray.L, ray.lf, ray.T_alpha, ray.tf);
+    } else {
+      results[i] = IntegrationResult(ray.L, ray.lf, ray.T_e, ray.tf);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
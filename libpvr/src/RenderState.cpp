@@ -0,0 +1,149 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file RenderState.cpp
+  Contains implementations of RayState and VolumeSampleState classes and 
+  related functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/RenderState.h"
+
+// System includes
+
+// Library includes
+
+// Project headers
+
+#include "pvr/RenderGlobals.h"
+#include "pvr/Scene.h"
+#include "pvr/Volumes/Volume.h"
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+
+//----------------------------------------------------------------------------//
+// RayState
+//----------------------------------------------------------------------------//
+
+const Scene& RayState::scene() const
+{
+  // The scene stays alive in RenderGlobals, so the reference remains
+  // valid after the returned pointer goes out of scope
+  return context ? *context->scene : *RenderGlobals::scene();
+}
+
+//----------------------------------------------------------------------------//
+
+const Volume& RayState::volume() const
+{
+  return context ? *context->volume : *RenderGlobals::scene()->volume;
+}
+
+//----------------------------------------------------------------------------//
+
+const ResolvedTransform* RayState::resolvedTransform(const void *key) const
+{
+  return transformCache ? transformCache->find(key, time) : NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+void RayState::cacheResolvedTransform(const void *key, 
+                                      const ResolvedTransform &xform) const
+{
+  if (transformCache) {
+    transformCache->insert(key, xform, time);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// TransformCache
+//----------------------------------------------------------------------------//
+
+const ResolvedTransform* 
+TransformCache::find(const void *key, const PTime t) const
+{
+  if (t != time) {
+    return NULL;
+  }
+  for (size_t i = 0, size = entries.size(); i < size; ++i) {
+    if (entries[i].key == key) {
+      return &entries[i].xform;
+    }
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+void TransformCache::insert(const void *key, const ResolvedTransform &xform,
+                            const PTime t)
+{
+  if (t != time) {
+    entries.clear();
+    time = t;
+  }
+  entries.push_back(Entry(key, xform));
+}
+
+//----------------------------------------------------------------------------//
+// VolumeSampleState
+//----------------------------------------------------------------------------//
+
+const TransformedRay* 
+VolumeSampleState::transformedRay(const void *key) const
+{
+  for (size_t i = 0; i < numTransformedRays; ++i) {
+    if (transformedRayKeys[i] == key) {
+      return &transformedRays[i];
+    }
+  }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------//
+
+const TransformedRay* 
+VolumeSampleState::cacheTransformedRay(const void *key, 
+                                       const TransformedRay &ray) const
+{
+  if (numTransformedRays == MaxTransformedRays) {
+    return NULL;
+  }
+  transformedRayKeys[numTransformedRays] = key;
+  transformedRays[numTransformedRays]    = ray;
+  return &transformedRays[numTransformedRays++];
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -35,15 +35,20 @@
 
 // Library includes
 
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+
 // Project headers
 
 #include "pvr/Constants.h"
 #include "pvr/RenderGlobals.h"
 #include "pvr/Interrupt.h"
 #include "pvr/Log.h"
+#include "pvr/Math.h"
 #include "pvr/PhaseFunction.h"
 #include "pvr/Scene.h"
 #include "pvr/Strings.h"
+#include "pvr/Threads.h"
 
 //----------------------------------------------------------------------------//
 // Local namespace
@@ -113,6 +118,39 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Returns the (per-channel) standard error of the mean of n samples,
+  //! given the sum and the sum of squares of the samples.
+  pvr::Color standardError(const pvr::Color &sum, const pvr::Color &sumSq, 
+                           const size_t n)
+  {
+    const float      nf   = static_cast<float>(n);
+    const pvr::Color mean = sum / nf;
+    // Unbiased sample variance
+    pvr::Color var = (sumSq - mean * mean * nf) / (nf - 1.0f);
+    return pvr::Color(std::sqrt(std::max(var.x, 0.0f) / nf),
+                      std::sqrt(std::max(var.y, 0.0f) / nf),
+                      std::sqrt(std::max(var.z, 0.0f) / nf));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Scrambles a pixel index into a random number seed. Rand48 streams 
+  //! from consecutive seeds are correlated, so neighboring pixels would 
+  //! otherwise get similar samples. The mixing steps are those of the 
+  //! MurmurHash3 finalizer.
+  unsigned long pixelSeed(const size_t pixelIdx)
+  {
+    boost::uint64_t h = pixelIdx;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<unsigned long>(h);
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -136,7 +174,9 @@ namespace Render {
 
 Renderer::Params::Params()
   : doPrimary(true), doLuminanceMap(false), doTransmittanceMap(false), 
-    doRandomizePixelSamples(false), numPixelSamples(1)
+    doRandomizePixelSamples(false), doAdaptivePixelSamples(false), 
+    numPixelSamples(1), maxPixelSamples(8), adaptiveThreshold(0.005f), 
+    numThreads(0), tileSize(32), packetSize(1)
 { 
   
 }
@@ -207,6 +247,13 @@ void Renderer::setRaymarcher(Raymarcher::CPtr raymarcher)
 
 //----------------------------------------------------------------------------//
 
+void Renderer::setSampleGenerator(Sampling::SampleGenerator::CPtr generator)
+{
+  m_sampleGenerator = generator;
+}
+
+//----------------------------------------------------------------------------//
+
 void Renderer::addVolume(Volume::CPtr volume)
 {
   if (!m_scene) {
@@ -311,6 +358,57 @@ void Renderer::setNumDeepSamples(const size_t numSamples)
 
 //----------------------------------------------------------------------------//
 
+void Renderer::setDoAdaptivePixelSamples(const bool enabled)
+{
+  m_params.doAdaptivePixelSamples = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setMaxPixelSamples(const size_t numSamples)
+{
+  m_params.maxPixelSamples = numSamples;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setAdaptiveThreshold(const float threshold)
+{
+  m_params.adaptiveThreshold = threshold;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setNumThreads(const size_t numThreads)
+{
+  m_params.numThreads = numThreads;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Renderer::numThreads() const
+{
+  return m_params.numThreads;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setTileSize(const size_t tileSize)
+{
+  m_params.tileSize = std::max(tileSize, static_cast<size_t>(1));
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::setPacketSize(const size_t packetSize)
+{
+  m_params.packetSize = 
+    std::min(std::max(packetSize, static_cast<size_t>(1)), 
+             static_cast<size_t>(VolumeSamplePacket::MaxSize));
+}
+
+//----------------------------------------------------------------------------//
+
 void Renderer::execute()
 {
   if (!m_camera) {
@@ -341,59 +439,42 @@ void Renderer::execute()
                " (" + str(numSamples) + " x " + str(numSamples) + ")");
   }
 
+  const size_t numThreads = Sys::resolveNumThreads(m_params.numThreads);
+
+  Log::print("  Using " + str(numThreads) + " thread(s), tile size " + 
+             str(m_params.tileSize));
+
   // Initialization ---
 
   RenderGlobals::setCamera(m_camera);
 
-  m_rng.init(0);
+  m_context.scene  = m_scene.get();
+  m_context.volume = m_scene->volume.get();
+  m_context.camera = m_camera.get();
+
+  // The volume is prepared first, since the raymarcher may query it
+  m_scene->volume->prepare();
+  m_raymarcher->prepare(m_context);
+
   Timer timer;
   ProgressReporter progress(2.5f, "  ");
 
-  // For each pixel ---
+  // For each tile ---
 
-  for (Image::pixel_iterator i = m_primary->begin(), end = m_primary->end();
-       i != end; ++i) {
-    // Check if user terminated
-    Sys::Interrupt::throwOnAbort();
-    // Print progress
-    progress.update(i.progress());
-    // Pixel result
-    Color luminance = Colors::zero();
-    Color alpha = Colors::zero();
-    // Transmittance functions to be averaged
-    std::vector<ColorCurve::CPtr> tf, lf;
-    // For each pixel sample (in x/y)
-    for (size_t iX = 0; iX < numSamples; iX++) {
-      for (size_t iY = 0; iY < numSamples; iY++) {
-        // Set up the next sample
-        float xSample, ySample;
-        PTime pTime(0.0);
-        setupSample(i.rsX(), i.rsY(), iX, iY, xSample, ySample, pTime);
-        // Render pixel
-        IntegrationResult result = integrateRay(xSample, ySample, pTime);
-        // Update accumulated result
-        luminance += result.luminance;
-        alpha     += Colors::one() - result.transmittance;
-        if (result.transmittanceFunction) {
-          tf.push_back(result.transmittanceFunction);
-        }
-        if (result.luminanceFunction) {
-          lf.push_back(result.luminanceFunction);
-        }
-      }
-    }
-    // Normalize luminance and transmittance
-    luminance *= 1.0 / std::pow(m_params.numPixelSamples, 2.0);
-    alpha     *= 1.0 / std::pow(m_params.numPixelSamples, 2.0);
-    // Update resulting image and transmittance/luminance maps
-    i.setPixel(luminance);
-    i.setPixelAlpha((alpha.x + alpha.y + alpha.z) / 3.0f);
-    if (tf.size() > 0) {
-      m_deepTransmittance->setPixel(i.x, i.y, ColorCurve::average(tf));
-    }
-    if (lf.size() > 0) {
-      m_deepLuminance->setPixel(i.x, i.y, ColorCurve::average(lf));
-    }
+  const TileVec tiles = setupTiles();
+  boost::mutex commitMutex;
+  size_t numRays = 0;
+  
+  Sys::parallelFor(tiles.size(), numThreads, 
+                   boost::bind(&Renderer::renderTile, this, boost::cref(tiles),
+                               boost::ref(commitMutex), boost::ref(numRays), 
+                               _1),
+                   &progress);
+
+  if (m_params.doAdaptivePixelSamples) {
+    const V2i res = m_primary->size();
+    Log::print("  Average rays per pixel: " + 
+               str(static_cast<float>(numRays) / (res.x * res.y)));
   }
 
   Log::print("  Time elapsed: " + str(timer.elapsed()));
@@ -436,41 +517,245 @@ void Renderer::saveImage(const std::string &filename) const
 
 //----------------------------------------------------------------------------//
 
-IntegrationResult Renderer::integrateRay(const float x, const float y,
-                                         const PTime time) const
+Renderer::TileVec Renderer::setupTiles() const
+{
+  const V2i    res      = m_primary->size();
+  const int    tileSize = static_cast<int>(m_params.tileSize);
+  TileVec      tiles;
+
+  for (int y = 0; y < res.y; y += tileSize) {
+    for (int x = 0; x < res.x; x += tileSize) {
+      tiles.push_back(Box2i(V2i(x, y), 
+                            V2i(std::min(x + tileSize, res.x) - 1, 
+                                std::min(y + tileSize, res.y) - 1)));
+    }
+  }
+
+  return tiles;
+}
+
+//----------------------------------------------------------------------------//
+
+void Renderer::renderTile(const TileVec &tiles, boost::mutex &commitMutex,
+                          size_t &numRays, const size_t tileIdx)
+{
+  const Box2i  &tile      = tiles[tileIdx];
+  const size_t  numPixels = (tile.max.x - tile.min.x + 1) * 
+                            (tile.max.y - tile.min.y + 1);
+
+  // Results are kept local until the whole tile is done, so that the output
+  // images only need to be locked once per tile
+  std::vector<Color>            luminances(numPixels), alphas(numPixels);
+  std::vector<ColorCurve::CPtr> deepT(numPixels), deepL(numPixels);
+  size_t                        numTileRays = 0;
+
+  // For each pixel ---
+
+  for (int y = tile.min.y, i = 0; y <= tile.max.y; ++y) {
+    for (int x = tile.min.x; x <= tile.max.x; ++x, ++i) {
+      numTileRays += renderPixel(x, y, luminances[i], alphas[i], 
+                                 deepT[i], deepL[i]);
+    }
+  }
+
+  // Update resulting image and transmittance/luminance maps ---
+
+  boost::mutex::scoped_lock lock(commitMutex);
+
+  numRays += numTileRays;
+
+  for (int y = tile.min.y, i = 0; y <= tile.max.y; ++y) {
+    for (int x = tile.min.x; x <= tile.max.x; ++x, ++i) {
+      const Color &alpha = alphas[i];
+      m_primary->setPixel(x, y, luminances[i]);
+      m_primary->setPixelAlpha(x, y, (alpha.x + alpha.y + alpha.z) / 3.0f);
+      if (deepT[i]) {
+        m_deepTransmittance->setPixel(x, y, deepT[i]);
+      }
+      if (deepL[i]) {
+        m_deepLuminance->setPixel(x, y, deepL[i]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t Renderer::renderPixel(const int x, const int y, Color &luminance, 
+                             Color &alpha, ColorCurve::CPtr &deepT,
+                             ColorCurve::CPtr &deepL) const
+{
+  const size_t numSamples = std::max(m_params.numPixelSamples, 
+                                     static_cast<size_t>(1));
+  const size_t batchSize  = numSamples * numSamples;
+  const bool   adaptive   = m_params.doAdaptivePixelSamples;
+  const float  threshold  = m_params.adaptiveThreshold;
+  const size_t maxRays    = adaptive ? 
+    std::max(m_params.maxPixelSamples * m_params.maxPixelSamples, batchSize) :
+    batchSize;
+
+  // Seed per pixel so that the result is independent of tile order
+  // and thread count
+  Rand48 rng(pixelSeed(x + y * m_primary->size().x));
+
+  // Accumulated results. The sums of squares are used to estimate the noise
+  // level in adaptive mode.
+  Color  sumL  = Colors::zero(), sumLSq = Colors::zero();
+  Color  sumA  = Colors::zero(), sumASq = Colors::zero();
+  size_t numRays = 0;
+  // Transmittance functions to be averaged
+  std::vector<ColorCurve::CPtr> tf, lf;
+
+  // Ray packets. Each lane keeps its transform cache across batches, which 
+  // pays off when the time doesn't vary between samples
+  RayState          states[VolumeSamplePacket::MaxSize];
+  IntegrationResult results[VolumeSamplePacket::MaxSize];
+  TransformCache    transformCaches[VolumeSamplePacket::MaxSize];
+
+  // Trace batches of numSamples^2 rays, packetSize rays at a time. Without 
+  // adaptive sampling only the first batch is used.
+  while (numRays < maxRays) {
+    // For each packet of pixel samples (in x/y)
+    for (size_t i = 0; i < batchSize && numRays < maxRays; ) {
+      const size_t numPacketRays = 
+        std::min(std::min(m_params.packetSize, batchSize - i), 
+                 maxRays - numRays);
+      // Set up the next packet of samples
+      for (size_t j = 0; j < numPacketRays; ++j) {
+        float xSample, ySample, stepOffset;
+        PTime pTime(0.0);
+        setupSample(x, y, numRays + j, rng, xSample, ySample, pTime, 
+                    stepOffset);
+        states[j] = setupRayState(xSample, ySample, pTime, stepOffset);
+        states[j].transformCache = &transformCaches[j];
+      }
+      // Render pixel samples
+      if (numPacketRays == 1) {
+        results[0] = m_raymarcher->integrate(states[0]);
+      } else {
+        m_raymarcher->integratePacket(states, numPacketRays, results);
+      }
+      // Update accumulated result
+      for (size_t j = 0; j < numPacketRays; ++j) {
+        const IntegrationResult &result = results[j];
+        const Color a = Colors::one() - result.transmittance;
+        sumL   += result.luminance;
+        sumLSq += result.luminance * result.luminance;
+        sumA   += a;
+        sumASq += a * a;
+        if (result.transmittanceFunction) {
+          tf.push_back(result.transmittanceFunction);
+        }
+        if (result.luminanceFunction) {
+          lf.push_back(result.luminanceFunction);
+        }
+      }
+      i       += numPacketRays;
+      numRays += numPacketRays;
+    }
+    // Check whether the pixel has converged. At least two samples are
+    // needed to estimate the variance, so a single sample only ends the
+    // pixel if it saw nothing at all.
+    if (!adaptive) {
+      break;
+    }
+    if (numRays == 1 && 
+        sumL == Colors::zero() && sumA == Colors::zero()) {
+      break;
+    }
+    if (numRays > 1 &&
+        Math::max(standardError(sumL, sumLSq, numRays)) <= threshold &&
+        Math::max(standardError(sumA, sumASq, numRays)) <= threshold) {
+      break;
+    }
+  }
+
+  // Normalize luminance and transmittance
+  luminance = sumL / static_cast<float>(numRays);
+  alpha     = sumA / static_cast<float>(numRays);
+  // Average deep functions
+  if (tf.size() > 0) {
+    deepT = ColorCurve::average(tf);
+  }
+  if (lf.size() > 0) {
+    deepL = ColorCurve::average(lf);
+  }
+
+  return numRays;
+}
+
+//----------------------------------------------------------------------------//
+
+RayState Renderer::setupRayState(const float x, const float y,
+                                const PTime time, 
+                                const float stepOffset) const
 {
   // Create default RayState. Rely on its constructor to set reasonable
   // defaults
   RayState state;
   // Update the values that are non-default
   state.wsRay = setupRay(m_camera, x, y, time);
+  // The footprint grows with the angle between rays through neighboring
+  // pixels. Rays start at the eye, so it's zero at the origin.
+  const Ray wsNeighborRay = setupRay(m_camera, x + 1.0f, y, time);
+  state.footprintSpread = (wsNeighborRay.dir - state.wsRay.dir).length();
   state.time = time;
+  state.stepOffset = stepOffset;
   if (!m_params.doPrimary) {
     state.rayType = RayState::TransmittanceOnly;
     state.rayDepth = 1;
   }
   state.doOutputDeepT = m_params.doTransmittanceMap;
   state.doOutputDeepL = m_params.doLuminanceMap;
-  // Let the Raymarcher do the integration work
-  return m_raymarcher->integrate(state);
+  state.context = &m_context;
+  return state;
 }
 
 //----------------------------------------------------------------------------//
 
-void Renderer::setupSample(const float xCenter, const float yCenter,
-                           const size_t xSubpixel, const size_t ySubpixel, 
-                           float &xSample, float &ySample, PTime &pTime) const
+void Renderer::setupSample(const int x, const int y, const size_t sampleIdx,
+                           Rand48 &rng, float &xSample, float &ySample, 
+                           PTime &pTime, float &stepOffset) const
 {
-  const size_t numSamples = m_params.numPixelSamples;
+  using Sampling::SampleGenerator;
+
+  const size_t numSamples = std::max(m_params.numPixelSamples, 
+                                     static_cast<size_t>(1));
+  const size_t batchSize  = numSamples * numSamples;
+
+  xSample    = Field3D::discToCont(x);
+  ySample    = Field3D::discToCont(y);
+  stepOffset = 0.5f;
+
+  // Sample generator ---
+
+  if (m_sampleGenerator) {
+    const size_t pixelSeed = x + y * m_primary->size().x;
+    if (m_params.doRandomizePixelSamples) {
+      const V2f offset = 
+        m_sampleGenerator->sample2D(pixelSeed, sampleIdx, batchSize, 
+                                    SampleGenerator::PixelDim);
+      xSample = x + offset.x;
+      ySample = y + offset.y;
+    }
+    pTime = PTime(m_sampleGenerator->sample1D(pixelSeed, sampleIdx, batchSize,
+                                              SampleGenerator::TimeDim));
+    stepOffset = m_sampleGenerator->sample1D(pixelSeed, sampleIdx, batchSize,
+                                             SampleGenerator::StepOffsetDim);
+    return;
+  }
+
+  // Default sampling ---
+
+  const size_t xSubpixel = (sampleIdx % batchSize) / numSamples;
+  const size_t ySubpixel = (sampleIdx % batchSize) % numSamples;
 
-  xSample = xCenter;
-  ySample = yCenter;
   if (m_params.doRandomizePixelSamples) {
-    xSample += m_rng.nextf() - 0.5f;
-    ySample += m_rng.nextf() - 0.5f;
+    xSample += rng.nextf() - 0.5f;
+    ySample += rng.nextf() - 0.5f;
   }
-  pTime = PTime((xSubpixel + ySubpixel * numSamples + m_rng.nextf()) / 
-                (numSamples * numSamples));
+  pTime = PTime((xSubpixel + ySubpixel * numSamples + rng.nextf()) / 
+                batchSize);
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,327 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SampleGenerator.cpp
+  Contains implementations of SampleGenerator classes.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/SampleGenerator.h"
+
+// System includes
+
+#include <algorithm>
+#include <cmath>
+
+// Library includes
+
+#include <boost/cstdint.hpp>
+
+// Project headers
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using boost::uint32_t;
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of Sobol dimensions supported. Higher dimensions wrap around,
+  //! but with a different scramble/shift so they aren't identical.
+  const size_t k_sobolDims = 8;
+  //! Number of bits in each Sobol direction number
+  const size_t k_sobolBits = 32;
+
+  //--------------------------------------------------------------------------//
+
+  //! Builds the Sobol direction numbers. The primitive polynomials and
+  //! initial direction numbers are from Joe & Kuo (2008).
+  struct SobolTable
+  {
+    SobolTable()
+    {
+      // Degree, polynomial coefficients and initial direction numbers for
+      // dimensions 2-8. Dimension 1 is the van der Corput sequence.
+      static const uint32_t s[k_sobolDims]    = { 0, 1, 2, 3, 3, 4, 4, 5 };
+      static const uint32_t a[k_sobolDims]    = { 0, 0, 1, 1, 2, 1, 4, 2 };
+      static const uint32_t m[k_sobolDims][5] = { { 0, 0, 0, 0, 0 },
+                                                  { 1, 0, 0, 0, 0 },
+                                                  { 1, 3, 0, 0, 0 },
+                                                  { 1, 3, 1, 0, 0 },
+                                                  { 1, 1, 1, 0, 0 },
+                                                  { 1, 1, 3, 3, 0 },
+                                                  { 1, 3, 5, 13, 0 },
+                                                  { 1, 1, 5, 5, 17 } };
+      for (size_t i = 0; i < k_sobolBits; ++i) {
+        v[0][i] = 1u << (31 - i);
+      }
+      for (size_t dim = 1; dim < k_sobolDims; ++dim) {
+        const uint32_t deg = s[dim];
+        for (size_t i = 0; i < k_sobolBits; ++i) {
+          if (i < deg) {
+            v[dim][i] = m[dim][i] << (31 - i);
+          } else {
+            v[dim][i] = v[dim][i - deg] ^ (v[dim][i - deg] >> deg);
+            for (size_t k = 1; k < deg; ++k) {
+              v[dim][i] ^= ((a[dim] >> (deg - 1 - k)) & 1u) * v[dim][i - k];
+            }
+          }
+        }
+      }
+    }
+    uint32_t v[k_sobolDims][k_sobolBits];
+  };
+
+  const SobolTable k_sobolTable;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the 32 bit Sobol sample for a given index and dimension
+  uint32_t sobol(uint32_t index, const size_t dim)
+  {
+    const uint32_t *v = k_sobolTable.v[dim % k_sobolDims];
+    uint32_t result = 0;
+    for (size_t i = 0; index; index >>= 1, ++i) {
+      if (index & 1u) {
+        result ^= v[i];
+      }
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Integer hash with good avalanche behavior
+  uint32_t hash(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Combines a pixel seed, dimension and an additional value into a seed
+  uint32_t seed(const size_t pixelSeed, const size_t dim,
+                const size_t extra = 0)
+  {
+    return hash(static_cast<uint32_t>(pixelSeed) ^
+                hash(static_cast<uint32_t>(dim) * 0x9e3779b9u +
+                     hash(static_cast<uint32_t>(extra))));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Converts 32 bits to a float in [0,1). Only the top 24 bits are used,
+  //! so the result can't round up to 1.0
+  float toFloat(const uint32_t x)
+  {
+    return (x >> 8) * (1.0f / 16777216.0f);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  uint32_t reverseBits(uint32_t x)
+  {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Hash-based Owen scrambling, from Burley (2020), "Practical Hash-based
+  //! Owen Scrambling". Each bit is flipped based on a hash of the bits
+  //! above it, which is a nested uniform scramble.
+  uint32_t owenScramble(uint32_t x, const uint32_t seed)
+  {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns a pseudo-random permutation of i in [0, l), from Kensler (2013),
+  //! "Correlated Multi-Jittered Sampling"
+  uint32_t permute(uint32_t i, const uint32_t l, const uint32_t p)
+  {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+      i ^= p;             i *= 0xe170893du;
+      i ^= p >> 16;
+      i ^= (i & w) >> 4;
+      i ^= p >> 8;        i *= 0x0929eb3fu;
+      i ^= p >> 23;
+      i ^= (i & w) >> 1;  i *= 1 | p >> 27;
+                          i *= 0x6935fa69u;
+      i ^= (i & w) >> 11; i *= 0x74dcb303u;
+      i ^= (i & w) >> 2;  i *= 0x9e501cc3u;
+      i ^= (i & w) >> 2;  i *= 0xc860a3dfu;
+      i &= w;
+      i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns a pseudo-random float in [0,1), from Kensler (2013)
+  float randFloat(uint32_t i, const uint32_t p)
+  {
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10; i *= 0xb36534e5u;
+    i ^= i >> 12;
+    i ^= i >> 21; i *= 0x93fc4795u;
+    i ^= 0xdf6e307fu;
+    i ^= i >> 17; i *= 1 | p >> 18;
+    return toFloat(i);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+// Namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Imath;
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Render {
+namespace Sampling {
+
+//----------------------------------------------------------------------------//
+// Stratified
+//----------------------------------------------------------------------------//
+
+float Stratified::sample1D(const size_t pixelSeed, const size_t index,
+                           const size_t numSamples,
+                           const size_t dimension) const
+{
+  const uint32_t n      = std::max(numSamples, static_cast<size_t>(1));
+  const uint32_t batch  = index / n;
+  const uint32_t s      = index % n;
+  const uint32_t p      = seed(pixelSeed, dimension, batch);
+  // Shuffle the strata so that dimensions are decorrelated from each other
+  const uint32_t strata = permute(s, n, p * 0x68bc21ebu);
+  return (strata + randFloat(s, p * 0x02e5be93u)) / n;
+}
+
+//----------------------------------------------------------------------------//
+
+V2f Stratified::sample2D(const size_t pixelSeed, const size_t index,
+                         const size_t numSamples,
+                         const size_t dimension) const
+{
+  // Correlated multi-jittered sampling, Kensler (2013)
+  const uint32_t N     = std::max(numSamples, static_cast<size_t>(1));
+  const uint32_t m     = 
+    static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(N))));
+  const uint32_t n     = (N + m - 1) / m;
+  const uint32_t batch = index / N;
+  const uint32_t p     = seed(pixelSeed, dimension, batch);
+  const uint32_t s     = permute(index % N, N, p * 0x51633e2du);
+  const uint32_t sx    = permute(s % m, m, p * 0xa511e9b3u);
+  const uint32_t sy    = permute(s / m, n, p * 0x63d83595u);
+  const float    jx    = randFloat(s, p * 0xa399d265u);
+  const float    jy    = randFloat(s, p * 0x711ad6a5u);
+  return V2f(std::min((s % m + (sy + jx) / n) / m, 0.99999994f),
+             std::min((s / m + (sx + jy) / m) / n, 0.99999994f));
+}
+
+//----------------------------------------------------------------------------//
+// Sobol
+//----------------------------------------------------------------------------//
+
+float Sobol::sample1D(const size_t pixelSeed, const size_t index,
+                      const size_t numSamples, const size_t dimension) const
+{
+  // Random digital shift decorrelates pixels but keeps the net properties
+  return toFloat(sobol(index, dimension) ^ seed(pixelSeed, dimension));
+}
+
+//----------------------------------------------------------------------------//
+
+V2f Sobol::sample2D(const size_t pixelSeed, const size_t index,
+                    const size_t numSamples, const size_t dimension) const
+{
+  return V2f(sample1D(pixelSeed, index, numSamples, dimension),
+             sample1D(pixelSeed, index, numSamples, dimension + 1));
+}
+
+//----------------------------------------------------------------------------//
+// OwenScrambledSobol
+//----------------------------------------------------------------------------//
+
+float OwenScrambledSobol::sample1D(const size_t pixelSeed, const size_t index,
+                                   const size_t numSamples,
+                                   const size_t dimension) const
+{
+  return toFloat(owenScramble(sobol(index, dimension),
+                              seed(pixelSeed, dimension)));
+}
+
+//----------------------------------------------------------------------------//
+
+V2f OwenScrambledSobol::sample2D(const size_t pixelSeed, const size_t index,
+                                 const size_t numSamples,
+                                 const size_t dimension) const
+{
+  return V2f(sample1D(pixelSeed, index, numSamples, dimension),
+             sample1D(pixelSeed, index, numSamples, dimension + 1));
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sampling
+} // namespace Render
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
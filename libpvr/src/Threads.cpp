@@ -0,0 +1,302 @@
+//----------------------------------------------------------------------------//
+
+/*
+    This file is part of PVR. Copyright (C) 2012 Magnus Wrenninge
+
+    PVR is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    PVR is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Threads.cpp
+  Contains implementations of the thread pool scheduling functions.
+ */
+
+//----------------------------------------------------------------------------//
+// Includes
+//----------------------------------------------------------------------------//
+
+// Header include
+
+#include "pvr/Threads.h"
+
+// System includes
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// Library includes
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Project headers
+
+#include "pvr/Interrupt.h"
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr;
+
+  //--------------------------------------------------------------------------//
+
+  //! How often the calling thread wakes up to check for interrupts,
+  //! in milliseconds
+  const long k_pollInterval = 100;
+
+  //--------------------------------------------------------------------------//
+
+  //! Task queue owned by a single worker thread
+  struct TaskQueue
+  {
+    boost::mutex       mutex;
+    std::deque<size_t> tasks;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Shared state between the calling thread and the worker threads
+  class Scheduler
+  {
+  public:
+
+    Scheduler(const size_t numTasks, const size_t numThreads,
+              const Sys::TaskFunc &func)
+      : m_func(func), m_numTasks(numTasks), m_numDone(0),
+        m_abort(false), m_failed(false)
+    {
+      // Distribute tasks in contiguous ranges. Neighboring tasks (i.e.
+      // neighboring image tiles) tend to have similar cost and touch the same
+      // data, so each thread starts out with a coherent chunk of work.
+      for (size_t i = 0; i < numThreads; ++i) {
+        QueuePtr queue(new TaskQueue);
+        const size_t first = numTasks * i / numThreads;
+        const size_t last  = numTasks * (i + 1) / numThreads;
+        for (size_t task = first; task < last; ++task) {
+          queue->tasks.push_back(task);
+        }
+        m_queues.push_back(queue);
+      }
+    }
+
+    //! Worker thread entry point
+    void run(const size_t thread)
+    {
+      size_t task;
+      while (!aborted() && nextTask(thread, task)) {
+        try {
+          m_func(task, thread);
+        }
+        catch (const std::exception &e) {
+          fail(e.what());
+        }
+        catch (...) {
+          fail("Unknown exception");
+        }
+        taskDone();
+      }
+    }
+
+    //! Blocks until all tasks are done or a task failed. Polls the global
+    //! interrupt while waiting.
+    void wait(Util::ProgressReporter *progress)
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (m_numDone < m_numTasks && !m_failed && !m_abort) {
+        m_cond.timed_wait(lock,
+                          boost::posix_time::milliseconds(k_pollInterval));
+        const float fraction = static_cast<float>(m_numDone) / m_numTasks;
+        // Interrupt handlers may call back into python, which may in turn
+        // take a while, so don't hold the lock.
+        lock.unlock();
+        const bool userAbort = Sys::Interrupt::checkAbort();
+        if (progress) {
+          progress->update(fraction);
+        }
+        lock.lock();
+        if (userAbort) {
+          m_abort = true;
+        }
+      }
+      // Make sure any remaining workers stop picking up new tasks
+      if (m_failed) {
+        m_abort = true;
+      }
+    }
+
+    bool userAborted() const
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      return m_abort && !m_failed;
+    }
+
+    bool failed() const
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      return m_failed;
+    }
+
+    const std::string& error() const
+    { return m_error; }
+
+  private:
+
+    typedef boost::shared_ptr<TaskQueue> QueuePtr;
+
+    //! Pops the next task from the thread's own queue. If that queue is
+    //! empty, steals from the back of another thread's queue.
+    bool nextTask(const size_t thread, size_t &task)
+    {
+      const size_t numQueues = m_queues.size();
+      // Own queue first
+      {
+        TaskQueue &queue = *m_queues[thread];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+          task = queue.tasks.front();
+          queue.tasks.pop_front();
+          return true;
+        }
+      }
+      // Steal from the other threads. Tasks are never added once the
+      // scheduler is running, so if all queues are empty we're done.
+      for (size_t i = 1; i < numQueues; ++i) {
+        TaskQueue &queue = *m_queues[(thread + i) % numQueues];
+        boost::mutex::scoped_lock lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+          task = queue.tasks.back();
+          queue.tasks.pop_back();
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool aborted() const
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      return m_abort;
+    }
+
+    void taskDone()
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_numDone++;
+      m_cond.notify_one();
+    }
+
+    void fail(const std::string &error)
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      // Only the first error is reported
+      if (!m_failed) {
+        m_failed = true;
+        m_abort = true;
+        m_error = error;
+      }
+    }
+
+    const Sys::TaskFunc       &m_func;
+    std::vector<QueuePtr>      m_queues;
+    mutable boost::mutex       m_mutex;
+    boost::condition_variable  m_cond;
+    const size_t               m_numTasks;
+    size_t                     m_numDone;
+    bool                       m_abort;
+    bool                       m_failed;
+    std::string                m_error;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
+//----------------------------------------------------------------------------//
+
+namespace pvr {
+namespace Sys {
+
+//----------------------------------------------------------------------------//
+// Thread functions
+//----------------------------------------------------------------------------//
+
+size_t numHardwareThreads()
+{
+  const size_t numThreads = boost::thread::hardware_concurrency();
+  return numThreads > 0 ? numThreads : 1;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t resolveNumThreads(const size_t numThreads)
+{
+  return numThreads > 0 ? numThreads : numHardwareThreads();
+}
+
+//----------------------------------------------------------------------------//
+
+void parallelFor(const size_t numTasks, const size_t numThreads,
+                 const TaskFunc &func, Util::ProgressReporter *progress)
+{
+  if (numTasks == 0) {
+    return;
+  }
+
+  const size_t threadCount = std::min(resolveNumThreads(numThreads), numTasks);
+
+  // Single-threaded case runs on the calling thread, in order
+  if (threadCount == 1) {
+    for (size_t task = 0; task < numTasks; ++task) {
+      Interrupt::throwOnAbort();
+      if (progress) {
+        progress->update(static_cast<float>(task) / numTasks);
+      }
+      func(task, 0);
+    }
+    return;
+  }
+
+  Scheduler scheduler(numTasks, threadCount, func);
+
+  boost::thread_group threads;
+  for (size_t i = 0; i < threadCount; ++i) {
+    threads.create_thread(boost::bind(&Scheduler::run, &scheduler, i));
+  }
+  scheduler.wait(progress);
+  threads.join_all();
+
+  if (scheduler.failed()) {
+    throw WorkerThreadException(scheduler.error());
+  }
+  if (scheduler.userAborted()) {
+    throw UserInterruptException();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sys
+} // namespace pvr
+
+//----------------------------------------------------------------------------//
@@ -31,9 +31,47 @@
 
 #include "pvr/VolumeAttr.h"
 
+// System includes
+
+#include <map>
+
+// Library includes
+
+#include <boost/thread/mutex.hpp>
+
 // Project includes
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
 
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  typedef std::map<std::string, size_t> IdMap;
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the global name-to-id map
+  IdMap& idMap()
+  {
+    static IdMap map;
+    return map;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Guards the global name-to-id map
+  boost::mutex& idMutex()
+  {
+    static boost::mutex mutex;
+    return mutex;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
 
 //----------------------------------------------------------------------------//
 // Namespaces
@@ -47,7 +85,7 @@ namespace Render {
 //----------------------------------------------------------------------------//
 
 VolumeAttr::VolumeAttr(const std::string &name)
-  : m_name(name), m_index(IndexNotSet)
+  : m_name(name), m_id(idForName(name))
 { 
   // Empty
 }
@@ -61,29 +99,39 @@ const std::string& VolumeAttr::name() const
   
 //----------------------------------------------------------------------------//
 
-int VolumeAttr::index() const
-{ 
-  return m_index; 
+size_t VolumeAttr::idForName(const std::string &name)
+{
+  boost::mutex::scoped_lock lock(idMutex());
+  IdMap &map = idMap();
+  IdMap::const_iterator i = map.find(name);
+  if (i != map.end()) {
+    return i->second;
+  }
+  const size_t id = map.size();
+  map[name] = id;
+  return id;
 }
 
+//----------------------------------------------------------------------------//
+// VolumeAttrTable implementations
 //----------------------------------------------------------------------------//
 
-void VolumeAttr::setIndex(const int index) const
-{ 
-  if (m_index != IndexNotSet) {
-    throw SetIndexException("Trying to set index more than once");
+void VolumeAttrTable::addAttribute(const std::string &name, const int index)
+{
+  const size_t id = VolumeAttr::idForName(name);
+  if (id >= m_indices.size()) {
+    m_indices.resize(id + 1, VolumeAttr::IndexInvalid);
   }
-  if (index < 0) {
-    throw SetIndexException("Index provided was less than zero");
+  if (m_indices[id] == VolumeAttr::IndexInvalid) {
+    m_indices[id] = index;
   }
-  m_index = index; 
 }
 
 //----------------------------------------------------------------------------//
 
-void VolumeAttr::setIndexInvalid() const
-{ 
-  m_index = IndexInvalid; 
+void VolumeAttrTable::clear()
+{
+  m_indices.clear();
 }
 
 //----------------------------------------------------------------------------//
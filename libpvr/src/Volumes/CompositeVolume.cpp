@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <boost/foreach.hpp>
@@ -61,19 +63,7 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
-  struct MatchName : 
-    public std::unary_function<CompositeVolume::ChildAttrs, bool>
-  {
-    MatchName(const std::string &name)
-      : m_match(name)
-    { }
-    bool operator()(const CompositeVolume::ChildAttrs &test)
-    {
-      return test.name == m_match;
-    }
-  private:
-    const std::string m_match;
-  };
+  typedef Phase::PhaseFunction::Weight Weight;
 
   //--------------------------------------------------------------------------//
 
@@ -118,26 +108,98 @@ Volume::AttrNameVec CompositeVolume::attributeNames() const
 VolumeSample CompositeVolume::sample(const VolumeSampleState &state,
                                      const VolumeAttr &attribute) const
 {
-  if (attribute.index() == VolumeAttr::IndexNotSet) {
-    setupAttribute(attribute);
+  VolumeSample result(Colors::zero(), m_phaseFunction);
+
+  // The phase function weights are only needed for scattering. They are 
+  // returned with the sample rather than stored in the phase function so 
+  // that sampling is safe to call from multiple threads.
+  const bool doPhaseWeights = state.rayState.rayType == RayState::FullRaymarch;
+
+  Accel::BVH::IndexVec children;
+  pointQuery(state.wsP, children);
+
+  BOOST_FOREACH (const size_t i, children) {
+    const Color sampleValue = m_volumes[i]->sample(state, attribute).value;
+    result.value += sampleValue;
+    if (doPhaseWeights) {
+      result.phaseWeights.push_back(Weight(i, Math::max(sampleValue)));
+    }
   }
-  if (attribute.index() == VolumeAttr::IndexInvalid) {
-    return VolumeSample(Colors::zero(), m_phaseFunction);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::sampleExtinction(const VolumeSampleState &state,
+                                       Color &extinction, Color &holdout) const
+{
+  extinction = holdout = Colors::zero();
+
+  Accel::BVH::IndexVec children;
+  pointQuery(state.wsP, children);
+
+  BOOST_FOREACH (const size_t i, children) {
+    Color childExtinction, childHoldout;
+    m_volumes[i]->sampleExtinction(state, childExtinction, childHoldout);
+    extinction += childExtinction;
+    holdout    += childHoldout;
   }
+}
 
-  Color value = Colors::zero();
-  int attrIndex = attribute.index();
+//----------------------------------------------------------------------------//
 
-  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
-    const VolumeAttr &childAttr = m_childAttrs[attrIndex].attrs[i];
-    const Color sampleValue = m_volumes[i]->sample(state, childAttr).value;
-    value += sampleValue;
-    if (state.rayState.rayType == RayState::FullRaymarch) {
-      m_compositePhaseFunction->setWeight(i, Math::max(sampleValue));
+void CompositeVolume::maxAttributeValues(const BBox &wsBox,
+                                         const VolumeAttr *attributes,
+                                         const size_t numAttrs,
+                                         Color *maxValues) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  std::fill(maxValues, maxValues + numAttrs, Colors::zero());
+
+  Accel::BVH::IndexVec children;
+  boxQuery(wsBox, children);
+
+  // Child values are summed, so the bounds are too
+  BOOST_FOREACH (const size_t i, children) {
+    Color childValues[MaxAttributes];
+    m_volumes[i]->maxAttributeValues(wsBox, attributes, numAttrs, 
+                                     childValues);
+    for (size_t a = 0; a < numAttrs; ++a) {
+      maxValues[a] += childValues[a];
     }
   }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::maxExtinction(const BBox &wsBox, Color &extinction,
+                                    Color &holdout) const
+{
+  extinction = holdout = Colors::zero();
+
+  Accel::BVH::IndexVec children;
+  boxQuery(wsBox, children);
+
+  BOOST_FOREACH (const size_t i, children) {
+    Color childExtinction, childHoldout;
+    m_volumes[i]->maxExtinction(wsBox, childExtinction, childHoldout);
+    extinction += childExtinction;
+    holdout    += childHoldout;
+  }
+}
 
-  return VolumeSample(value, m_phaseFunction);
+//----------------------------------------------------------------------------//
+
+bool CompositeVolume::hasConservativeBounds() const
+{
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    if (!m_volumes[i]->hasConservativeBounds()) {
+      return false;
+    }
+  }
+  return true;
 }
 
 //----------------------------------------------------------------------------//
@@ -155,11 +217,14 @@ BBox CompositeVolume::wsBounds() const
 
 IntervalVec CompositeVolume::intersect(const RayState &state) const
 {
+  Accel::BVH::IndexVec children;
+  rayQuery(state.wsRay, children);
+
   IntervalVec intervals;
-  BOOST_FOREACH (Volume::CPtr child, m_volumes) {
-    IntervalVec childIntervals = child->intersect(state);
-    intervals.insert(intervals.begin(),
-                     childIntervals.begin(), childIntervals.end());
+  BOOST_FOREACH (const size_t i, children) {
+    IntervalVec childIntervals = m_volumes[i]->intersect(state);
+    // Order doesn't matter, since the raymarcher sorts the intervals
+    intervals.append(childIntervals.begin(), childIntervals.end());
   }
   return intervals;
 }
@@ -173,37 +238,178 @@ Volume::CVec CompositeVolume::inputs() const
 
 //----------------------------------------------------------------------------//
 
+void CompositeVolume::sampleAttributes(const VolumeSampleState &state,
+                                       const VolumeAttr *attributes,
+                                       const size_t numAttrs,
+                                       VolumeSample *samples) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  VolumeSample childSamples[MaxAttributes];
+
+  const bool doPhaseWeights = state.rayState.rayType == RayState::FullRaymarch;
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    samples[a] = VolumeSample(Colors::zero(), m_phaseFunction);
+  }
+
+  Accel::BVH::IndexVec children;
+  pointQuery(state.wsP, children);
+
+  BOOST_FOREACH (const size_t i, children) {
+    m_volumes[i]->sampleAttributes(state, attributes, numAttrs, childSamples);
+    for (size_t a = 0; a < numAttrs; ++a) {
+      const Color &sampleValue = childSamples[a].value;
+      samples[a].value += sampleValue;
+      if (doPhaseWeights) {
+        samples[a].phaseWeights.push_back(Weight(i, Math::max(sampleValue)));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::samplePacket(const VolumeSamplePacket &packet,
+                                   const VolumeAttr *attributes,
+                                   const size_t numAttrs,
+                                   PacketValues *values,
+                                   PacketWeights *phaseWeights) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  PacketValues childValues[MaxAttributes];
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    std::fill(values[a], values[a] + packet.size, Colors::zero());
+  }
+
+  // Visit the children that overlap any of the samples
+  BBox wsPacketBounds;
+  for (size_t i = 0; i < packet.size; ++i) {
+    wsPacketBounds.extendBy(packet.wsP(i));
+  }
+
+  Accel::BVH::IndexVec children;
+  boxQuery(wsPacketBounds, children);
+
+  BOOST_FOREACH (const size_t c, children) {
+    m_volumes[c]->samplePacket(packet, attributes, numAttrs, childValues,
+                               NULL);
+    for (size_t a = 0; a < numAttrs; ++a) {
+      for (size_t i = 0; i < packet.size; ++i) {
+        values[a][i] += childValues[a][i];
+      }
+    }
+    // Weight each child by its contribution, as in sample(). Children
+    // that don't contain a sample contribute zero, which is ignored.
+    if (phaseWeights && numAttrs > 0) {
+      for (size_t i = 0; i < packet.size; ++i) {
+        const float weight = Math::max(childValues[0][i]);
+        if (weight > 0.0f &&
+            packet.rayState[i]->rayType == RayState::FullRaymarch) {
+          (*phaseWeights)[i].push_back(Weight(c, weight));
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::sampleExtinctionPacket(const VolumeSamplePacket &packet,
+                                             PacketValues &extinction,
+                                             PacketValues &holdout) const
+{
+  std::fill(extinction, extinction + packet.size, Colors::zero());
+  std::fill(holdout, holdout + packet.size, Colors::zero());
+
+  BBox wsPacketBounds;
+  for (size_t i = 0; i < packet.size; ++i) {
+    wsPacketBounds.extendBy(packet.wsP(i));
+  }
+
+  Accel::BVH::IndexVec children;
+  boxQuery(wsPacketBounds, children);
+
+  BOOST_FOREACH (const size_t c, children) {
+    PacketValues childExtinction, childHoldout;
+    m_volumes[c]->sampleExtinctionPacket(packet, childExtinction,
+                                         childHoldout);
+    for (size_t i = 0; i < packet.size; ++i) {
+      extinction[i] += childExtinction[i];
+      holdout[i]    += childHoldout[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::prepare() const
+{
+  // Children may themselves need preparing, e.g. nested composites
+  Volume::prepare();
+
+  Accel::BVH::BBoxVec bounds;
+  bounds.reserve(m_volumes.size());
+  BOOST_FOREACH (Volume::CPtr volume, m_volumes) {
+    bounds.push_back(volume->wsBounds());
+  }
+  m_bvh.build(bounds);
+  m_bvhValid = true;
+}
+
+//----------------------------------------------------------------------------//
+
 void CompositeVolume::add(Volume::CPtr child)
 {
   m_volumes.push_back(child);
   m_compositePhaseFunction->add(child->phaseFunction());
+  m_bvhValid = false;
 }
 
 //----------------------------------------------------------------------------//
 
-void CompositeVolume::setupAttribute(const VolumeAttr &attribute) const
+void CompositeVolume::pointQuery(const Vector &wsP, 
+                                 Accel::BVH::IndexVec &children) const
 {
-  ChildAttrsVec::const_iterator i = 
-    find_if(m_childAttrs.begin(), m_childAttrs.end(), 
-            MatchName(attribute.name()));
+  if (m_bvhValid) {
+    m_bvh.pointQuery(wsP, children);
+  } else {
+    allChildren(children);
+  }
+}
+
+//----------------------------------------------------------------------------//
 
-  if (i != m_childAttrs.end()) {
-    // Attribute already exists in m_childAttrs, so set index directly
-    attribute.setIndex(i - m_childAttrs.begin());
+void CompositeVolume::boxQuery(const BBox &wsBox, 
+                               Accel::BVH::IndexVec &children) const
+{
+  if (m_bvhValid) {
+    m_bvh.boxQuery(wsBox, children);
   } else {
-    // Attribute does not yet exist, look for it among children
-    AttrNameVec attrs = attributeNames();
-    if (find(attrs.begin(), attrs.end(), attribute.name()) != attrs.end()) {
-      // One or more children have the attribute
-      ChildAttrs newAttr;
-      newAttr.name = attribute.name();
-      newAttr.attrs.resize(m_volumes.size(), VolumeAttr(attribute.name()));
-      m_childAttrs.push_back(newAttr);
-      attribute.setIndex(m_childAttrs.size() - 1);
-    } else {
-      // No child has the attribute. Mark as invalid
-      attribute.setIndexInvalid();
-    }
+    allChildren(children);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::rayQuery(const Ray &wsRay, 
+                               Accel::BVH::IndexVec &children) const
+{
+  if (m_bvhValid) {
+    m_bvh.rayQuery(wsRay, children);
+  } else {
+    allChildren(children);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void CompositeVolume::allChildren(Accel::BVH::IndexVec &children) const
+{
+  for (size_t i = 0, size = m_volumes.size(); i < size; ++i) {
+    children.push_back(i);
   }
 }
 
@@ -33,6 +33,8 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
 #include <OpenEXR/ImathBoxAlgo.h>
@@ -76,18 +78,15 @@ Volume::AttrNameVec ConstantVolume::attributeNames() const
 VolumeSample ConstantVolume::sample(const VolumeSampleState &state,
                                     const VolumeAttr &attribute) const
 {
-  if (attribute.index() == VolumeAttr::IndexNotSet) {
-    setIndexForName(attribute, m_attrNames);
-  }
-  if (attribute.index() == VolumeAttr::IndexInvalid) {
+  const int index = m_attrTable.index(attribute);
+  if (index == VolumeAttr::IndexInvalid) {
     return VolumeSample(Colors::zero(), m_phaseFunction);
   }
 
   // Check if sample falls within volume
-  Vector lsP;
-  m_worldToLocal.interpolate(state.rayState.time).multVecMatrix(state.wsP, lsP);
+  const Vector lsP = worldToLocal(state.rayState)(state.wsP);
   if (Bounds::zeroOne().intersects(lsP)) {
-    return VolumeSample(m_attrValues[attribute.index()], m_phaseFunction);
+    return VolumeSample(m_attrValues[index], m_phaseFunction);
   } else {
     return VolumeSample(Colors::zero(), m_phaseFunction);
   }
@@ -112,14 +111,16 @@ IntervalVec ConstantVolume::intersect(const RayState &state) const
 {
   // Transform ray to local space
   Ray lsRay;
-  const Matrix wsToLs = m_worldToLocal.interpolate(state.time);
+  const Matrix wsToLs = worldToLocal(state).m0;
   wsToLs.multVecMatrix(state.wsRay.pos, lsRay.pos);
   wsToLs.multDirMatrix(state.wsRay.dir, lsRay.dir);
   // Intersect against unity bounds
   double t0, t1;
   if (Math::intersect(lsRay, Bounds::zeroOne(), t0, t1)) {
+    // The volume is constant, so the interval is homogeneous
     return IntervalVec(1, Interval(t0, t1, (t1 - t0) / 
-                                   (std::sqrt(m_maxAttrValue) * 20.0)));
+                                   (std::sqrt(m_maxAttrValue) * 20.0), 
+                                   true));
   } else {
     return IntervalVec();
   }
@@ -138,6 +139,91 @@ Volume::StringVec ConstantVolume::info() const
 
 //----------------------------------------------------------------------------//
 
+void ConstantVolume::sampleAttributes(const VolumeSampleState &state,
+                                      const VolumeAttr *attributes,
+                                      const size_t numAttrs,
+                                      VolumeSample *samples) const
+{
+  // Check if sample falls within volume
+  const Vector lsP      = worldToLocal(state.rayState)(state.wsP);
+  const bool   isInside = Bounds::zeroOne().intersects(lsP);
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    const int index = m_attrTable.index(attributes[a]);
+    if (isInside && index != VolumeAttr::IndexInvalid) {
+      samples[a] = VolumeSample(m_attrValues[index], m_phaseFunction);
+    } else {
+      samples[a] = VolumeSample(Colors::zero(), m_phaseFunction);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void ConstantVolume::samplePacket(const VolumeSamplePacket &packet,
+                                  const VolumeAttr *attributes,
+                                  const size_t numAttrs,
+                                  PacketValues *values,
+                                  PacketWeights *phaseWeights) const
+{
+  // Samples in a packet usually share the same time, so the transform is 
+  // only interpolated when it changes
+  PTime  time(packet.size > 0 ? packet.rayState[0]->time : PTime(0.0));
+  Matrix wsToLs = m_worldToLocal.interpolate(time);
+  bool   isInside[VolumeSamplePacket::MaxSize];
+
+  for (size_t i = 0; i < packet.size; ++i) {
+    if (packet.rayState[i]->time != time) {
+      time   = packet.rayState[i]->time;
+      wsToLs = m_worldToLocal.interpolate(time);
+    }
+    Vector lsP;
+    wsToLs.multVecMatrix(packet.wsP(i), lsP);
+    isInside[i] = Bounds::zeroOne().intersects(lsP);
+  }
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    const int index = m_attrTable.index(attributes[a]);
+    if (index == VolumeAttr::IndexInvalid) {
+      std::fill(values[a], values[a] + packet.size, Colors::zero());
+      continue;
+    }
+    const Color value(m_attrValues[index]);
+    for (size_t i = 0; i < packet.size; ++i) {
+      values[a][i] = isInside[i] ? value : Colors::zero();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void ConstantVolume::maxAttributeValues(const BBox &wsBox,
+                                        const VolumeAttr *attributes,
+                                        const size_t numAttrs,
+                                        Color *maxValues) const
+{
+  // The volume is either present at its full value or not at all
+  const bool overlaps = wsBounds().intersects(wsBox);
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    const int index = m_attrTable.index(attributes[a]);
+    if (overlaps && index != VolumeAttr::IndexInvalid) {
+      maxValues[a] = Math::abs(m_attrValues[index]);
+    } else {
+      maxValues[a] = Colors::zero();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool ConstantVolume::hasConservativeBounds() const
+{
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
 void ConstantVolume::addAttribute(const std::string &attrName, 
                                const Imath::V3f &value)
 {
@@ -146,6 +232,7 @@ void ConstantVolume::addAttribute(const std::string &attrName,
     return;
   }
 
+  m_attrTable.addAttribute(attrName, m_attrNames.size());
   m_attrNames.push_back(attrName);
   m_attrValues.push_back(value);
   m_maxAttrValue = std::max(m_maxAttrValue, Math::max(value));
@@ -153,6 +240,18 @@ void ConstantVolume::addAttribute(const std::string &attrName,
 
 //----------------------------------------------------------------------------//
 
+ResolvedTransform ConstantVolume::worldToLocal(const RayState &state) const
+{
+  if (const ResolvedTransform *xform = state.resolvedTransform(this)) {
+    return *xform;
+  }
+  const ResolvedTransform xform(m_worldToLocal.interpolate(state.time));
+  state.cacheResolvedTransform(this, xform);
+  return xform;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -72,14 +72,7 @@ Volume::AttrNameVec FractalCloud::attributeNames() const
 VolumeSample FractalCloud::sample(const VolumeSampleState &state,
                                   const VolumeAttr &attribute) const
 {
-  if (attribute.index() == VolumeAttr::IndexNotSet) {
-    if (attribute.name() == "scattering") {
-      attribute.setIndex(0);
-    } else {
-      attribute.setIndexInvalid();
-    }
-  }
-  if (attribute.index() == VolumeAttr::IndexInvalid) {
+  if (attribute.id() != m_scatteringAttr.id()) {
     return VolumeSample(Colors::zero(), m_phaseFunction);
   }
   
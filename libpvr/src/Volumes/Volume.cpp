@@ -33,12 +33,58 @@
 
 // System includes
 
+#include <algorithm>
+
 // Library includes
 
+#include <boost/foreach.hpp>
+
 // Project headers
 
+#include "pvr/Constants.h"
+#include "pvr/Math.h"
 #include "pvr/Strings.h"
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  using namespace pvr::Render;
+
+  //--------------------------------------------------------------------------//
+
+  //! Indices into k_extinctionAttrs
+  enum ExtinctionAttrIndex {
+    ScatteringAttr = 0,
+    AbsorptionAttr,
+    HoldoutAttr,
+    NumExtinctionAttrs
+  };
+
+  //! Attributes used by the default Volume::sampleExtinction()
+  const VolumeAttr k_extinctionAttrs[NumExtinctionAttrs] = {
+    VolumeAttr("scattering"), 
+    VolumeAttr("absorption"), 
+    VolumeAttr("holdout")
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of lattice points along each axis used by the default 
+  //! Volume::maxAttributeValues()
+  const int   k_boundLatticeRes = 5;
+  //! Padding applied to the lattice estimate, since the lattice may miss 
+  //! features smaller than its spacing
+  const float k_boundPadding    = 2.0f;
+
+  //--------------------------------------------------------------------------//
+
+} // local namespace
+
 //----------------------------------------------------------------------------//
 // Namespaces
 //----------------------------------------------------------------------------//
@@ -96,22 +142,142 @@ Volume::CVec Volume::inputs() const
 }
 
 //----------------------------------------------------------------------------//
-// Utility functions
+
+void Volume::prepare() const
+{
+  BOOST_FOREACH (Volume::CPtr input, inputs()) {
+    input->prepare();
+  }
+}
+
 //----------------------------------------------------------------------------//
 
-void setIndexForName(const VolumeAttr &attr, const Volume::StringVec &v)
+void Volume::sampleAttributes(const VolumeSampleState &state,
+                              const VolumeAttr *attributes,
+                              const size_t numAttrs,
+                              VolumeSample *samples) const
 {
-  Volume::AttrNameVec::const_iterator i = 
-    std::find(v.begin(), v.end(), attr.name());
-  if (i != v.end()) {
-    attr.setIndex(std::distance(i, v.begin()));
-  } else {
-    attr.setIndexInvalid();
+  for (size_t a = 0; a < numAttrs; ++a) {
+    samples[a] = sample(state, attributes[a]);
   }
 }
 
 //----------------------------------------------------------------------------//
 
+void Volume::samplePacket(const VolumeSamplePacket &packet,
+                          const VolumeAttr *attributes,
+                          const size_t numAttrs,
+                          PacketValues *values,
+                          PacketWeights *phaseWeights) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  VolumeSample samples[MaxAttributes];
+
+  for (size_t i = 0; i < packet.size; ++i) {
+    VolumeSampleState state(*packet.rayState[i]);
+    state.wsP = packet.wsP(i);
+    sampleAttributes(state, attributes, numAttrs, samples);
+    for (size_t a = 0; a < numAttrs; ++a) {
+      values[a][i] = samples[a].value;
+    }
+    if (phaseWeights && numAttrs > 0) {
+      const Phase::PhaseFunction::Weights &weights = samples[0].phaseWeights;
+      (*phaseWeights)[i].append(weights.begin(), weights.end());
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleExtinctionPacket(const VolumeSamplePacket &packet,
+                                    PacketValues &extinction,
+                                    PacketValues &holdout) const
+{
+  PacketValues values[NumExtinctionAttrs];
+  samplePacket(packet, k_extinctionAttrs, NumExtinctionAttrs, values, NULL);
+  for (size_t i = 0; i < packet.size; ++i) {
+    extinction[i] = values[ScatteringAttr][i] + values[AbsorptionAttr][i];
+    holdout[i]    = values[HoldoutAttr][i];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::sampleExtinction(const VolumeSampleState &state,
+                              Color &extinction, Color &holdout) const
+{
+  VolumeSample samples[NumExtinctionAttrs];
+  sampleAttributes(state, k_extinctionAttrs, NumExtinctionAttrs, samples);
+  extinction = samples[ScatteringAttr].value + samples[AbsorptionAttr].value;
+  holdout    = samples[HoldoutAttr].value;
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::maxAttributeValues(const BBox &wsBox,
+                                const VolumeAttr *attributes,
+                                const size_t numAttrs,
+                                Color *maxValues) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  std::fill(maxValues, maxValues + numAttrs, Colors::zero());
+
+  if (wsBox.isEmpty()) {
+    return;
+  }
+
+  RayState          rayState;
+  VolumeSampleState state(rayState);
+  VolumeSample      samples[MaxAttributes];
+
+  // Sample the lattice at the start and end of the shutter interval
+  for (int shutter = 0; shutter < 2; ++shutter) {
+    rayState.time = PTime(static_cast<float>(shutter));
+    for (int k = 0; k < k_boundLatticeRes; ++k) {
+      for (int j = 0; j < k_boundLatticeRes; ++j) {
+        for (int i = 0; i < k_boundLatticeRes; ++i) {
+          const Vector fraction(Math::parametric(i, k_boundLatticeRes),
+                                Math::parametric(j, k_boundLatticeRes),
+                                Math::parametric(k, k_boundLatticeRes));
+          state.wsP = wsBox.min + fraction * wsBox.size();
+          sampleAttributes(state, attributes, numAttrs, samples);
+          for (size_t a = 0; a < numAttrs; ++a) {
+            maxValues[a] = Math::max(maxValues[a], 
+                                     Math::abs(samples[a].value));
+          }
+        }
+      }
+    }
+  }
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    maxValues[a] *= k_boundPadding;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Volume::maxExtinction(const BBox &wsBox, Color &extinction, 
+                           Color &holdout) const
+{
+  Color maxValues[NumExtinctionAttrs];
+  maxAttributeValues(wsBox, k_extinctionAttrs, NumExtinctionAttrs, 
+                     maxValues);
+  extinction = maxValues[ScatteringAttr] + maxValues[AbsorptionAttr];
+  holdout    = maxValues[HoldoutAttr];
+}
+
+//----------------------------------------------------------------------------//
+
+bool Volume::hasConservativeBounds() const
+{
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 
@@ -33,11 +33,21 @@
 
 // System includes
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
 // Library includes
 
 #include <Field3D/Field3DFile.h>
 #include <Field3D/DenseField.h>
 #include <Field3D/SparseField.h>
+#include <Field3D/SparseFile.h>
+
+#include <boost/bind.hpp>
+
+#include <OpenEXR/ImathFun.h>
 
 // Project headers
 
@@ -58,51 +68,6 @@ int sign(float x) { return (x > 0) - (x < 0); }
 
 //----------------------------------------------------------------------------//
 
-void handleNaN(pvr::Vector &v) 
-{
-#ifdef WIN32
-  if (_isnan(v.x)) 
-    v.x = std::numeric_limits<double>::max();
-  if (_isnan(v.y)) 
-    v.y = std::numeric_limits<double>::max();
-  if (_isnan(v.z)) 
-    v.z = std::numeric_limits<double>::max();
-  if (!_finite(v.x)) 
-    v.x = std::numeric_limits<double>::max();
-  if (!_finite(v.y)) 
-    v.y = std::numeric_limits<double>::max();
-  if (!_finite(v.z)) 
-    v.z = std::numeric_limits<double>::max();
-#else
-  if (std::isnan(v.x)) 
-    v.x = std::numeric_limits<double>::max();
-  if (std::isnan(v.y)) 
-    v.y = std::numeric_limits<double>::max();
-  if (std::isnan(v.z)) 
-    v.z = std::numeric_limits<double>::max();
-  if (std::isinf(v.x)) 
-    v.x = std::numeric_limits<double>::max();
-  if (std::isinf(v.y)) 
-    v.y = std::numeric_limits<double>::max();
-  if (std::isinf(v.z)) 
-    v.z = std::numeric_limits<double>::max();
-#endif
-}
-
-//----------------------------------------------------------------------------//
-
-void worldToBlock(Field3D::MatrixFieldMapping::Ptr mapping, 
-                  const int blockSize, const pvr::Ray &wsRay, 
-                  pvr::Ray &bsRay)
-{
-  mapping->worldToVoxel(wsRay.pos, bsRay.pos);
-  mapping->worldToVoxelDir(wsRay.dir, bsRay.dir);
-  bsRay.pos /= static_cast<double>(blockSize);
-  bsRay.dir /= static_cast<double>(blockSize);
-}
-
-//----------------------------------------------------------------------------//
-
 void stepToNextBlock(const pvr::Vector &tDelta, const Imath::V3i &sgn, 
                      pvr::Vector &tMax, int &x, int &y, int &z)
 {
@@ -120,6 +85,522 @@ void stepToNextBlock(const pvr::Vector &tDelta, const Imath::V3i &sgn,
 
 //----------------------------------------------------------------------------//
 
+//! Attributes used to bake the extinction of VoxelVolume
+const pvr::Render::VolumeAttr k_extinctionAttr("extinction");
+const pvr::Render::VolumeAttr k_scatteringAttr("scattering");
+const pvr::Render::VolumeAttr k_absorptionAttr("absorption");
+const pvr::Render::VolumeAttr k_holdoutAttr("holdout");
+
+//----------------------------------------------------------------------------//
+
+//! Interpolates each point in a packet that lies within the buffer's data
+//! window. Points outside are set to zero. Buffer_T is either a 
+//! VoxelBuffer or one of the access classes in TypedInterp.h.
+template <typename Interp_T, typename Buffer_T>
+void interpolatePacket(const Interp_T &interp, const Buffer_T &buffer,
+                       const pvr::Vector *vsP, const bool *inBounds,
+                       const size_t size, Imath::V3f *values)
+{
+  for (size_t i = 0; i < size; ++i) {
+    values[i] = inBounds[i] ? interp.sample(buffer, vsP[i]) : Imath::V3f(0.0);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Whether TypedInterp.h implements the given interpolation type. Point 
+//! sampling and monotonic cubic always use the generic path.
+bool hasTypedInterp(const pvr::Render::VoxelVolume::InterpType interpType)
+{
+  using pvr::Render::VoxelVolume;
+  return interpType != VoxelVolume::NoInterp && 
+    interpType != VoxelVolume::MonotonicCubicInterp;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Mip pyramids stop after this many levels, or when a level is a single
+//! voxel
+const size_t k_maxMipLevels = 16;
+
+//----------------------------------------------------------------------------//
+
+//! Default error tolerance of shadow proxies, relative to the largest 
+//! voxel value
+const float k_defaultShadowProxyTolerance = 0.05f;
+
+//----------------------------------------------------------------------------//
+
+//! Number of cells along each axis that are merged into one cell of the
+//! next coarser level of a sparse occupancy pyramid
+const int k_occupancyFactor = 4;
+
+//----------------------------------------------------------------------------//
+
+//! Number of blocks that may wait for the prefetcher. Kept short, since 
+//! blocks that rays requested long ago are unlikely to still be useful.
+const size_t k_maxQueuedBlocks = 256;
+
+//----------------------------------------------------------------------------//
+
+//! Holds, along each axis, the range [lo, hi) of voxels in a mip level 
+//! whose centers fall within each voxel of the next coarser level.
+struct MipRanges
+{
+  MipRanges(const Imath::V3i &fineRes, const Imath::V3i &coarseRes)
+  {
+    for (int axis = 0; axis < 3; ++axis) {
+      const double ratio = 
+        static_cast<double>(fineRes[axis]) / coarseRes[axis];
+      lo[axis].resize(coarseRes[axis]);
+      hi[axis].resize(coarseRes[axis]);
+      for (int c = 0; c < coarseRes[axis]; ++c) {
+        lo[axis][c] = 
+          Imath::clamp(static_cast<int>(std::ceil(c * ratio - 0.5)), 
+                       0, fineRes[axis] - 1);
+        hi[axis][c] = 
+          Imath::clamp(static_cast<int>(std::ceil((c + 1) * ratio - 0.5)), 
+                       lo[axis][c] + 1, fineRes[axis]);
+      }
+    }
+  }
+  std::vector<int> lo[3], hi[3];
+};
+
+//----------------------------------------------------------------------------//
+
+//! Computes the voxels in [begin, end) of a mip level as the average of 
+//! the voxels of the finer level that they cover. Indices are relative to
+//! the data windows. Voxels that average to zero aren't written, so that
+//! sparse blocks stay unallocated.
+template <typename Fine_T, typename Coarse_T>
+void downsampleVoxels(const Fine_T &fine, const MipRanges &ranges,
+                      const Imath::V3i &begin, const Imath::V3i &end,
+                      Coarse_T &coarse)
+{
+  const Imath::V3i fineOrigin   = fine.dataWindow().min;
+  const Imath::V3i coarseOrigin = coarse.dataWindow().min;
+  for (int k = begin.z; k < end.z; ++k) {
+    for (int j = begin.y; j < end.y; ++j) {
+      for (int i = begin.x; i < end.x; ++i) {
+        Imath::V3f sum(0.0);
+        int        count = 0;
+        for (int fk = ranges.lo[2][k]; fk < ranges.hi[2][k]; ++fk) {
+          for (int fj = ranges.lo[1][j]; fj < ranges.hi[1][j]; ++fj) {
+            for (int fi = ranges.lo[0][i]; fi < ranges.hi[0][i]; ++fi) {
+              sum += fine.fastValue(fineOrigin.x + fi, fineOrigin.y + fj,
+                                    fineOrigin.z + fk);
+              count++;
+            }
+          }
+        }
+        if (sum != Imath::V3f(0.0)) {
+          coarse.fastLValue(coarseOrigin.x + i, coarseOrigin.y + j, 
+                            coarseOrigin.z + k) = sum / count;
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Downsamples a sparse buffer block by block. Blocks that only cover
+//! unallocated blocks with the same empty value in the finer level are 
+//! left unallocated.
+void downsampleSparse(const pvr::SparseBuffer &fine, const MipRanges &ranges,
+                      pvr::SparseBuffer &coarse)
+{
+  using Imath::V3i;
+  const int fineOrder = fine.blockOrder();
+  const int bs        = coarse.blockSize();
+  const V3i bRes      = coarse.blockRes();
+  const V3i res       = coarse.dataResolution();
+  for (int bk = 0; bk < bRes.z; ++bk) {
+    for (int bj = 0; bj < bRes.y; ++bj) {
+      for (int bi = 0; bi < bRes.x; ++bi) {
+        const V3i begin(bi * bs, bj * bs, bk * bs);
+        const V3i end(std::min(begin.x + bs, res.x), 
+                      std::min(begin.y + bs, res.y),
+                      std::min(begin.z + bs, res.z));
+        // Blocks of the finer level that are covered
+        const V3i fb0(ranges.lo[0][begin.x] >> fineOrder,
+                      ranges.lo[1][begin.y] >> fineOrder,
+                      ranges.lo[2][begin.z] >> fineOrder);
+        const V3i fb1((ranges.hi[0][end.x - 1] - 1) >> fineOrder,
+                      (ranges.hi[1][end.y - 1] - 1) >> fineOrder,
+                      (ranges.hi[2][end.z - 1] - 1) >> fineOrder);
+        const Imath::V3f emptyValue = 
+          fine.getBlockEmptyValue(fb0.x, fb0.y, fb0.z);
+        bool isEmpty = true;
+        for (int k = fb0.z; k <= fb1.z && isEmpty; ++k) {
+          for (int j = fb0.y; j <= fb1.y && isEmpty; ++j) {
+            for (int i = fb0.x; i <= fb1.x && isEmpty; ++i) {
+              isEmpty = !fine.blockIsAllocated(i, j, k) && 
+                fine.getBlockEmptyValue(i, j, k) == emptyValue;
+            }
+          }
+        }
+        if (!isEmpty) {
+          downsampleVoxels(fine, ranges, begin, end, coarse);
+        } else if (emptyValue != Imath::V3f(0.0)) {
+          coarse.setBlockEmptyValue(bi, bj, bk, emptyValue);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Builds the next coarser mip level of a dense or sparse buffer, with 
+//! half the resolution (rounded up) and the same local space. Returns a 
+//! null pointer for other buffer types.
+pvr::VoxelBuffer::Ptr downsample(pvr::VoxelBuffer::Ptr fine)
+{
+  using namespace pvr;
+  using Field3D::field_dynamic_cast;
+
+  const Imath::V3i fineRes = fine->dataResolution();
+  const Imath::V3i res(std::max((fineRes.x + 1) / 2, 1),
+                       std::max((fineRes.y + 1) / 2, 1),
+                       std::max((fineRes.z + 1) / 2, 1));
+  const MipRanges  ranges(fineRes, res);
+
+  DenseBuffer::Ptr  fineDense  = field_dynamic_cast<DenseBuffer>(fine);
+  SparseBuffer::Ptr fineSparse = field_dynamic_cast<SparseBuffer>(fine);
+
+  if (fineDense) {
+    DenseBuffer::Ptr coarse(new DenseBuffer);
+    coarse->setSize(res);
+    coarse->setMapping(fine->mapping()->clone());
+    coarse->clear(Imath::V3f(0.0));
+    downsampleVoxels(*fineDense, ranges, Imath::V3i(0), res, *coarse);
+    return coarse;
+  }
+  if (fineSparse) {
+    SparseBuffer::Ptr coarse(new SparseBuffer);
+    coarse->setBlockOrder(fineSparse->blockOrder());
+    coarse->setSize(res);
+    coarse->setMapping(fine->mapping()->clone());
+    coarse->clear(Imath::V3f(0.0));
+    downsampleSparse(*fineSparse, ranges, *coarse);
+    return coarse;
+  }
+  return VoxelBuffer::Ptr();
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the block size of a sparse buffer of any supported storage 
+//! type, or zero if the buffer isn't sparse. The leaves of tree buffers 
+//! count as blocks.
+int sparseBlockSize(Field3D::FieldRes::Ptr buffer)
+{
+  using namespace pvr;
+  using Field3D::field_dynamic_cast;
+
+  if (field_dynamic_cast<TreeBuffer>(buffer)) {
+    return TreeBuffer::leafSize();
+  }
+  if (SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer)) {
+    return sparse->blockSize();
+  }
+  if (HalfSparseBuffer::Ptr sparse = 
+      field_dynamic_cast<HalfSparseBuffer>(buffer)) {
+    return sparse->blockSize();
+  }
+  if (ScalarSparseBuffer::Ptr sparse = 
+      field_dynamic_cast<ScalarSparseBuffer>(buffer)) {
+    return sparse->blockSize();
+  }
+  if (HalfScalarSparseBuffer::Ptr sparse = 
+      field_dynamic_cast<HalfScalarSparseBuffer>(buffer)) {
+    return sparse->blockSize();
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether downsample() and the level of detail lookups can handle
+//! a buffer. Warns, using feature as the subject, if not.
+bool canDownsample(Field3D::FieldRes::Ptr buffer, const std::string &feature)
+{
+  using namespace pvr;
+  using namespace pvr::Util;
+  using namespace Field3D;
+
+  // Frustum buffers already match the camera's pixel footprint, and the 
+  // level selection assumes constant voxel size
+  if (!field_dynamic_cast<MatrixFieldMapping>(buffer->mapping())) {
+    Log::warning("VoxelVolume: " + feature + " require a MatrixFieldMapping");
+    return false;
+  }
+  if (!field_dynamic_cast<DenseBuffer>(buffer) && 
+      !field_dynamic_cast<SparseBuffer>(buffer)) {
+    Log::warning("VoxelVolume: " + feature + 
+                 " require a full precision dense or sparse buffer");
+    return false;
+  }
+  if (buffer->dataWindow() != buffer->extents()) {
+    Log::warning("VoxelVolume: " + feature + 
+                 " require the data window to match the extents");
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the largest difference between the voxels of fine within 
+//! dvsBox and a linear interpolation of the proxy at their centers.
+template <typename Fine_T, typename Access_T>
+float proxyError(const Fine_T &fine, const Access_T &proxy, 
+                 const pvr::Vector &scale, const pvr::DiscreteBBox &dvsBox)
+{
+  using namespace pvr;
+  const Vector         origin(fine.dataWindow().min);
+  const Interp::Linear interp;
+  float                error = 0.0f;
+  for (int k = dvsBox.min.z; k <= dvsBox.max.z; ++k) {
+    for (int j = dvsBox.min.y; j <= dvsBox.max.y; ++j) {
+      for (int i = dvsBox.min.x; i <= dvsBox.max.x; ++i) {
+        const Vector vsP = (Vector(i, j, k) + Vector(0.5) - origin) * scale;
+        const Imath::V3f diff = 
+          fine.fastValue(i, j, k) - interp.sample(proxy, vsP);
+        error = std::max(error, Math::max(Math::abs(diff)));
+      }
+    }
+  }
+  return error;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Distance between the points that a frustum mapping's voxel space ray
+//! is fitted to, as a fraction of the size of the volume.
+const double k_frustumFitDistance = 0.1;
+
+//! Largest voxel space error allowed in a frustum mapping's voxel space
+//! ray. Rays with larger errors are transformed point by point.
+const double k_frustumFitTolerance = 1e-4;
+
+//----------------------------------------------------------------------------//
+
+//! Number of voxels on each side of a lookup point that the widest 
+//! interpolator (Gaussian, Mitchell and cubic) reads from
+const int k_interpSupport = 2;
+
+//! Number of voxels along each edge of a macrocell, for dense buffers. 
+//! Sparse buffers use their block size.
+const int k_macrocellSize = 8;
+
+//----------------------------------------------------------------------------//
+
+//! Returns the macrocell range [lo, hi] that reads each voxel along an axis,
+//! taking the interpolation support into account.
+void macrocellRange(const int numVoxels, const int cellSize, const int numCells,
+                    std::vector<int> &lo, std::vector<int> &hi)
+{
+  lo.resize(numVoxels);
+  hi.resize(numVoxels);
+  for (int v = 0; v < numVoxels; ++v) {
+    lo[v] = std::max(v - k_interpSupport, 0) / cellSize;
+    hi[v] = std::min((v + k_interpSupport) / cellSize, numCells - 1);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Merges consecutive parts of a ray with the same macrocell type into 
+//! intervals. Empty runs are left out.
+class RunBuilder
+{
+public:
+  typedef pvr::Render::MacrocellGrid MacrocellGrid;
+  RunBuilder(const double stepLength, pvr::IntervalVec &result)
+    : m_stepLength(stepLength), m_result(result), m_isOpen(false)
+  { }
+  ~RunBuilder()
+  { flush(); }
+  //! Adds a part of the ray, which must start where the last one ended
+  void add(const double t0, const double t1, 
+           const MacrocellGrid::CellType type, const Imath::V3f &value)
+  {
+    if (m_isOpen && type == m_type && 
+        (type != MacrocellGrid::HomogeneousCell || value == m_value)) {
+      m_t1 = t1;
+      return;
+    }
+    flush();
+    m_isOpen = true;
+    m_t0     = t0;
+    m_t1     = t1;
+    m_type   = type;
+    m_value  = value;
+  }
+  //! Outputs the current run, if it isn't empty
+  void flush()
+  {
+    if (m_isOpen && m_type != MacrocellGrid::EmptyCell && m_t1 > m_t0) {
+      const bool isHomogeneous = m_type == MacrocellGrid::HomogeneousCell;
+      m_result.push_back(pvr::Interval(m_t0, m_t1, m_stepLength, 
+                                       isHomogeneous));
+    }
+    m_isOpen = false;
+  }
+private:
+  const double              m_stepLength;
+  pvr::IntervalVec         &m_result;
+  bool                      m_isOpen;
+  double                    m_t0, m_t1;
+  MacrocellGrid::CellType   m_type;
+  Imath::V3f                m_value;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Steps through the cells of a regular grid in the order that a straight
+//! voxel space ray passes through them. Based on "A Fast Voxel Traversal 
+//! Algorithm for Ray Tracing", John Amanatides, Andrew Woo.
+class GridWalker
+{
+public:
+  //! The ray passes through vsP0 at parameter t0, and moves vsDir per 
+  //! unit of t. Cells are cellSize voxels wide, with cell (0, 0, 0) 
+  //! starting at origin. Walking stops when the ray leaves the cells
+  //! [minCell, maxCell], and the first cell is clamped to them.
+  GridWalker(const pvr::Vector &vsP0, const pvr::Vector &vsDir, 
+             const double t0, const pvr::Vector &origin, const int cellSize,
+             const Imath::V3i &minCell, const Imath::V3i &maxCell)
+    : m_minCell(minCell), m_maxCell(maxCell)
+  {
+    for (int axis = 0; axis < 3; ++axis) {
+      const double dir = vsDir[axis];
+      m_cell[axis] = Imath::clamp
+        (static_cast<int>(std::floor((vsP0[axis] - origin[axis]) / 
+                                     cellSize)),
+         minCell[axis], maxCell[axis]);
+      m_sgn[axis] = sign(dir);
+      if (m_sgn[axis] != 0) {
+        const double boundary = origin[axis] + 
+          (m_cell[axis] + (m_sgn[axis] > 0 ? 1 : 0)) * cellSize;
+        m_tMax[axis]   = t0 + (boundary - vsP0[axis]) / dir;
+        m_tDelta[axis] = cellSize / std::abs(dir);
+      } else {
+        m_tMax[axis]   = std::numeric_limits<double>::max();
+        m_tDelta[axis] = std::numeric_limits<double>::max();
+      }
+    }
+  }
+  //! Current cell
+  const Imath::V3i& cell() const
+  { return m_cell; }
+  //! Parameter at which the ray leaves the current cell
+  double tExit() const
+  { return std::min(std::min(m_tMax.x, m_tMax.y), m_tMax.z); }
+  //! Moves to the next cell. Returns false if the ray left the grid.
+  bool step()
+  {
+    stepToNextBlock(m_tDelta, m_sgn, m_tMax, m_cell.x, m_cell.y, m_cell.z);
+    return m_cell.x >= m_minCell.x && m_cell.x <= m_maxCell.x &&
+      m_cell.y >= m_minCell.y && m_cell.y <= m_maxCell.y &&
+      m_cell.z >= m_minCell.z && m_cell.z <= m_maxCell.z;
+  }
+private:
+  const Imath::V3i m_minCell, m_maxCell;
+  Imath::V3i       m_cell, m_sgn;
+  pvr::Vector      m_tMax, m_tDelta;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Maps a parameter s along the voxel space image of a ray segment back 
+//! to the parameter u in [0, 1] along the segment. Perspective mappings 
+//! relate them through s = u / (u + w (1 - u)), for some w > 0.
+double unprojectParameter(const double s, const double w)
+{
+  return w * s / (1.0 - s + w * s);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Finds the voxel space image of the ray segment [t0, t1] under a frustum
+//! mapping, which is the straight segment from vsA to vsA + vsDir if the z
+//! distribution is perspective. Its parameter s runs from 0 to 1, and 
+//! relates to the ray parameter through unprojectParameter(), with w 
+//! found from the midpoint. Returns false for other z distributions and 
+//! degenerate segments.
+bool perspectiveSegment(const Field3D::FrustumFieldMapping &mapping,
+                        const pvr::Render::RayState &state, 
+                        const double t0, const double t1,
+                        pvr::Vector &vsA, pvr::Vector &vsDir, double &w)
+{
+  using namespace pvr;
+  using Field3D::FrustumFieldMapping;
+
+  // Straight lines only stay straight in voxel space if the z 
+  // distribution is perspective
+  if (mapping.zDistribution() != 
+      FrustumFieldMapping::PerspectiveDistribution || !(t1 > t0)) {
+    return false;
+  }
+
+  Vector vsB, vsMid;
+  mapping.worldToVoxel(state.wsRay(t0), vsA, state.time);
+  mapping.worldToVoxel(state.wsRay(t1), vsB, state.time);
+  mapping.worldToVoxel(state.wsRay((t0 + t1) * 0.5), vsMid, state.time);
+
+  vsDir = vsB - vsA;
+  const double length2 = vsDir.length2();
+  if (!(length2 > 0.0)) {
+    return false;
+  }
+  const double sMid = (vsMid - vsA).dot(vsDir) / length2;
+  if (!(sMid > 0.0 && sMid < 1.0)) {
+    return false;
+  }
+  w = 1.0 / sMid - 1.0;
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Appends [t0, t1] to the intervals, extending the last one if they
+//! touch.
+void appendRun(pvr::IntervalVec &result, const double t0, const double t1,
+               const double stepLength)
+{
+  if (!result.empty() && result.back().t1 >= t0) {
+    result.back().t1 = t1;
+  } else {
+    result.push_back(pvr::Interval(t0, t1, stepLength));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns how far interpolation may overshoot the largest voxel value in
+//! its neighborhood. Filters with negative lobes can overshoot by the sum 
+//! of their absolute weights along each axis, at most.
+float interpOvershoot(const pvr::Render::VoxelVolume::InterpType interpType)
+{
+  using pvr::Render::VoxelVolume;
+  switch (interpType) {
+  case VoxelVolume::CubicInterp:
+    // Catmull-Rom, 1.25 along each axis
+    return 1.953125f;
+  case VoxelVolume::MitchellInterp:
+    // Mitchell-Netravali with B = C = 1/3, 1.139 along each axis
+    return 1.48f;
+  default:
+    return 1.0f;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // local namespace
 
 //----------------------------------------------------------------------------//
@@ -232,132 +713,231 @@ IntervalVec FrustumMappingIntersection::intersect(const Ray &wsRay,
 }
 
 //----------------------------------------------------------------------------//
-// SparseUniformOptimizer
+// SparseBlockPrefetcher
 //----------------------------------------------------------------------------//
 
-SparseUniformOptimizer::SparseUniformOptimizer
-(SparseBuffer::Ptr sparse, 
- Field3D::MatrixFieldMapping::Ptr mapping)
-  : m_sparse(sparse), m_mapping(mapping)
-{ 
+SparseBlockPrefetcher::SparseBlockPrefetcher(SparseBuffer::Ptr sparse, 
+                                             const size_t maxQueued)
+  : m_sparse(sparse), m_maxQueued(maxQueued), 
+    m_isQueued(sparse->blockRes().x * sparse->blockRes().y * 
+               sparse->blockRes().z, false),
+    m_stop(false),
+    m_thread(boost::bind(&SparseBlockPrefetcher::run, this))
+{
 
 }
 
 //----------------------------------------------------------------------------//
 
-IntervalVec
-SparseUniformOptimizer::optimize(const RayState &state, 
-                                 const IntervalVec &intervals) const
+SparseBlockPrefetcher::~SparseBlockPrefetcher()
 {
-  if (intervals.size() != 1) {
-    return intervals;
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stop = true;
   }
+  m_cond.notify_one();
+  m_thread.join();
+}
 
-  IntervalVec result;
-
-  const Ray &wsRay = state.wsRay;
-  const PTime &time = state.time;
+//----------------------------------------------------------------------------//
 
-  // Find start voxel
-  Vector wsStart = wsRay(intervals[0].t0), vsStart;
-  m_sparse->mapping()->worldToVoxel(wsStart, vsStart, time);
-  V3i in = Imath::clip(V3i(vsStart), m_sparse->extents());
+void SparseBlockPrefetcher::prefetch(const BlockVec &blocks) const
+{
+  if (blocks.empty()) {
+    return;
+  }
 
-  // Find start block
-  V3i bStart;
-  m_sparse->getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
+  const V3i res      = m_sparse->blockRes();
+  bool      didQueue = false;
 
-  // Transform ray to block space
-  Ray bsRay;
-  worldToBlock(m_mapping, m_sparse->blockSize(), wsRay, bsRay);
-  
-  // Find runs along ray ---
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    BOOST_FOREACH (const V3i &block, blocks) {
+      if (m_queue.size() >= m_maxQueued) {
+        break;
+      }
+      const int index = (block.z * res.y + block.y) * res.x + block.x;
+      if (!m_isQueued[index]) {
+        m_queue.push_back(block);
+        m_isQueued[index] = true;
+        didQueue          = true;
+      }
+    }
+  }
+  if (didQueue) {
+    m_cond.notify_one();
+  }
+}
 
-  // Implementation is based on:
-  // "A Fast Voxel Traversal Algorithm for Ray Tracing"
-  // John Amanatides, Andrew Woo
-  // http://www.cse.yorku.ca/~amana/research/grid.pdf
+//----------------------------------------------------------------------------//
 
-  // Current block
-  int x = bStart.x, y = bStart.y, z = bStart.z;
-  // Direction to step
-  V3i sgn(sign(bsRay.dir.x), sign(bsRay.dir.y), sign(bsRay.dir.z));
-  // Whether to look at positive or negative side of block
-  Vector cell(x + (sgn.x > 0 ? 1 : 0), 
-              y + (sgn.y > 0 ? 1 : 0), 
-              z + (sgn.z > 0 ? 1 : 0));
-  // Distance we could step in each direction, at most
-  Vector tMax((cell - bsRay.pos) / bsRay.dir);
-  // Size of one step in each dimension
-  Vector tDelta(sgn.x / bsRay.dir.x, sgn.y / bsRay.dir.y, sgn.z / bsRay.dir.z);
-  // Ensure there are no inf's or nan's
-  handleNaN(tMax);
-  handleNaN(tDelta);
-  // Check if first block starts a run
-  bool run = m_sparse->blockIsAllocated(x, y, z);
-  // Keep track of start-of-run and last visited block
-  V3i last(bStart), startRun(bStart);
+void SparseBlockPrefetcher::run()
+{
+  const V3i origin    = m_sparse->dataWindow().min;
+  const V3i res       = m_sparse->blockRes();
+  const int blockSize = m_sparse->blockSize();
 
-  // Traverse blocks
-  while (m_sparse->blockIndexIsValid(x, y, z)) {
-    if (m_sparse->blockIsAllocated(x, y, z)) {
-      if (!run) {
-        startRun = V3i(x, y, z);
-        run = true;
+  while (true) {
+    V3i block;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (m_queue.empty() && !m_stop) {
+        m_cond.wait(lock);
       }
-    } else {
-      if (run) {
-        result.push_back(intervalForRun(wsRay, time, startRun, last));
-        run = false;
+      if (m_stop) {
+        return;
       }
+      block = m_queue.front();
+      m_queue.pop_front();
+      m_isQueued[(block.z * res.y + block.y) * res.x + block.x] = false;
     }
-    last = V3i(x, y, z);    
-    stepToNextBlock(tDelta, sgn, tMax, x, y, z);
+    // Reading any voxel loads the whole block
+    const V3i voxel = origin + block * blockSize;
+    m_sparse->fastValue(voxel.x, voxel.y, voxel.z);
   }
+}
 
-  if (run) {
-    result.push_back(intervalForRun(wsRay, time, startRun, last));
-  }
+//----------------------------------------------------------------------------//
+// SparseUniformOptimizer
+//----------------------------------------------------------------------------//
 
-  return result;
+SparseUniformOptimizer::SparseUniformOptimizer
+(SparseBuffer::Ptr sparse, 
+ Field3D::MatrixFieldMapping::Ptr mapping,
+ SparseBlockPrefetcher::CPtr prefetcher)
+  : m_sparse(sparse), m_mapping(mapping), m_prefetcher(prefetcher),
+    m_origin(sparse->dataWindow().min)
+{ 
+  // Level 0 holds the blocks. Unallocated blocks with a non-zero empty 
+  // value count as occupied.
+  OccupancyLevel blocks;
+  blocks.res      = m_sparse->blockRes();
+  blocks.cellSize = m_sparse->blockSize();
+  blocks.isOccupied.reserve(blocks.res.x * blocks.res.y * blocks.res.z);
+  for (int k = 0; k < blocks.res.z; ++k) {
+    for (int j = 0; j < blocks.res.y; ++j) {
+      for (int i = 0; i < blocks.res.x; ++i) {
+        blocks.isOccupied.push_back
+          (m_sparse->blockIsAllocated(i, j, k) ||
+           m_sparse->getBlockEmptyValue(i, j, k) != V3f(0.0));
+      }
+    }
+  }
+  m_levels.push_back(blocks);
+
+  // Each coarser level is occupied wherever any of its finer cells are
+  while (Math::max(m_levels.back().res) > k_occupancyFactor) {
+    const OccupancyLevel &fine = m_levels.back();
+    const int             f    = k_occupancyFactor;
+    OccupancyLevel        coarse;
+    coarse.res      = (fine.res + V3i(f - 1)) / f;
+    coarse.cellSize = fine.cellSize * f;
+    coarse.isOccupied.resize(coarse.res.x * coarse.res.y * coarse.res.z, 
+                             false);
+    for (int k = 0; k < fine.res.z; ++k) {
+      for (int j = 0; j < fine.res.y; ++j) {
+        for (int i = 0; i < fine.res.x; ++i) {
+          if (fine.occupied(V3i(i, j, k))) {
+            coarse.isOccupied[coarse.index(V3i(i / f, j / f, k / f))] = true;
+          }
+        }
+      }
+    }
+    m_levels.push_back(coarse);
+  }
 }
 
 //----------------------------------------------------------------------------//
 
-Interval
-SparseUniformOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
-                                       const Imath::V3i &start, 
-                                       const Imath::V3i &end) const
+IntervalVec
+SparseUniformOptimizer::optimize(const RayState &state, 
+                                 const IntervalVec &intervals) const
 {
-  double t0, t1, intT0, intT1;
-  intersect(wsRay, time, start, t0, t1);
-  intT0 = std::min(t0, t1);
-  intersect(wsRay, time, end, t0, t1);
-  intT1 = std::max(t0, t1);
-  return makeInterval(wsRay, intT0, intT1, m_sparse->mapping());
+  if (intervals.size() != 1) {
+    return intervals;
+  }
+
+  const double t0 = intervals[0].t0, t1 = intervals[0].t1;
+
+  if (!(t1 > t0)) {
+    return intervals;
+  }
+
+  // The ray is transformed to voxel space once. The mapping is linear, 
+  // so the voxel space ray can be found from its end points, which also 
+  // accounts for motion. 
+  Vector vsP0, vsP1;
+  m_mapping->worldToVoxel(state.wsRay(t0), vsP0, state.time);
+  m_mapping->worldToVoxel(state.wsRay(t1), vsP1, state.time);
+  const Vector vsDir = (vsP1 - vsP0) / (t1 - t0);
+
+  // For the same reason, one voxel along the ray is the same length
+  // everywhere
+  const double vsSpeed = vsDir.length();
+  if (!(vsSpeed > 0.0)) {
+    return intervals;
+  }
+
+  IntervalVec                     result;
+  SparseBlockPrefetcher::BlockVec prefetch;
+  double                          t   = t0;
+  const V3i                      &res = m_levels.back().res;
+  walk(m_levels.size() - 1, V3i(0), res - V3i(1), vsP0, vsDir, t0, 
+       1.0 / vsSpeed, t, t1, result, prefetch);
+
+  if (m_prefetcher) {
+    m_prefetcher->prefetch(prefetch);
+  }
+
+  return result;
 }
 
 //----------------------------------------------------------------------------//
 
-//! \note worldToLocalDir does not yet take a time argument.
-void
-SparseUniformOptimizer::intersect(const Ray &wsRay, const PTime time, 
-                                  const Imath::V3i block,
-                                  double &t0, double &t1) const
+void SparseUniformOptimizer::walk(const size_t level, const V3i &minCell,
+                                  const V3i &maxCell, const Vector &vsP0,
+                                  const Vector &vsDir, const double t0,
+                                  const double stepLength, double &t, 
+                                  const double tEnd, 
+                                  IntervalVec &result,
+                                  SparseBlockPrefetcher::BlockVec &prefetch)
+  const
 {
-  // Transform to local space
-  Ray lsRay;
-  m_mapping->worldToLocal(wsRay.pos, lsRay.pos, time);
-  m_mapping->worldToLocalDir(wsRay.dir, lsRay.dir);
-  // Intersect in local space
-  Imath::Box3i box;
-  int blockSz = m_sparse->blockSize();
-  box.min = V3i(block.x * blockSz, block.y * blockSz, block.z * blockSz);
-  box.max = box.min + V3i(blockSz - 1, blockSz - 1, blockSz - 1);
-  BBox vsBox(box.min, box.max + V3i(1)), lsBox;
-  m_mapping->voxelToLocal(vsBox.min, lsBox.min);
-  m_mapping->voxelToLocal(vsBox.max, lsBox.max);
-  Math::intersect(lsRay, lsBox, t0, t1);
+  const OccupancyLevel &grid = m_levels[level];
+  GridWalker cells(vsP0 + vsDir * (t - t0), vsDir, t, m_origin, 
+                   grid.cellSize, minCell, maxCell);
+
+  while (t < tEnd) {
+    const V3i   &cell  = cells.cell();
+    const double tExit = std::min(cells.tExit(), tEnd);
+    if (tExit > t && grid.occupied(cell)) {
+      if (level == 0) {
+        if (m_prefetcher && m_sparse->blockIsAllocated(cell.x, cell.y, 
+                                                       cell.z)) {
+          prefetch.push_back(cell);
+        }
+        appendRun(result, t, tExit, stepLength);
+      } else {
+        // Descend into the finer cells covered by this one
+        const int f    = k_occupancyFactor;
+        const V3i last = m_levels[level - 1].res - V3i(1);
+        walk(level - 1, cell * f, 
+             V3i(std::min(cell.x * f + f - 1, last.x),
+                 std::min(cell.y * f + f - 1, last.y),
+                 std::min(cell.z * f + f - 1, last.z)),
+             vsP0, vsDir, t0, stepLength, t, tExit, result, prefetch);
+        // Numerical error may leave a sliver at the end of the cell. Keep
+        // it, rather than risk skipping contents.
+        if (t < tExit) {
+          appendRun(result, t, tExit, stepLength);
+        }
+      }
+    }
+    t = std::max(t, tExit);
+    if (!cells.step()) {
+      break;
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -366,8 +946,9 @@ SparseUniformOptimizer::intersect(const Ray &wsRay, const PTime time,
 
 SparseFrustumOptimizer::SparseFrustumOptimizer
 (SparseBuffer::Ptr sparse, 
- Field3D::FrustumFieldMapping::Ptr mapping)
-  : m_sparse(sparse), m_mapping(mapping)
+ Field3D::FrustumFieldMapping::Ptr mapping,
+ SparseBlockPrefetcher::CPtr prefetcher)
+  : m_sparse(sparse), m_mapping(mapping), m_prefetcher(prefetcher)
 { 
 
 }
@@ -382,11 +963,6 @@ SparseFrustumOptimizer::optimize(const RayState &state,
     return intervals;
   }
 
-  if (state.rayType != RayState::FullRaymarch ||
-      state.rayDepth != 0) {
-    return intervals;
-  }
-
   IntervalVec result;
   const Ray &wsRay = state.wsRay;
   const PTime &time = state.time;
@@ -403,9 +979,11 @@ SparseFrustumOptimizer::optimize(const RayState &state,
   m_sparse->getBlockCoord(in.x, in.y, in.z, bStart.x, bStart.y, bStart.z);
   m_sparse->getBlockCoord(out.x, out.y, out.z, bEnd.x, bEnd.y, bEnd.z);
 
-  // Ensure ray travels down z axis
-  if (bStart.x != bEnd.x || bStart.y != bEnd.y) {
-    return intervals;
+  // Camera rays stay within a single column of blocks, which is just 
+  // walked along z. All other rays get the general traversal.
+  if (state.rayType != RayState::FullRaymarch || state.rayDepth != 0 ||
+      bStart.x != bEnd.x || bStart.y != bEnd.y) {
+    return traverse(state, intervals[0]);
   }
 
   // Current block
@@ -414,10 +992,15 @@ SparseFrustumOptimizer::optimize(const RayState &state,
   bool run = m_sparse->blockIsAllocated(x, y, z);
   // Keep track of start-of-run and last visited block
   int startRun = z, last = z;
+  // Allocated blocks, handed to the prefetcher at the end
+  SparseBlockPrefetcher::BlockVec prefetch;
 
   // Traverse row of blocks
   for (; z <= bEnd.z; z++) {
     if (m_sparse->blockIsAllocated(x, y, z)) {
+      if (m_prefetcher) {
+        prefetch.push_back(V3i(x, y, z));
+      }
       if (!run) {
         startRun = z;
         run = true;
@@ -435,18 +1018,91 @@ SparseFrustumOptimizer::optimize(const RayState &state,
     result.push_back(intervalForRun(wsRay, time, vsStart, startRun, last));
   }
 
+  if (m_prefetcher) {
+    m_prefetcher->prefetch(prefetch);
+  }
+
   return result;
 }
 
 //----------------------------------------------------------------------------//
 
-Interval 
-SparseFrustumOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
-                                       const Vector &vsFirst, 
-                                       const int start, const int end) const
+IntervalVec
+SparseFrustumOptimizer::traverse(const RayState &state, 
+                                 const Interval &interval) const
 {
-  double vsStartZ = start * m_sparse->blockSize();
-  double vsEndZ = (end + 1) * m_sparse->blockSize();
+  const double t0 = interval.t0, t1 = interval.t1;
+
+  Vector vsA, vsDir;
+  double w;
+  if (!perspectiveSegment(*m_mapping, state, t0, t1, vsA, vsDir, w)) {
+    return IntervalVec(1, interval);
+  }
+
+  // Walk the blocks along the segment ---
+
+  IntervalVec result;
+  GridWalker  blocks(vsA, vsDir, 0.0, Vector(m_sparse->dataWindow().min), 
+                     m_sparse->blockSize(), V3i(0), 
+                     m_sparse->blockRes() - V3i(1));
+  double      s        = 0.0;
+  double      runStart = 0.0;
+  bool        run      = false;
+  // Allocated blocks, handed to the prefetcher at the end
+  SparseBlockPrefetcher::BlockVec prefetch;
+
+  while (s < 1.0) {
+    const V3i   &b     = blocks.cell();
+    const double sExit = std::min(blocks.tExit(), 1.0);
+    if (sExit > s) {
+      const bool isAllocated = m_sparse->blockIsAllocated(b.x, b.y, b.z);
+      const bool isOccupied  = isAllocated || 
+        m_sparse->getBlockEmptyValue(b.x, b.y, b.z) != V3f(0.0);
+      if (isAllocated && m_prefetcher) {
+        prefetch.push_back(b);
+      }
+      if (isOccupied && !run) {
+        runStart = s;
+        run      = true;
+      } else if (!isOccupied && run) {
+        result.push_back
+          (makeInterval(state.wsRay, 
+                        t0 + unprojectParameter(runStart, w) * (t1 - t0),
+                        t0 + unprojectParameter(s, w) * (t1 - t0),
+                        m_mapping));
+        run = false;
+      }
+      s = sExit;
+    }
+    if (!blocks.step()) {
+      break;
+    }
+  }
+
+  if (run) {
+    result.push_back
+      (makeInterval(state.wsRay, 
+                    t0 + unprojectParameter(runStart, w) * (t1 - t0),
+                    t0 + unprojectParameter(s, w) * (t1 - t0),
+                    m_mapping));
+  }
+
+  if (m_prefetcher) {
+    m_prefetcher->prefetch(prefetch);
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+Interval 
+SparseFrustumOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
+                                       const Vector &vsFirst, 
+                                       const int start, const int end) const
+{
+  double vsStartZ = start * m_sparse->blockSize();
+  double vsEndZ = (end + 1) * m_sparse->blockSize();
   Vector vsStart(vsFirst.x, vsFirst.y, vsStartZ);
   Vector vsEnd(vsFirst.x, vsFirst.y, vsEndZ);
   Vector wsStart, wsEnd;
@@ -457,77 +1113,1202 @@ SparseFrustumOptimizer::intervalForRun(const Ray &wsRay, const PTime time,
   return makeInterval(wsRay, t0, t1, m_mapping);
 }
 
+//----------------------------------------------------------------------------//
+// TreeOptimizer
+//----------------------------------------------------------------------------//
+
+TreeOptimizer::TreeOptimizer(TreeBuffer::Ptr tree, 
+                             Field3D::MatrixFieldMapping::Ptr mapping)
+  : m_tree(tree), m_mapping(mapping)
+{ 
+
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec TreeOptimizer::optimize(const RayState &state, 
+                                    const IntervalVec &intervals) const
+{
+  if (intervals.size() != 1) {
+    return intervals;
+  }
+
+  const Interval &interval = intervals[0];
+  const double    t0       = interval.t0, t1 = interval.t1;
+
+  if (!(t1 > t0)) {
+    return intervals;
+  }
+
+  // The mapping is linear, so the voxel space ray can be found from its 
+  // end points. This also accounts for motion.
+  Vector vsP0, vsP1;
+  m_mapping->worldToVoxel(state.wsRay(t0), vsP0, state.time);
+  m_mapping->worldToVoxel(state.wsRay(t1), vsP1, state.time);
+  const Vector vsDir = (vsP1 - vsP0) / (t1 - t0);
+
+  const TreeBuffer &tree    = *m_tree;
+  const Vector      origin(tree.dataWindow().min);
+  const V3i         leafMax = tree.leafRes() - V3i(1);
+  const int         lpn     = TreeBuffer::leavesPerNode();
+
+  IntervalVec result;
+  RunBuilder  runs(interval.stepLength, result);
+  GridWalker  nodes(vsP0, vsDir, t0, origin, TreeBuffer::nodeSize(), 
+                    V3i(0), tree.rootRes() - V3i(1));
+  double      t = t0;
+
+  // Walk the root grid ---
+
+  while (t < t1) {
+    const V3i   &n     = nodes.cell();
+    const double tNode = std::min(nodes.tExit(), t1);
+    if (tNode > t && !tree.nodeIsAllocated(n.x, n.y, n.z)) {
+      // Root tiles are skipped whole
+      const bool isEmpty = tree.nodeTileValue(n.x, n.y, n.z) == V3f(0.0);
+      runs.add(t, tNode, isEmpty ? MacrocellGrid::EmptyCell : 
+               MacrocellGrid::VaryingCell, V3f(0.0));
+      t = tNode;
+    } else if (tNode > t) {
+      // Walk the leaves of the node ---
+      const V3i  first = n * lpn;
+      const V3i  last(std::min(first.x + lpn - 1, leafMax.x),
+                      std::min(first.y + lpn - 1, leafMax.y),
+                      std::min(first.z + lpn - 1, leafMax.z));
+      GridWalker leaves(vsP0 + vsDir * (t - t0), vsDir, t, origin, 
+                        TreeBuffer::leafSize(), first, last);
+      while (t < tNode) {
+        const V3i   &l     = leaves.cell();
+        const double tLeaf = std::min(leaves.tExit(), tNode);
+        if (tLeaf > t) {
+          const bool isEmpty = !tree.leafIsAllocated(l.x, l.y, l.z) &&
+            tree.leafTileValue(l.x, l.y, l.z) == V3f(0.0);
+          runs.add(t, tLeaf, isEmpty ? MacrocellGrid::EmptyCell : 
+                   MacrocellGrid::VaryingCell, V3f(0.0));
+          t = tLeaf;
+        }
+        if (!leaves.step()) {
+          break;
+        }
+      }
+      // Numerical error may leave a sliver at the end of the node. Keep
+      // it, rather than risk skipping contents.
+      if (t < tNode) {
+        runs.add(t, tNode, MacrocellGrid::VaryingCell, V3f(0.0));
+        t = tNode;
+      }
+    }
+    if (!nodes.step()) {
+      if (t < t1) {
+        runs.add(t, t1, MacrocellGrid::VaryingCell, V3f(0.0));
+      }
+      break;
+    }
+  }
+
+  runs.flush();
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+// MacrocellGrid
+//----------------------------------------------------------------------------//
+
+MacrocellGrid::MacrocellGrid(FieldRes::Ptr buffer, const int cellSize)
+  : m_dataWindow(buffer->dataWindow()), m_cellSize(cellSize)
+{
+  const V3i size = m_dataWindow.size() + V3i(1);
+
+  m_res = V3i((size.x + cellSize - 1) / cellSize,
+              (size.y + cellSize - 1) / cellSize,
+              (size.z + cellSize - 1) / cellSize);
+
+  const size_t numCells = m_res.x * m_res.y * m_res.z;
+  m_min.resize(numCells, V3f(std::numeric_limits<float>::max()));
+  m_max.resize(numCells, V3f(-std::numeric_limits<float>::max()));
+
+  // Each voxel contributes to all macrocells whose lookups may read it.
+  // Away from the macrocell boundaries that's just a single macrocell.
+  std::vector<int> lo[3], hi[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    macrocellRange(size[axis], cellSize, m_res[axis], lo[axis], hi[axis]);
+  }
+
+  if (SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer)) {
+    includeSparse(*sparse, lo, hi);
+  } else if (TreeBuffer::Ptr tree = field_dynamic_cast<TreeBuffer>(buffer)) {
+    includeTree(*tree, lo, hi);
+  } else if (HalfSparseBuffer::Ptr sparse = 
+             field_dynamic_cast<HalfSparseBuffer>(buffer)) {
+    includeSparse(*sparse, lo, hi);
+  } else if (ScalarSparseBuffer::Ptr sparse = 
+             field_dynamic_cast<ScalarSparseBuffer>(buffer)) {
+    includeSparse(*sparse, lo, hi);
+  } else if (HalfScalarSparseBuffer::Ptr sparse = 
+             field_dynamic_cast<HalfScalarSparseBuffer>(buffer)) {
+    includeSparse(*sparse, lo, hi);
+  } else if (VoxelBuffer::Ptr voxels = 
+             field_dynamic_cast<VoxelBuffer>(buffer)) {
+    includeVoxels(*voxels, lo, hi);
+  } else if (HalfDenseBuffer::Ptr dense = 
+             field_dynamic_cast<HalfDenseBuffer>(buffer)) {
+    includeVoxels(*dense, lo, hi);
+  } else if (ScalarDenseBuffer::Ptr dense = 
+             field_dynamic_cast<ScalarDenseBuffer>(buffer)) {
+    includeVoxels(*dense, lo, hi);
+  } else if (HalfScalarDenseBuffer::Ptr dense = 
+             field_dynamic_cast<HalfScalarDenseBuffer>(buffer)) {
+    includeVoxels(*dense, lo, hi);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+void MacrocellGrid::includeVoxels(const Field_T &buffer, 
+                                  const std::vector<int> (&lo)[3],
+                                  const std::vector<int> (&hi)[3])
+{
+  const V3i  size   = m_dataWindow.size() + V3i(1);
+  const V3i &origin = m_dataWindow.min;
+  for (int k = 0; k < size.z; ++k) {
+    for (int j = 0; j < size.y; ++j) {
+      for (int i = 0; i < size.x; ++i) {
+        include(V3i(lo[0][i], lo[1][j], lo[2][k]),
+                V3i(hi[0][i], hi[1][j], hi[2][k]),
+                Interp::toColor(buffer.value(origin.x + i, origin.y + j, 
+                                             origin.z + k)));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void MacrocellGrid::includeSparse(const Field3D::SparseField<Data_T> &buffer,
+                                  const std::vector<int> (&lo)[3],
+                                  const std::vector<int> (&hi)[3])
+{
+  const V3i  size   = m_dataWindow.size() + V3i(1);
+  const V3i &origin = m_dataWindow.min;
+  // Unallocated blocks are constant, so they're handled as a whole
+  const int bs   = buffer.blockSize();
+  const V3i bRes = buffer.blockRes();
+  for (int bk = 0; bk < bRes.z; ++bk) {
+    for (int bj = 0; bj < bRes.y; ++bj) {
+      for (int bi = 0; bi < bRes.x; ++bi) {
+        const V3i first(bi * bs, bj * bs, bk * bs);
+        const V3i last(std::min(first.x + bs, size.x) - 1,
+                       std::min(first.y + bs, size.y) - 1,
+                       std::min(first.z + bs, size.z) - 1);
+        if (!buffer.blockIsAllocated(bi, bj, bk)) {
+          includeConstant(first, last, lo, hi, 
+                          Interp::toColor(buffer.getBlockEmptyValue(bi, bj, 
+                                                                    bk)));
+          continue;
+        }
+        for (int k = first.z; k <= last.z; ++k) {
+          for (int j = first.y; j <= last.y; ++j) {
+            for (int i = first.x; i <= last.x; ++i) {
+              include(V3i(lo[0][i], lo[1][j], lo[2][k]),
+                      V3i(hi[0][i], hi[1][j], hi[2][k]),
+                      Interp::toColor(buffer.fastValue(origin.x + i, 
+                                                       origin.y + j,
+                                                       origin.z + k)));
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void MacrocellGrid::includeTree(const TreeBuffer &buffer,
+                                const std::vector<int> (&lo)[3],
+                                const std::vector<int> (&hi)[3])
+{
+  const V3i  size = m_dataWindow.size() + V3i(1);
+  const int  ns   = TreeBuffer::nodeSize();
+  const int  ls   = TreeBuffer::leafSize();
+  const int  lpn  = TreeBuffer::leavesPerNode();
+  const V3i &rRes = buffer.rootRes();
+  const V3i  lRes = buffer.leafRes();
+  // Tiles are constant, so they're handled as a whole, at either level
+  for (int nk = 0; nk < rRes.z; ++nk) {
+    for (int nj = 0; nj < rRes.y; ++nj) {
+      for (int ni = 0; ni < rRes.x; ++ni) {
+        if (!buffer.nodeIsAllocated(ni, nj, nk)) {
+          const V3i first(ni * ns, nj * ns, nk * ns);
+          const V3i last(std::min(first.x + ns, size.x) - 1,
+                         std::min(first.y + ns, size.y) - 1,
+                         std::min(first.z + ns, size.z) - 1);
+          includeConstant(first, last, lo, hi, 
+                          buffer.nodeTileValue(ni, nj, nk));
+          continue;
+        }
+        const int lkEnd = std::min((nk + 1) * lpn, lRes.z);
+        const int ljEnd = std::min((nj + 1) * lpn, lRes.y);
+        const int liEnd = std::min((ni + 1) * lpn, lRes.x);
+        for (int lk = nk * lpn; lk < lkEnd; ++lk) {
+          for (int lj = nj * lpn; lj < ljEnd; ++lj) {
+            for (int li = ni * lpn; li < liEnd; ++li) {
+              const V3i first(li * ls, lj * ls, lk * ls);
+              const V3i last(std::min(first.x + ls, size.x) - 1,
+                             std::min(first.y + ls, size.y) - 1,
+                             std::min(first.z + ls, size.z) - 1);
+              const V3f *leaf = buffer.leafData(li, lj, lk);
+              if (!leaf) {
+                includeConstant(first, last, lo, hi,
+                                buffer.leafTileValue(li, lj, lk));
+                continue;
+              }
+              for (int k = first.z; k <= last.z; ++k) {
+                for (int j = first.y; j <= last.y; ++j) {
+                  const V3f *row = leaf + 
+                    ((k - first.z) * ls + (j - first.y)) * ls;
+                  for (int i = first.x; i <= last.x; ++i) {
+                    include(V3i(lo[0][i], lo[1][j], lo[2][k]),
+                            V3i(hi[0][i], hi[1][j], hi[2][k]),
+                            row[i - first.x]);
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void MacrocellGrid::includeConstant(const V3i &first, const V3i &last,
+                                    const std::vector<int> (&lo)[3],
+                                    const std::vector<int> (&hi)[3],
+                                    const V3f &value)
+{
+  include(V3i(lo[0][first.x], lo[1][first.y], lo[2][first.z]),
+          V3i(hi[0][last.x], hi[1][last.y], hi[2][last.z]),
+          value);
+}
+
+//----------------------------------------------------------------------------//
+
+void MacrocellGrid::include(const V3i &firstCell, const V3i &lastCell, 
+                            const V3f &value)
+{
+  for (int k = firstCell.z; k <= lastCell.z; ++k) {
+    for (int j = firstCell.y; j <= lastCell.y; ++j) {
+      for (int i = firstCell.x; i <= lastCell.x; ++i) {
+        const size_t idx = index(V3i(i, j, k));
+        V3f &min = m_min[idx], &max = m_max[idx];
+        min = V3f(std::min(min.x, value.x), std::min(min.y, value.y), 
+                  std::min(min.z, value.z));
+        max = Math::max(max, value);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+MacrocellGrid::CellType MacrocellGrid::cellType(const V3i &cell) const
+{
+  const size_t idx = index(cell);
+  const V3f &min = m_min[idx], &max = m_max[idx];
+  if (min == max) {
+    return min == V3f(0.0) ? EmptyCell : HomogeneousCell;
+  }
+  return VaryingCell;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f MacrocellGrid::maxAbsValue(const DiscreteBBox &dvsBounds) const
+{
+  const V3i first = cellForVoxel(discToCont(dvsBounds.min));
+  const V3i last  = cellForVoxel(discToCont(dvsBounds.max));
+  V3f result(0.0);
+  for (int k = first.z; k <= last.z; ++k) {
+    for (int j = first.y; j <= last.y; ++j) {
+      for (int i = first.x; i <= last.x; ++i) {
+        const size_t idx = index(V3i(i, j, k));
+        result = Math::max(result, Math::max(Math::abs(m_min[idx]), 
+                                             Math::abs(m_max[idx])));
+      }
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+V3i MacrocellGrid::cellForVoxel(const Vector &vsP) const
+{
+  V3i cell;
+  for (int axis = 0; axis < 3; ++axis) {
+    const double c = (vsP[axis] - m_dataWindow.min[axis]) / m_cellSize;
+    cell[axis] = Imath::clamp(static_cast<int>(std::floor(c)), 
+                              0, m_res[axis] - 1);
+  }
+  return cell;
+}
+
+//----------------------------------------------------------------------------//
+
+Vector MacrocellGrid::cellOrigin(const V3i &cell) const
+{
+  return Vector(m_dataWindow.min) + Vector(cell) * m_cellSize;
+}
+
+//----------------------------------------------------------------------------//
+// MacrocellOptimizer
+//----------------------------------------------------------------------------//
+
+MacrocellOptimizer::MacrocellOptimizer(MacrocellGrid::CPtr macrocells,
+                                       Field3D::FieldMapping::Ptr mapping)
+  : m_macrocells(macrocells), m_mapping(mapping),
+    m_frustumMapping(field_dynamic_cast<FrustumFieldMapping>(mapping)),
+    m_isUniform(field_dynamic_cast<MatrixFieldMapping>(mapping))
+{
+
+}
+
+//----------------------------------------------------------------------------//
+
+IntervalVec 
+MacrocellOptimizer::optimize(const RayState &state, 
+                             const IntervalVec &intervals) const
+{
+  IntervalVec result;
+  BOOST_FOREACH (const Interval &interval, intervals) {
+    if (m_isUniform) {
+      traverseUniform(state, interval, result);
+    } else {
+      traverseFrustum(state, interval, result);
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+void MacrocellOptimizer::traverseUniform(const RayState &state, 
+                                         const Interval &interval,
+                                         IntervalVec &result) const
+{
+  const double t0 = interval.t0, t1 = interval.t1;
+
+  if (!(t1 > t0)) {
+    return;
+  }
+
+  // The mapping is linear, so the voxel space ray can be found from its 
+  // end points. This also accounts for motion.
+  Vector vsP0, vsP1;
+  m_mapping->worldToVoxel(state.wsRay(t0), vsP0, state.time);
+  m_mapping->worldToVoxel(state.wsRay(t1), vsP1, state.time);
+  const Vector vsDir = (vsP1 - vsP0) / (t1 - t0);
+
+  // Set up traversal. Based on "A Fast Voxel Traversal Algorithm for 
+  // Ray Tracing", John Amanatides, Andrew Woo ---
+
+  const int    cellSize = m_macrocells->cellSize();
+  const V3i   &res      = m_macrocells->resolution();
+  V3i          cell     = m_macrocells->cellForVoxel(vsP0);
+  const Vector origin   = m_macrocells->cellOrigin(V3i(0));
+  V3i          sgn;
+  Vector       tMax, tDelta;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    const double dir = vsDir[axis];
+    sgn[axis] = sign(dir);
+    if (sgn[axis] != 0) {
+      const double boundary = origin[axis] + 
+        (cell[axis] + (sgn[axis] > 0 ? 1 : 0)) * cellSize;
+      tMax[axis]   = t0 + (boundary - vsP0[axis]) / dir;
+      tDelta[axis] = cellSize / std::abs(dir);
+    } else {
+      tMax[axis]   = std::numeric_limits<double>::max();
+      tDelta[axis] = std::numeric_limits<double>::max();
+    }
+  }
+
+  // Traverse macrocells ---
+
+  RunBuilder runs(interval.stepLength, result);
+  double     t = t0;
+
+  while (t < t1) {
+    const double tExit = std::min(std::min(tMax.x, tMax.y), 
+                                  std::min(tMax.z, t1));
+    if (tExit > t) {
+      runs.add(t, tExit, m_macrocells->cellType(cell), 
+               m_macrocells->minValue(cell));
+      t = tExit;
+    }
+    stepToNextBlock(tDelta, sgn, tMax, cell.x, cell.y, cell.z);
+    if (cell.x < 0 || cell.y < 0 || cell.z < 0 ||
+        cell.x >= res.x || cell.y >= res.y || cell.z >= res.z) {
+      // Numerical error may leave a sliver at the end of the interval. 
+      // Keep it, rather than risk skipping contents.
+      if (t < t1) {
+        runs.add(t, t1, MacrocellGrid::VaryingCell, V3f(0.0));
+      }
+      break;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void MacrocellOptimizer::traverseFrustum(const RayState &state, 
+                                         const Interval &interval,
+                                         IntervalVec &result) const
+{
+  const double t0 = interval.t0, t1 = interval.t1;
+
+  if (!(t1 > t0)) {
+    return;
+  }
+
+  Vector vsA, vsDir;
+  double w;
+  if (!m_frustumMapping || 
+      !perspectiveSegment(*m_frustumMapping, state, t0, t1, vsA, vsDir, w)) {
+    result.push_back(interval);
+    return;
+  }
+
+  // Walk the macrocells along the segment ---
+
+  GridWalker cells(vsA, vsDir, 0.0, m_macrocells->cellOrigin(V3i(0)),
+                   m_macrocells->cellSize(), V3i(0), 
+                   m_macrocells->resolution() - V3i(1));
+  RunBuilder runs(interval.stepLength, result);
+  double     s = 0.0;
+  double     t = t0;
+
+  while (s < 1.0) {
+    const V3i   &cell  = cells.cell();
+    const double sExit = std::min(cells.tExit(), 1.0);
+    if (sExit > s) {
+      const double tExit = t0 + unprojectParameter(sExit, w) * (t1 - t0);
+      runs.add(t, tExit, m_macrocells->cellType(cell), 
+               m_macrocells->minValue(cell));
+      s = sExit;
+      t = tExit;
+    }
+    if (!cells.step()) {
+      break;
+    }
+  }
+
+  // Numerical error may leave a sliver at the end of the interval. Keep 
+  // it, rather than risk skipping contents.
+  if (t < t1) {
+    runs.add(t, t1, MacrocellGrid::VaryingCell, V3f(0.0));
+  }
+}
+
 //----------------------------------------------------------------------------//
 // VoxelVolume
 //----------------------------------------------------------------------------//
 
-VoxelVolume::VoxelVolume()
-  : m_interpType(LinearInterp), m_useEmptySpaceOptimization(true)
-{
-  // Empty
-}
+VoxelVolume::VoxelVolume()
+  : m_extinctionValue(0.0), m_holdoutValue(0.0),
+    m_interpType(LinearInterp), m_useEmptySpaceOptimization(true),
+    m_useMipmaps(false), m_wsVoxelSize(0.0), m_useShadowProxy(false), 
+    m_shadowProxyTolerance(k_defaultShadowProxyTolerance), 
+    m_shadowProxyMaxError(0.0f), m_isStreamed(false), 
+    m_useBlockPrefetch(false)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+Volume::AttrNameVec VoxelVolume::attributeNames() const
+{
+  return m_attrNames;
+}
+
+//----------------------------------------------------------------------------//
+
+VolumeSample VoxelVolume::sample(const VolumeSampleState &state,
+                                 const VolumeAttr &attribute) const
+{
+  // Look up attribute index ---
+
+  const int index = m_attrTable.index(attribute);
+  if (index == VolumeAttr::IndexInvalid) {
+    return VolumeSample(Colors::zero(), m_phaseFunction);
+  }
+
+  return VolumeSample(m_attrValues[index] * voxelValue(state), 
+                      m_phaseFunction);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleAttributes(const VolumeSampleState &state,
+                                   const VolumeAttr *attributes,
+                                   const size_t numAttrs,
+                                   VolumeSample *samples) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  // Look up attribute indices ---
+
+  int  indices[MaxAttributes];
+  bool hasValidAttr = false;
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    indices[a] = m_attrTable.index(attributes[a]);
+    hasValidAttr |= indices[a] != VolumeAttr::IndexInvalid;
+  }
+
+  // All attributes share the same buffer, so the transform and the 
+  // interpolation only need to happen once ---
+
+  const V3f value = hasValidAttr ? voxelValue(state) : V3f(0.0);
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    if (indices[a] == VolumeAttr::IndexInvalid) {
+      samples[a] = VolumeSample(Colors::zero(), m_phaseFunction);
+    } else {
+      samples[a] = VolumeSample(m_attrValues[indices[a]] * value, 
+                                m_phaseFunction);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Access_T>
+V3f VoxelVolume::typedVoxelValue(const Access_T &access, 
+                                 const Vector &vsP) const
+{
+  switch (m_interpType) {
+  case NoInterp:
+    return Interp::Point().sample(access, vsP);
+  case CubicInterp:
+  case MonotonicCubicInterp:
+    return Interp::Cubic().sample(access, vsP);
+  case GaussianInterp:
+    return m_typedGaussInterp.sample(access, vsP);
+  case MitchellInterp:
+    return m_typedMitchellInterp.sample(access, vsP);
+  case LinearInterp:
+  default:
+    return Interp::Linear().sample(access, vsP);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Access_T>
+void VoxelVolume::typedVoxelValues(const Access_T &access, const Vector *vsP,
+                                   const bool *inBounds, const size_t size, 
+                                   V3f *values) const
+{
+  switch (m_interpType) {
+  case NoInterp:
+    interpolatePacket(Interp::Point(), access, vsP, inBounds, size, values);
+    break;
+  case CubicInterp:
+  case MonotonicCubicInterp:
+    interpolatePacket(Interp::Cubic(), access, vsP, inBounds, size, values);
+    break;
+  case GaussianInterp:
+    interpolatePacket(m_typedGaussInterp, access, vsP, inBounds, size, 
+                      values);
+    break;
+  case MitchellInterp:
+    interpolatePacket(m_typedMitchellInterp, access, vsP, inBounds, size, 
+                      values);
+    break;
+  case LinearInterp:
+  default:
+    interpolatePacket(Interp::Linear(), access, vsP, inBounds, size, values);
+    break;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::samplePacket(const VolumeSamplePacket &packet,
+                               const VolumeAttr *attributes,
+                               const size_t numAttrs,
+                               PacketValues *values,
+                               PacketWeights *phaseWeights) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  // Look up attribute indices ---
+
+  int  indices[MaxAttributes];
+  bool hasValidAttr = false;
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    indices[a] = m_attrTable.index(attributes[a]);
+    hasValidAttr |= indices[a] != VolumeAttr::IndexInvalid;
+    if (indices[a] == VolumeAttr::IndexInvalid) {
+      std::fill(values[a], values[a] + packet.size, Colors::zero());
+    }
+  }
+
+  if (!hasValidAttr) {
+    return;
+  }
+
+  // Interpolate voxel values ---
+
+  V3f value[VolumeSamplePacket::MaxSize];
+  packetVoxelValues(packet, value);
+
+  // Scale by each attribute's value ---
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    if (indices[a] == VolumeAttr::IndexInvalid) {
+      continue;
+    }
+    const V3f &attrValue = m_attrValues[indices[a]];
+    for (size_t i = 0; i < packet.size; ++i) {
+      values[a][i] = attrValue * value[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleExtinctionPacket(const VolumeSamplePacket &packet,
+                                         PacketValues &extinction,
+                                         PacketValues &holdout) const
+{
+  if (m_extinctionValue == V3f(0.0) && m_holdoutValue == V3f(0.0)) {
+    std::fill(extinction, extinction + packet.size, Colors::zero());
+    std::fill(holdout, holdout + packet.size, Colors::zero());
+    return;
+  }
+
+  V3f value[VolumeSamplePacket::MaxSize];
+  packetVoxelValues(packet, value);
+
+  for (size_t i = 0; i < packet.size; ++i) {
+    extinction[i] = m_extinctionValue * value[i];
+    holdout[i]    = m_holdoutValue * value[i];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::packetVoxelValues(const VolumeSamplePacket &packet,
+                                    V3f *value) const
+{
+  // Transform to voxel space for sampling ---
+
+  const size_t size = packet.size;
+  Vector       vsP[VolumeSamplePacket::MaxSize];
+  bool         inBounds[VolumeSamplePacket::MaxSize];
+
+  for (size_t i = 0; i < size; ++i) {
+    m_field->mapping()->worldToVoxel(packet.wsP(i), vsP[i], 
+                                     packet.rayState[i]->time);
+    inBounds[i] = Math::isInBounds(vsP[i], m_field->dataWindow());
+  }
+
+  // Interpolate ---
+
+  // Shadow rays read from the shadow proxy, and footprints that cover 
+  // several voxels from a coarser mip level. Either may differ within the
+  // packet, so those samples are done one by one.
+  double t[VolumeSamplePacket::MaxSize];
+  bool   useReducedDetail = false;
+  if (m_shadowProxy.buffer || !m_mipLevels.empty()) {
+    for (size_t i = 0; i < size; ++i) {
+      const RayState &rayState = *packet.rayState[i];
+      t[i] = (packet.wsP(i) - rayState.wsRay.pos).length();
+      useReducedDetail |= isReducedDetail(rayState, t[i]);
+    }
+  }
+
+  // The buffer and interpolation types are resolved once for the whole 
+  // packet rather than once per sample. Dense and sparse buffers are read
+  // directly, without a virtual call per tap.
+  if (useReducedDetail) {
+    for (size_t i = 0; i < size; ++i) {
+      value[i] = inBounds[i] ? 
+        lodValue(*packet.rayState[i], t[i], vsP[i]) : V3f(0.0);
+    }
+  } else if (!m_buffer) {
+    compactVoxelValues(vsP, inBounds, size, value);
+  } else if (hasTypedInterp(m_interpType) && m_denseBuffer) {
+    typedVoxelValues(Interp::DenseAccess<>(*m_denseBuffer), vsP, inBounds, 
+                     size, value);
+  } else if (hasTypedInterp(m_interpType) && m_sparseBuffer) {
+    typedVoxelValues(Interp::SparseAccess<>(*m_sparseBuffer, !m_isStreamed), 
+                     vsP, inBounds, size, value);
+  } else if (hasTypedInterp(m_interpType) && m_treeBuffer) {
+    typedVoxelValues(Interp::TreeAccess<>(*m_treeBuffer), vsP, inBounds, 
+                     size, value);
+  } else {
+    switch (m_interpType) {
+    case NoInterp:
+      for (size_t i = 0; i < size; ++i) {
+        if (inBounds[i]) {
+          V3i dvsP = contToDisc(vsP[i]);
+          value[i] = m_buffer->value(dvsP.x, dvsP.y, dvsP.z);
+        } else {
+          value[i] = V3f(0.0);
+        }
+      }
+      break;
+    case CubicInterp:
+      interpolatePacket(m_cubicInterp, *m_buffer, vsP, inBounds, size, value);
+      break;
+    case MonotonicCubicInterp:
+      interpolatePacket(m_monotonicCubicInterp, *m_buffer, vsP, inBounds, 
+                        size, value);
+      break;
+    case GaussianInterp:
+      interpolatePacket(m_gaussInterp, *m_buffer, vsP, inBounds, size, value);
+      break;
+    case MitchellInterp:
+      interpolatePacket(m_mitchellInterp, *m_buffer, vsP, inBounds, size, 
+                        value);
+      break;
+    case LinearInterp:
+    default:
+      interpolatePacket(m_linearInterp, *m_buffer, vsP, inBounds, size, value);
+      break;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::sampleExtinction(const VolumeSampleState &state,
+                                   Color &extinction, Color &holdout) const
+{
+  if (m_extinctionValue == V3f(0.0) && m_holdoutValue == V3f(0.0)) {
+    extinction = holdout = Colors::zero();
+    return;
+  }
+
+  const V3f value = voxelValue(state);
+
+  extinction = m_extinctionValue * value;
+  holdout    = m_holdoutValue * value;
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::maxAttributeValues(const BBox &wsBox,
+                                     const VolumeAttr *attributes,
+                                     const size_t numAttrs,
+                                     Color *maxValues) const
+{
+  assert(numAttrs <= MaxAttributes && "Too many attributes");
+
+  // Look up attribute indices ---
+
+  int  indices[MaxAttributes];
+  bool hasValidAttr = false;
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    indices[a] = m_attrTable.index(attributes[a]);
+    hasValidAttr |= indices[a] != VolumeAttr::IndexInvalid;
+  }
+
+  // All attributes scale the same buffer, so it only needs to be 
+  // scanned once ---
+
+  const V3f value = hasValidAttr ? maxVoxelValue(wsBox) : V3f(0.0);
+
+  for (size_t a = 0; a < numAttrs; ++a) {
+    if (indices[a] == VolumeAttr::IndexInvalid) {
+      maxValues[a] = Colors::zero();
+    } else {
+      maxValues[a] = Math::abs(m_attrValues[indices[a]]) * value;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::maxExtinction(const BBox &wsBox, Color &extinction,
+                                Color &holdout) const
+{
+  // Bounds the baked values that sampleExtinction() uses, which may come
+  // from an explicit extinction attribute
+  if (m_extinctionValue == V3f(0.0) && m_holdoutValue == V3f(0.0)) {
+    extinction = holdout = Colors::zero();
+    return;
+  }
+
+  const V3f value = maxVoxelValue(wsBox);
+
+  extinction = Math::abs(m_extinctionValue) * value;
+  holdout    = Math::abs(m_holdoutValue) * value;
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::hasConservativeBounds() const
+{
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::maxVoxelValue(const BBox &wsBox) const
+{
+  if (!m_field || wsBox.isEmpty() || !m_wsBounds.intersects(wsBox)) {
+    return V3f(0.0);
+  }
+
+  // Find the voxel space bounds of the box at the start and end of the
+  // shutter interval ---
+
+  const std::vector<Vector> wsCorners = Math::cornerPoints(wsBox);
+  BBox vsBox;
+
+  for (int shutter = 0; shutter < 2; ++shutter) {
+    const float time = static_cast<float>(shutter);
+    BOOST_FOREACH (const Vector &wsP, wsCorners) {
+      Vector vsP;
+      m_field->mapping()->worldToVoxel(wsP, vsP, time);
+      vsBox.extendBy(vsP);
+    }
+  }
+
+  // The macrocells already include the voxels that interpolation reads 
+  // from around each lookup, but coarser levels reach further ---
+
+  const V3i    padding(reducedDetailPadding());
+  DiscreteBBox dvsBox(contToDisc(vsBox.min) - padding, 
+                      contToDisc(vsBox.max) + padding);
+  dvsBox = Math::clipBounds(dvsBox, m_field->dataWindow());
 
-//----------------------------------------------------------------------------//
+  if (dvsBox.isEmpty()) {
+    return V3f(0.0);
+  }
 
-Volume::AttrNameVec VoxelVolume::attributeNames() const
-{
-  return m_attrNames;
+  // The shadow proxy may differ from m_buffer by up to its tolerance
+  return m_macrocells->maxAbsValue(dvsBox) * interpOvershoot(m_interpType) +
+    V3f(m_shadowProxyMaxError);
 }
 
 //----------------------------------------------------------------------------//
 
-VolumeSample VoxelVolume::sample(const VolumeSampleState &state,
-                                 const VolumeAttr &attribute) const
+int VoxelVolume::reducedDetailPadding() const
 {
-  // Check (and set up) attribute index ---
-
-  if (attribute.index() == VolumeAttr::IndexNotSet) {
-    setIndexForName(attribute, m_attrNames);
+  // Mip levels are box filtered, so they don't exceed the voxels they 
+  // cover. A lookup into the coarsest level reads its neighbors within 
+  // the interpolation support, each covering 1 / scale voxels of m_buffer.
+  // One more voxel covers the rounding of the level resolutions.
+  int padding = 0;
+  if (!m_mipLevels.empty()) {
+    const double scale = Math::min(m_mipLevels.back().scale);
+    padding = static_cast<int>(std::ceil((k_interpSupport + 1) / scale)) + 1;
   }
-  if (attribute.index() == VolumeAttr::IndexInvalid) {
-    return VolumeSample(Colors::zero(), m_phaseFunction);
+  // The shadow proxy is built the same way, and always read linearly
+  if (m_shadowProxy.buffer) {
+    const double scale = Math::min(m_shadowProxy.scale);
+    padding = std::max(padding, 
+                       static_cast<int>(std::ceil(2.0 / scale)) + 1);
   }
+  return padding;
+}
+
+//----------------------------------------------------------------------------//
 
+V3f VoxelVolume::voxelValue(const VolumeSampleState &state) const
+{
   // Transform to voxel space for sampling ---
   
-  Vector vsP;
-  m_buffer->mapping()->worldToVoxel(state.wsP, vsP, state.rayState.time);
+  const Vector vsP = voxelPosition(state);
 
-  if (!Math::isInBounds(vsP, m_buffer->dataWindow())) {
-    return VolumeSample(Colors::zero(), m_phaseFunction);
+  if (!Math::isInBounds(vsP, m_field->dataWindow())) {
+    return V3f(0.0);
+  }
+
+  // Shadow rays read from the shadow proxy, and footprints that cover 
+  // several voxels from a coarser mip level
+  if (m_shadowProxy.buffer || !m_mipLevels.empty()) {
+    const double t = state.isOnRay() ? 
+      state.t : (state.wsP - state.rayState.wsRay.pos).length();
+    return lodValue(state.rayState, t, vsP);
   }
 
-  // Interpolate voxel value ---
+  return baseValue(vsP);
+}
+
+//----------------------------------------------------------------------------//
 
-  V3f value(0.0);
+V3f VoxelVolume::interpolate(const VoxelBuffer &buffer, 
+                             const DenseBuffer *dense,
+                             const SparseBuffer *sparse,
+                             const Vector &vsP) const
+{
+  // Dense and sparse buffers are read directly, without a virtual call 
+  // per tap
+  if (hasTypedInterp(m_interpType)) {
+    if (dense) {
+      return typedVoxelValue(Interp::DenseAccess<>(*dense), vsP);
+    }
+    if (sparse) {
+      return typedVoxelValue(Interp::SparseAccess<>(*sparse, !m_isStreamed),
+                             vsP);
+    }
+  }
 
   switch (m_interpType) {
   case NoInterp:
     {
       V3i dvsP = contToDisc(vsP);
-      value = m_buffer->value(dvsP.x, dvsP.y, dvsP.z);
-      break;
+      return buffer.value(dvsP.x, dvsP.y, dvsP.z);
     }
   case CubicInterp:
-    value = m_cubicInterp.sample(*m_buffer, vsP);
-    break;
+    return m_cubicInterp.sample(buffer, vsP);
   case MonotonicCubicInterp:
-    value = m_monotonicCubicInterp.sample(*m_buffer, vsP);
-    break;
+    return m_monotonicCubicInterp.sample(buffer, vsP);
   case GaussianInterp:
-    value = m_gaussInterp.sample(*m_buffer, vsP);
-    break;
+    return m_gaussInterp.sample(buffer, vsP);
   case MitchellInterp:
-    value = m_mitchellInterp.sample(*m_buffer, vsP);
-    break;
+    return m_mitchellInterp.sample(buffer, vsP);
   case LinearInterp:
   default:
-    value = m_linearInterp.sample(*m_buffer, vsP);
-    break;
+    return m_linearInterp.sample(buffer, vsP);
   }
+}
 
-  return VolumeSample(m_attrValues[attribute.index()] * value, 
-                      m_phaseFunction);
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::lodValue(const RayState &rayState, const double t, 
+                          const Vector &vsP) const
+{
+  if (m_shadowProxy.buffer && rayState.rayDepth > 0) {
+    const Vector proxyVsP = 
+      (vsP - Vector(m_field->dataWindow().min)) * m_shadowProxy.scale;
+    if (m_shadowProxy.denseBuffer) {
+      return Interp::Linear().sample
+        (Interp::DenseAccess<>(*m_shadowProxy.denseBuffer), proxyVsP);
+    } 
+    return Interp::Linear().sample
+      (Interp::SparseAccess<>(*m_shadowProxy.sparseBuffer), proxyVsP);
+  }
+  return levelValue(mipLevel(rayState, t), vsP);
+}
+
+//----------------------------------------------------------------------------//
+
+bool VoxelVolume::isReducedDetail(const RayState &rayState, 
+                                  const double t) const
+{
+  return (m_shadowProxy.buffer && rayState.rayDepth > 0) || 
+    mipLevel(rayState, t) > 0;
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::baseValue(const Vector &vsP) const
+{
+  if (m_treeBuffer && hasTypedInterp(m_interpType)) {
+    return typedVoxelValue(Interp::TreeAccess<>(*m_treeBuffer), vsP);
+  }
+  if (m_buffer) {
+    return interpolate(*m_buffer, m_denseBuffer.get(), m_sparseBuffer.get(), 
+                       vsP);
+  }
+
+  // Reduced storage is always read with the typed interpolators
+  if (m_halfDenseBuffer) {
+    return typedVoxelValue(Interp::DenseAccess<V3h>(*m_halfDenseBuffer), 
+                           vsP);
+  }
+  if (m_halfSparseBuffer) {
+    return typedVoxelValue
+      (Interp::SparseAccess<V3h>(*m_halfSparseBuffer, !m_isStreamed), vsP);
+  }
+  if (m_scalarDenseBuffer) {
+    return typedVoxelValue(Interp::DenseAccess<float>(*m_scalarDenseBuffer),
+                           vsP);
+  }
+  if (m_scalarSparseBuffer) {
+    return typedVoxelValue
+      (Interp::SparseAccess<float>(*m_scalarSparseBuffer, !m_isStreamed), 
+       vsP);
+  }
+  if (m_halfScalarDenseBuffer) {
+    return typedVoxelValue
+      (Interp::DenseAccess<half>(*m_halfScalarDenseBuffer), vsP);
+  }
+  if (m_halfScalarSparseBuffer) {
+    return typedVoxelValue
+      (Interp::SparseAccess<half>(*m_halfScalarSparseBuffer, !m_isStreamed),
+       vsP);
+  }
+
+  return V3f(0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::compactVoxelValues(const Vector *vsP, const bool *inBounds,
+                                     const size_t size, V3f *values) const
+{
+  if (m_halfDenseBuffer) {
+    typedVoxelValues(Interp::DenseAccess<V3h>(*m_halfDenseBuffer), 
+                     vsP, inBounds, size, values);
+  } else if (m_halfSparseBuffer) {
+    typedVoxelValues(Interp::SparseAccess<V3h>(*m_halfSparseBuffer, 
+                                               !m_isStreamed), 
+                     vsP, inBounds, size, values);
+  } else if (m_scalarDenseBuffer) {
+    typedVoxelValues(Interp::DenseAccess<float>(*m_scalarDenseBuffer), 
+                     vsP, inBounds, size, values);
+  } else if (m_scalarSparseBuffer) {
+    typedVoxelValues(Interp::SparseAccess<float>(*m_scalarSparseBuffer, 
+                                                 !m_isStreamed), 
+                     vsP, inBounds, size, values);
+  } else if (m_halfScalarDenseBuffer) {
+    typedVoxelValues(Interp::DenseAccess<half>(*m_halfScalarDenseBuffer), 
+                     vsP, inBounds, size, values);
+  } else if (m_halfScalarSparseBuffer) {
+    typedVoxelValues(Interp::SparseAccess<half>(*m_halfScalarSparseBuffer,
+                                                !m_isStreamed),
+                     vsP, inBounds, size, values);
+  } else {
+    std::fill(values, values + size, V3f(0.0));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+V3f VoxelVolume::levelValue(const size_t level, const Vector &vsP) const
+{
+  if (level == 0) {
+    return baseValue(vsP);
+  }
+  // Each level maps the same local space onto fewer voxels
+  const MipLevel &mip = m_mipLevels[level - 1];
+  const Vector    mipVsP = 
+    (vsP - Vector(m_field->dataWindow().min)) * mip.scale;
+  return interpolate(*mip.buffer, mip.denseBuffer.get(), 
+                     mip.sparseBuffer.get(), mipVsP);
+}
+
+//----------------------------------------------------------------------------//
+
+size_t VoxelVolume::mipLevel(const RayState &rayState, const double t) const
+{
+  // Use the finest level whose voxels are no larger than the footprint
+  const double footprint = rayState.footprint(t);
+  if (m_mipLevels.empty() || footprint < 2.0 * m_wsVoxelSize) {
+    return 0;
+  }
+  const double level = std::log(footprint / m_wsVoxelSize) / std::log(2.0);
+  return std::min(static_cast<size_t>(level), m_mipLevels.size());
+}
+
+//----------------------------------------------------------------------------//
+
+Vector VoxelVolume::voxelPosition(const VolumeSampleState &state) const
+{
+  // Points along the ray are found by stepping along the cached voxel 
+  // space ray, which saves the virtual call and the transform
+  if (state.isOnRay()) {
+    const TransformedRay *vsRay = state.transformedRay(this);
+    if (!vsRay && 
+        state.numTransformedRays < VolumeSampleState::MaxTransformedRays) {
+      vsRay = state.cacheTransformedRay(this, voxelSpaceRay(state));
+    }
+    if (vsRay && vsRay->isValid) {
+      return (*vsRay)(state.t);
+    }
+  }
+
+  Vector vsP;
+  m_field->mapping()->worldToVoxel(state.wsP, vsP, state.rayState.time);
+  return vsP;
+}
+
+//----------------------------------------------------------------------------//
+
+TransformedRay 
+VoxelVolume::voxelSpaceRay(const VolumeSampleState &state) const
+{
+  FieldMapping::Ptr mapping = m_field->mapping();
+  const Ray        &wsRay   = state.rayState.wsRay;
+  const PTime       time    = state.rayState.time;
+
+  // Matrix mappings are affine, so the voxel space ray is just the 
+  // transformed origin and direction ---
+
+  if (field_dynamic_cast<MatrixFieldMapping>(mapping)) {
+    Vector vsPos, vsEnd;
+    mapping->worldToVoxel(wsRay.pos, vsPos, time);
+    mapping->worldToVoxel(wsRay.pos + wsRay.dir, vsEnd, time);
+    return TransformedRay::affine(vsPos, vsEnd - vsPos);
+  }
+
+  if (!field_dynamic_cast<FrustumFieldMapping>(mapping)) {
+    return TransformedRay();
+  }
+
+  // Frustum mappings are perspective transforms (or affine in depth, for
+  // the uniform z distribution), so each voxel space component is a linear
+  // fractional function of t. It's fitted to three points starting at the
+  // current sample. The origin of camera rays can't be used, since it 
+  // lies on the eye plane ---
+
+  const double t0 = state.t;
+  const double s  = k_frustumFitDistance * m_wsBounds.size().length();
+
+  if (m_wsBounds.isEmpty() || s <= 0.0) {
+    return TransformedRay();
+  }
+
+  Vector f0, f1, f2;
+  mapping->worldToVoxel(wsRay(t0), f0, time);
+  mapping->worldToVoxel(wsRay(t0 + s), f1, time);
+  mapping->worldToVoxel(wsRay(t0 + 2.0 * s), f2, time);
+
+  // With u = (t - t0) / s, each component is f(u) = (f0 + B u) / (1 + D u).
+  // Constant components have no defined D, so D is set to zero.
+  TransformedRay ray;
+  for (int dim = 0; dim < 3; ++dim) {
+    const double diff = f2[dim] - f1[dim];
+    const double D = 
+      std::abs(diff) > std::numeric_limits<double>::epsilon() * 
+      (std::abs(f1[dim]) + 1.0) ?
+      (2.0 * f1[dim] - f0[dim] - f2[dim]) / (2.0 * diff) : 0.0;
+    const double B = f1[dim] * (1.0 + D) - f0[dim];
+    // Substitute u and write as (a + b t) / (c + d t)
+    ray.b[dim] = B / s;
+    ray.d[dim] = D / s;
+    ray.a[dim] = f0[dim] - ray.b[dim] * t0;
+    ray.c[dim] = 1.0 - ray.d[dim] * t0;
+  }
+  ray.isAffine = false;
+  ray.isValid  = true;
+
+  // Verify the fit in between the fitted points, in case the mapping 
+  // isn't a plain perspective transform
+  Vector vsCheck;
+  mapping->worldToVoxel(wsRay(t0 + 0.5 * s), vsCheck, time);
+  if ((ray(t0 + 0.5 * s) - vsCheck).length() > k_frustumFitTolerance) {
+    return TransformedRay();
+  }
+
+  return ray;
 }
 
 //----------------------------------------------------------------------------//
@@ -542,12 +2323,20 @@ BBox VoxelVolume::wsBounds() const
 IntervalVec VoxelVolume::intersect(const RayState &state) const
 {
   assert (m_intersectionHandler && "Missing intersection handler");
-  if (m_eso && m_useEmptySpaceOptimization) {
-    IntervalVec i = m_intersectionHandler->intersect(state.wsRay, state.time);
-    return m_eso->optimize(state, i);                   
-  } else {
-    return m_intersectionHandler->intersect(state.wsRay, state.time);
+  IntervalVec i = m_intersectionHandler->intersect(state.wsRay, state.time);
+  if (m_useEmptySpaceOptimization && m_eso) {
+    i = m_eso->optimize(state, i);
+  }
+  if (m_useEmptySpaceOptimization && m_macrocellOptimizer) {
+    i = m_macrocellOptimizer->optimize(state, i);
+  }
+  // Mipmapped lookups filter away detail smaller than the ray footprint
+  if (!m_mipLevels.empty()) {
+    BOOST_FOREACH (Interval &interval, i) {
+      interval.scalesWithFootprint = true;
+    }
   }
+  return i;
 }
 
 //----------------------------------------------------------------------------//
@@ -558,11 +2347,28 @@ Volume::StringVec VoxelVolume::info() const
   for (size_t i = 0, size = m_attrNames.size(); i < size; ++i) {
     info.push_back(m_attrNames[i] + " : " + str(m_attrValues[i]));
   }
-  if (m_eso && m_useEmptySpaceOptimization) {
-    info.push_back("Empty space optimization: " + m_eso->typeName());
+  if (m_useEmptySpaceOptimization) {
+    if (m_eso) {
+      info.push_back("Empty space optimization: " + m_eso->typeName());
+    }
+    if (m_macrocells) {
+      info.push_back("Macrocell resolution: " + 
+                     str(m_macrocells->resolution()));
+    }
   } else {
     info.push_back("Empty space optimization disabled");
   }
+  if (!m_mipLevels.empty()) {
+    info.push_back("Mip levels: " + str(m_mipLevels.size()));
+  }
+  if (m_shadowProxy.buffer) {
+    info.push_back("Shadow proxy resolution: " + 
+                   str(m_shadowProxy.buffer->dataResolution()));
+  }
+  if (m_isStreamed) {
+    info.push_back(string("Streamed sparse blocks") + 
+                   (m_prefetcher ? ", prefetched" : ""));
+  }
   return info;
 }
 
@@ -572,49 +2378,308 @@ void VoxelVolume::load(const std::string &filename)
 {
   Log::print("Loading voxel buffer: " + filename);
 
-  Field<Imath::V3f>::Vec buffers;
   Field3DInputFile in;
   if (!in.open(filename)) {
     Log::warning("Couldn't load " + filename);
     return;
   }
 
-  buffers = in.readVectorLayers<float>();
-  if (buffers.size() == 0) {
-    Log::warning("No <float> fields could be loaded from " + filename);
+  // Full precision color fields take precedence over reduced storage
+  const string &name = m_layerName;
+  FieldRes::Ptr field;
+  Field<V3f>::Vec   colorFields      = in.readVectorLayers<float>(name);
+  Field<V3h>::Vec   halfColorFields;
+  Field<float>::Vec scalarFields;
+  Field<half>::Vec  halfScalarFields;
+  if (!colorFields.empty()) {
+    field = colorFields[0];
+  } else if (!(halfColorFields = in.readVectorLayers<half>(name)).empty()) {
+    field = halfColorFields[0];
+  } else if (!(scalarFields = in.readScalarLayers<float>(name)).empty()) {
+    field = scalarFields[0];
+  } else if (!(halfScalarFields = in.readScalarLayers<half>(name)).empty()) {
+    field = halfScalarFields[0];
+  } else {
+    Log::warning("No <float> or <half> fields " + 
+                 (name.empty() ? string() : "named " + name + " ") + 
+                 "could be loaded from " + filename);
     return;
   }
 
-  DenseBuffer::Ptr denseBuffer = field_dynamic_cast<DenseBuffer>(buffers[0]);
-  if (denseBuffer) {
-    m_buffer = denseBuffer;
-  } else {
-    Log::warning("No DenseField in: " + filename);
+  // With a limited block cache, Field3D reads sparse fields lazily, one 
+  // block at a time
+  const bool isStreamed = 
+    SparseFileManager::singleton().doLimitMemUse() && 
+    sparseBlockSize(field) > 0;
+  if (isStreamed) {
+    Log::print("  Streaming sparse blocks from file");
   }
-  
-  updateIntersectionHandler();
+
+  updateField(field, isStreamed);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setLayerName(const std::string &layerName)
+{
+  m_layerName = layerName;
 }
 
 //----------------------------------------------------------------------------//
 
 void VoxelVolume::setBuffer(VoxelBuffer::Ptr buffer)
 {
-  m_buffer = buffer;
+  updateField(buffer, false);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setField(FieldRes::Ptr field)
+{
+  updateField(field, false);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateField(FieldRes::Ptr field, const bool isStreamed)
+{
+  m_field      = field;
+  m_isStreamed = isStreamed;
+  updateTypedBuffers();
+  if (m_field && !m_buffer && !m_halfDenseBuffer && !m_halfSparseBuffer &&
+      !m_scalarDenseBuffer && !m_scalarSparseBuffer && 
+      !m_halfScalarDenseBuffer && !m_halfScalarSparseBuffer) {
+    Log::warning("VoxelVolume: Unsupported buffer type: " + 
+                 m_field->className());
+    m_field.reset();
+    updateTypedBuffers();
+  }
   updateIntersectionHandler();
-  SparseBuffer::Ptr sparse = field_dynamic_cast<SparseBuffer>(buffer);
-  if (sparse) {
+  updateEmptySpaceOptimizer();
+  updateMacrocells();
+  updateMipmaps();
+  updateShadowProxy();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateEmptySpaceOptimizer()
+{
+  // The prefetcher's thread must stop before a new one starts reading
+  m_eso.reset();
+  m_prefetcher.reset();
+
+  if (m_treeBuffer) {
     MatrixFieldMapping::Ptr mMapping = 
-      field_dynamic_cast<MatrixFieldMapping>(sparse->mapping());
-    FrustumFieldMapping::Ptr fMapping = 
-      field_dynamic_cast<FrustumFieldMapping>(sparse->mapping());
+      field_dynamic_cast<MatrixFieldMapping>(m_treeBuffer->mapping());
     if (mMapping) {
-      m_eso = SparseUniformOptimizer::create(sparse, mMapping);
-    } else if (fMapping) {
-      m_eso = SparseFrustumOptimizer::create(sparse, fMapping);
-    } else {
-      Log::warning("VoxelVolume::setBuffer(): Unrecognized mapping type.");
+      m_eso = TreeOptimizer::create(m_treeBuffer, mMapping);
+    }
+    return;
+  }
+
+  if (!m_sparseBuffer) {
+    return;
+  }
+
+  if (m_isStreamed && m_useBlockPrefetch) {
+    m_prefetcher = SparseBlockPrefetcher::create(m_sparseBuffer, 
+                                                 k_maxQueuedBlocks);
+  }
+
+  MatrixFieldMapping::Ptr mMapping = 
+    field_dynamic_cast<MatrixFieldMapping>(m_sparseBuffer->mapping());
+  FrustumFieldMapping::Ptr fMapping = 
+    field_dynamic_cast<FrustumFieldMapping>(m_sparseBuffer->mapping());
+  if (mMapping) {
+    m_eso = SparseUniformOptimizer::create(m_sparseBuffer, mMapping, 
+                                           m_prefetcher);
+  } else if (fMapping) {
+    m_eso = SparseFrustumOptimizer::create(m_sparseBuffer, fMapping, 
+                                           m_prefetcher);
+  } else {
+    Log::warning("VoxelVolume: Unrecognized mapping type.");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateTypedBuffers()
+{
+  m_buffer                 = field_dynamic_cast<VoxelBuffer>(m_field);
+  m_denseBuffer            = field_dynamic_cast<DenseBuffer>(m_field);
+  m_sparseBuffer           = field_dynamic_cast<SparseBuffer>(m_field);
+  m_treeBuffer             = field_dynamic_cast<TreeBuffer>(m_field);
+  m_halfDenseBuffer        = field_dynamic_cast<HalfDenseBuffer>(m_field);
+  m_halfSparseBuffer       = field_dynamic_cast<HalfSparseBuffer>(m_field);
+  m_scalarDenseBuffer      = field_dynamic_cast<ScalarDenseBuffer>(m_field);
+  m_scalarSparseBuffer     = field_dynamic_cast<ScalarSparseBuffer>(m_field);
+  m_halfScalarDenseBuffer  = 
+    field_dynamic_cast<HalfScalarDenseBuffer>(m_field);
+  m_halfScalarSparseBuffer = 
+    field_dynamic_cast<HalfScalarSparseBuffer>(m_field);
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateMipmaps()
+{
+  m_mipLevels.clear();
+
+  if (!m_useMipmaps || !m_field) {
+    return;
+  }
+
+  if (!canDownsample(m_field, "Mipmaps")) {
+    return;
+  }
+
+  Log::print("Building mipmaps");
+
+  Timer timer;
+
+  // Smallest world space voxel edge, used to pick levels
+  const FieldMapping::Ptr mapping = m_buffer->mapping();
+  Vector wsOrigin, wsX, wsY, wsZ;
+  mapping->voxelToWorld(Vector(0.0, 0.0, 0.0), wsOrigin);
+  mapping->voxelToWorld(Vector(1.0, 0.0, 0.0), wsX);
+  mapping->voxelToWorld(Vector(0.0, 1.0, 0.0), wsY);
+  mapping->voxelToWorld(Vector(0.0, 0.0, 1.0), wsZ);
+  m_wsVoxelSize = std::min((wsX - wsOrigin).length(), 
+                           std::min((wsY - wsOrigin).length(),
+                                    (wsZ - wsOrigin).length()));
+
+  const Vector     baseRes(m_buffer->dataResolution());
+  VoxelBuffer::Ptr fine = m_buffer;
+
+  while (Math::max(fine->dataResolution()) > 1 && 
+         m_mipLevels.size() < k_maxMipLevels) {
+    m_mipLevels.push_back(MipLevel(downsample(fine), baseRes));
+    fine = m_mipLevels.back().buffer;
+  }
+
+  Log::print("  Levels: " + str(m_mipLevels.size()));
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateShadowProxy()
+{
+  m_shadowProxy         = MipLevel();
+  m_shadowProxyMaxError = 0.0f;
+
+  if (!m_useShadowProxy || !m_field || !m_macrocells) {
+    return;
+  }
+
+  if (!canDownsample(m_field, "Shadow proxies")) {
+    return;
+  }
+
+  Log::print("Building shadow proxy");
+
+  Timer timer;
+
+  // The tolerance is relative to the largest voxel value
+  const float tolerance = m_shadowProxyTolerance * 
+    Math::max(m_macrocells->maxAbsValue(m_buffer->dataWindow()));
+
+  // Keep halving the resolution until the error is too large
+  const Vector     baseRes(m_buffer->dataResolution());
+  VoxelBuffer::Ptr fine = m_buffer;
+
+  while (Math::max(fine->dataResolution()) > 1) {
+    const MipLevel level(downsample(fine), baseRes);
+    if (shadowProxyError(level, tolerance) > tolerance) {
+      break;
+    }
+    m_shadowProxy = level;
+    fine = level.buffer;
+  }
+
+  if (m_shadowProxy.buffer) {
+    m_shadowProxyMaxError = tolerance;
+    Log::print("  Resolution: " + 
+               str(m_shadowProxy.buffer->dataResolution()));
+  } else {
+    Log::print("  No reduced resolution within tolerance");
+  }
+  Log::print("  Time elapsed: " + str(timer.elapsed()));
+}
+
+//----------------------------------------------------------------------------//
+
+float VoxelVolume::shadowProxyError(const MipLevel &proxy, 
+                                    const float tolerance) const
+{
+  // Every macrocell is compared, including empty and constant ones. The
+  // proxy blurs varying macrocells into their neighbors, which may bleed 
+  // density into empty space or shift a constant region's value.
+  // Macrocells are still used to walk the buffer, so that the comparison 
+  // can stop as soon as one of them exceeds the tolerance.
+  const V3i res = m_macrocells->resolution();
+  float     error = 0.0f;
+
+  for (int k = 0; k < res.z; ++k) {
+    for (int j = 0; j < res.y; ++j) {
+      for (int i = 0; i < res.x; ++i) {
+        const V3i    cell(i, j, k);
+        const V3i    cellMin = 
+          contToDisc(m_macrocells->cellOrigin(cell) + Vector(0.5));
+        DiscreteBBox dvsBox(cellMin, 
+                            cellMin + V3i(m_macrocells->cellSize() - 1));
+        dvsBox = Math::clipBounds(dvsBox, m_buffer->dataWindow());
+        if (m_denseBuffer) {
+          error = std::max(error, 
+                           proxyError(*m_denseBuffer, 
+                                      Interp::DenseAccess<>(*proxy.denseBuffer),
+                                      proxy.scale, dvsBox));
+        } else {
+          error = std::max(error, 
+                           proxyError(*m_sparseBuffer, 
+                                      Interp::SparseAccess<>
+                                      (*proxy.sparseBuffer),
+                                      proxy.scale, dvsBox));
+        }
+        if (error > tolerance) {
+          return error;
+        }
+      }
     }
   }
+
+  return error;
+}
+
+//----------------------------------------------------------------------------//
+
+VoxelVolume::MipLevel::MipLevel(VoxelBuffer::Ptr levelBuffer, 
+                                const Vector &baseRes)
+  : buffer(levelBuffer), 
+    denseBuffer(field_dynamic_cast<DenseBuffer>(levelBuffer)),
+    sparseBuffer(field_dynamic_cast<SparseBuffer>(levelBuffer)),
+    scale(Vector(levelBuffer->dataResolution()) / baseRes)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::updateMacrocells()
+{
+  if (!m_field) {
+    m_macrocells.reset();
+    m_macrocellOptimizer.reset();
+    return;
+  }
+  // Sparse buffers use their block size, so that each unallocated block 
+  // maps to whole macrocells
+  const int blockSize = sparseBlockSize(m_field);
+  const int cellSize  = blockSize > 0 ? blockSize : k_macrocellSize;
+  m_macrocells = MacrocellGrid::create(m_field, cellSize);
+  m_macrocellOptimizer = 
+    MacrocellOptimizer::create(m_macrocells, m_field->mapping());
 }
 
 //----------------------------------------------------------------------------//
@@ -622,8 +2687,10 @@ void VoxelVolume::setBuffer(VoxelBuffer::Ptr buffer)
 void VoxelVolume::addAttribute(const std::string &attrName, 
                                const Imath::V3f &value)
 {
+  m_attrTable.addAttribute(attrName, m_attrNames.size());
   m_attrNames.push_back(attrName);
   m_attrValues.push_back(value);
+  updateExtinction();
 }
 
 //----------------------------------------------------------------------------//
@@ -642,20 +2709,63 @@ void VoxelVolume::setUseEmptySpaceOptimization(const bool enabled)
 
 //----------------------------------------------------------------------------//
 
+void VoxelVolume::setUseMipmaps(const bool enabled)
+{
+  m_useMipmaps = enabled;
+  updateMipmaps();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setUseShadowProxy(const bool enabled)
+{
+  m_useShadowProxy = enabled;
+  updateShadowProxy();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setShadowProxyTolerance(const float tolerance)
+{
+  m_shadowProxyTolerance = tolerance;
+  updateShadowProxy();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setUseBlockPrefetch(const bool enabled)
+{
+  m_useBlockPrefetch = enabled;
+  updateEmptySpaceOptimizer();
+}
+
+//----------------------------------------------------------------------------//
+
+void VoxelVolume::setSparseCacheSize(const float megabytes)
+{
+  SparseFileManager &manager = SparseFileManager::singleton();
+  manager.setLimitMemUse(megabytes > 0.0f);
+  if (megabytes > 0.0f) {
+    manager.setMaxMemUse(megabytes);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 void VoxelVolume::updateIntersectionHandler()
 {
   // Error checks
-  if (!m_buffer) {
+  if (!m_field) {
     throw MissingBufferException();
   }
-  if (!m_buffer->mapping()) {
+  if (!m_field->mapping()) {
     throw MissingMappingException();
   }
   // Update intersection handler
   MatrixFieldMapping::Ptr matrixMapping = 
-    field_dynamic_cast<MatrixFieldMapping>(m_buffer->mapping());
+    field_dynamic_cast<MatrixFieldMapping>(m_field->mapping());
   FrustumFieldMapping::Ptr frustumMapping = 
-    field_dynamic_cast<FrustumFieldMapping>(m_buffer->mapping());
+    field_dynamic_cast<FrustumFieldMapping>(m_field->mapping());
   if (matrixMapping) {
     m_intersectionHandler.reset(new UniformMappingIntersection(matrixMapping));
   } else if (frustumMapping) {
@@ -670,7 +2780,7 @@ void VoxelVolume::updateIntersectionHandler()
   Vector wsP;
   for (std::vector<Vector>::iterator lsP = lsCorners.begin(), end = lsCorners.end(); 
        lsP != end; ++lsP) {
-    m_buffer->mapping()->localToWorld(*lsP, wsP);
+    m_field->mapping()->localToWorld(*lsP, wsP);
     m_wsBounds.extendBy(wsP);
   }
 }
@@ -694,6 +2804,33 @@ Interval makeInterval(const Ray &wsRay, const double t0, const double t1,
 
 //----------------------------------------------------------------------------//
 
+void VoxelVolume::updateExtinction()
+{
+  const int exIndex = m_attrTable.index(k_extinctionAttr);
+  const int scIndex = m_attrTable.index(k_scatteringAttr);
+  const int abIndex = m_attrTable.index(k_absorptionAttr);
+  const int hoIndex = m_attrTable.index(k_holdoutAttr);
+
+  m_extinctionValue = V3f(0.0);
+  m_holdoutValue    = V3f(0.0);
+
+  if (exIndex != VolumeAttr::IndexInvalid) {
+    m_extinctionValue = m_attrValues[exIndex];
+  } else {
+    if (scIndex != VolumeAttr::IndexInvalid) {
+      m_extinctionValue += m_attrValues[scIndex];
+    }
+    if (abIndex != VolumeAttr::IndexInvalid) {
+      m_extinctionValue += m_attrValues[abIndex];
+    }
+  }
+  if (hoIndex != VolumeAttr::IndexInvalid) {
+    m_holdoutValue = m_attrValues[hoIndex];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Render
 } // namespace pvr
 